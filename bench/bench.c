@@ -0,0 +1,328 @@
+/*
+ * Microbenchmarks for Foxy's hot paths: `make bench`.
+ *
+ * Prints one JSON object per line:
+ *   {"bench":"tokenize/short","iters":N,"ns_per_op":X,"allocs_per_op":Y,"bytes_per_op":Z}
+ *
+ * Allocations are counted by wrapping malloc, calloc, realloc and strdup at
+ * link time (-Wl,--wrap=...), so only calls made from Foxy's own code are
+ * seen, and only on the thread running the benchmark.
+ */
+#include "foxy.h"
+#include "alias.h"
+#include "history.h"
+#include "complete.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(p) _mkdir(p)
+#else
+#define make_dir(p) mkdir(p, 0755)
+#endif
+
+#define BENCH_MIN_NS 200000000ull  // run each benchmark for at least 0.2 s
+#define MAX_BENCH_LINE 8192
+#define HISTORY_LINES 100000
+#define DIR_FILES 10000
+
+/* Allocation counting */
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+char *__real_strdup(const char *s);
+
+static _Thread_local int counting;
+static unsigned long long alloc_count, alloc_bytes;
+
+void *__wrap_malloc(size_t n)
+{
+    if (counting) { alloc_count++; alloc_bytes += n; }
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    if (counting) { alloc_count++; alloc_bytes += n * size; }
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+    if (counting) { alloc_count++; alloc_bytes += n; }
+    return __real_realloc(p, n);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    if (counting) { alloc_count++; alloc_bytes += strlen(s) + 1; }
+    return __real_strdup(s);
+}
+
+/* Driver */
+
+static const char *only; // run benchmarks whose name starts with this
+
+static void run(const char *name, void (*op)(void *), void *arg)
+{
+    if (only && strncmp(name, only, strlen(only)) != 0) return;
+
+    op(arg); // warm caches and lazy indexes
+    unsigned long long iters = 1, elapsed = 0;
+    while (1)
+    {
+        alloc_count = alloc_bytes = 0;
+        counting = 1;
+        uint64_t t0 = foxy_clock_ns();
+        for (unsigned long long i = 0; i < iters; ++i) op(arg);
+        elapsed = foxy_clock_ns() - t0;
+        counting = 0;
+        if (elapsed >= BENCH_MIN_NS || iters >= (1ull << 32)) break;
+        iters *= elapsed < BENCH_MIN_NS / 100 ? 10 : 2;
+    }
+    printf("{\"bench\":\"%s\",\"iters\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+           name, iters, (double)elapsed / iters, (double)alloc_count / iters, (double)alloc_bytes / iters);
+    fflush(stdout);
+}
+
+/* Corpora */
+
+static const char *line_short = "ls -l src";
+static char line_long[MAX_BENCH_LINE];
+static char line_patho[MAX_BENCH_LINE];
+
+static void build_corpora()
+{
+    // A realistic but long command: many arguments, quotes, pipes, redirects
+    size_t n = 0;
+    const char *parts[] = { "git log --oneline \"src/main.c\" ", "| grep -v 'merge commit' ", "&& echo $HOME/build ", "> out.txt ; " };
+    for (int i = 0; n + 64 < 4096; ++i)
+    {
+        const char *p = parts[i % 4];
+        memcpy(line_long + n, p, strlen(p));
+        n += strlen(p);
+    }
+    line_long[n] = '\0';
+
+    // Pathological: a thousand-stage pipeline of tiny quoted words, no spaces
+    n = 0;
+    while (n + 8 < 4096)
+    {
+        memcpy(line_patho + n, "a\"b\"c|", 6);
+        n += 6;
+    }
+    line_patho[n++] = 'z';
+    line_patho[n] = '\0';
+}
+
+/* Lexer and parser */
+
+static void op_tokenize(void *arg)
+{
+    token_list_t t = {0};
+    lex_err_t err;
+    tokenize_line(arg, &t, &err);
+    free_token_list(&t);
+}
+
+static void op_parse(void *arg)
+{
+    node_t *ast = parse_tokens(arg);
+    free_ast(ast);
+}
+
+static hl_class_t classify_all(const char *word, size_t len)
+{
+    (void)word;
+    (void)len;
+    return HL_COMMAND;
+}
+
+static void op_highlight(void *arg)
+{
+    static lex_state_t states[MAX_BENCH_LINE + 1];
+    static unsigned char classes[MAX_BENCH_LINE];
+    states[0] = LEX_STATE_INIT;
+    lex_highlight(arg, strlen(arg), 0, states, classes, classify_all);
+}
+
+static void bench_lexer()
+{
+    const char *names[] = { "short", "long", "pathological" };
+    const char *lines[] = { line_short, line_long, line_patho };
+    char name[64];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        snprintf(name, sizeof(name), "tokenize/%s", names[i]);
+        run(name, op_tokenize, (void *)lines[i]);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        token_list_t t = {0};
+        lex_err_t err;
+        if (tokenize_line(lines[i], &t, &err) != 0) continue;
+        snprintf(name, sizeof(name), "parse_free/%s", names[i]);
+        run(name, op_parse, &t);
+        free_token_list(&t);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        snprintf(name, sizeof(name), "highlight/%s", names[i]);
+        run(name, op_highlight, (void *)lines[i]);
+    }
+}
+
+/* Aliases */
+
+static void op_alias(void *arg)
+{
+    volatile const char *v = alias_resolve(arg);
+    (void)v;
+}
+
+static void bench_alias()
+{
+    alias_init();
+    char name[32], value[64];
+    for (int i = 0; i < MAX_ALIASES; ++i)
+    {
+        snprintf(name, sizeof(name), "alias%02d", i);
+        snprintf(value, sizeof(value), "command --option-%d", i);
+        alias_add(name, value);
+    }
+    snprintf(name, sizeof(name), "alias%02d", MAX_ALIASES - 1);
+    run("alias_resolve/hit_last", op_alias, name);
+    run("alias_resolve/miss", op_alias, "no-such-alias");
+}
+
+/* History */
+
+static unsigned long long history_seq;
+
+static void op_add_history(void *arg)
+{
+    (void)arg;
+    char line[64];
+    snprintf(line, sizeof(line), "make -j8 target-%llu", history_seq++);
+    add_to_history(line);
+}
+
+static void op_find(void *arg)
+{
+    volatile int i = history_find(arg, history_length());
+    (void)i;
+}
+
+static void op_fuzzy(void *arg)
+{
+    int out[64];
+    volatile int n = history_fuzzy(arg, out, 64);
+    (void)n;
+}
+
+static void bench_history()
+{
+    // A full history of distinct commands, as a long-lived user would have
+    FILE *fp = fopen(".foxy_history", "w");
+    if (!fp) return;
+    for (int i = 0; i < HISTORY_LINES; ++i)
+    {
+        fprintf(fp, "git commit -m \"change %d\" --author=dev%d src/file%d.c\n", i, i % 97, i % 1013);
+    }
+    fclose(fp);
+
+    history_init();
+    history_load();
+    run("history_find/recent", op_find, "change 99990");
+    run("history_find/oldest", op_find, "change 5\"");
+    run("history_find/miss", op_find, "no such command");
+    run("history_fuzzy/gcm", op_fuzzy, "gcm");
+    run("add_to_history", op_add_history, NULL);
+}
+
+/* Completion */
+
+typedef struct
+{
+    const char *dir;
+    const char *prefix;
+} lookup_t;
+
+static void op_complete_files(void *arg)
+{
+    lookup_t *l = arg;
+    const char *const *names;
+    size_t count;
+    complete_files(l->dir, l->prefix, strlen(l->prefix), &names, &count);
+}
+
+static void op_complete_commands(void *arg)
+{
+    const char *const *names;
+    size_t count;
+    complete_commands(arg, strlen(arg), &names, &count);
+}
+
+static void bench_complete()
+{
+    make_dir("files");
+    char path[64];
+    for (int i = 0; i < DIR_FILES; ++i)
+    {
+        snprintf(path, sizeof(path), "files/file_%05d.txt", i);
+        FILE *fp = fopen(path, "w");
+        if (fp) fclose(fp);
+    }
+
+    // Listings taken within a second of the directory changing are never
+    // trusted; wait that out so the cached path is what gets measured
+    sleep(2);
+
+    lookup_t one = { "files", "file_0999" }, all = { "files", "" };
+    run("complete_files/prefix", op_complete_files, &one);
+    run("complete_files/all", op_complete_files, &all);
+
+    // The PATH index is built in the background; wait up to 5 s for it
+    const char *const *names;
+    size_t count;
+    for (int i = 0; i < 500 && complete_commands("", 0, &names, &count) != 0; ++i) usleep(10000);
+    run("complete_commands/prefix", op_complete_commands, "g");
+
+    for (int i = 0; i < DIR_FILES; ++i)
+    {
+        snprintf(path, sizeof(path), "files/file_%05d.txt", i);
+        remove(path);
+    }
+    rmdir("files");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) only = argv[1];
+
+    // History and completion work on files: keep them out of the tree
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "bench_tmp_%d", (int)getpid());
+    if (make_dir(tmp) != 0 || chdir(tmp) != 0)
+    {
+        perror("bench: temp dir");
+        return 1;
+    }
+
+    build_corpora();
+    bench_lexer();
+    bench_alias();
+    bench_history();
+    bench_complete();
+
+    remove(".foxy_history");
+    if (chdir("..") == 0) rmdir(tmp);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * End-to-end executor benchmarks: `make bench-e2e`.
+ *
+ * Each workload is one command line, parsed once and run repeatedly through
+ * exec_node() in this process. The same workload is then run as a script
+ * (the line repeated) under `foxy -c` and, when installed, dash and bash,
+ * timing the whole shell process. One JSON object per line:
+ *   {"bench":"spawn/true","shell":"exec_node","ops":N,"us_per_op":X,"mb_per_s":Y}
+ * mb_per_s is only given for pipelines. E2E_SCALE=<n> multiplies the counts.
+ *
+ * Needs a POSIX userland (true, false, cat, head, /dev/zero).
+ */
+#include "foxy.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define make_dir(p) _mkdir(p)
+#define PATH_SEP ';'
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#define make_dir(p) mkdir(p, 0755)
+#define PATH_SEP ':'
+extern char **environ;
+#endif
+
+#define PIPE_BYTES (64u << 20)
+#define MAX_SCRIPT (1u << 17)  // one argv string must stay under 128 KB on Linux
+
+typedef struct
+{
+    const char *name;
+    char line[512];
+    int ops;                  // runs of the line
+    unsigned long long bytes; // moved per run, for pipelines
+} workload_t;
+
+static void report(const workload_t *w, const char *shell, int ops, uint64_t ns)
+{
+    printf("{\"bench\":\"%s\",\"shell\":\"%s\",\"ops\":%d,\"us_per_op\":%.2f", w->name, shell, ops, ns / 1e3 / ops);
+    if (w->bytes) printf(",\"mb_per_s\":%.1f", (double)w->bytes * ops / (1 << 20) / (ns / 1e9));
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void run_in_process(const workload_t *w)
+{
+    token_list_t tokens = {0};
+    lex_err_t err;
+    if (tokenize_line(w->line, &tokens, &err) != 0) return;
+    node_t *ast = parse_tokens(&tokens);
+    if (!ast)
+    {
+        free_token_list(&tokens);
+        return;
+    }
+
+    uint64_t t0 = foxy_clock_ns();
+    for (int i = 0; i < w->ops; ++i) exec_node(ast);
+    report(w, "exec_node", w->ops, foxy_clock_ns() - t0);
+
+    free_ast(ast);
+    free_token_list(&tokens);
+}
+
+// Full path of prog if it is on PATH (or prog itself if it has a slash)
+static char *find_program(const char *prog)
+{
+    if (strchr(prog, '/')) return access(prog, X_OK) == 0 ? strdup(prog) : NULL;
+    const char *path = getenv("PATH");
+    while (path && *path)
+    {
+        const char *end = strchr(path, PATH_SEP);
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        char full[4096];
+        snprintf(full, sizeof(full), "%.*s/%s", (int)len, path, prog);
+        if (len > 0 && access(full, X_OK) == 0) return strdup(full);
+        path = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+static int run_program(char **argv)
+{
+#ifdef _WIN32
+    return (int)_spawnv(_P_WAIT, argv[0], (const char * const *)argv);
+#else
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0) return -1;
+    int st;
+    if (waitpid(pid, &st, 0) < 0) return -1;
+    return WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+#endif
+}
+
+// The line repeated as a script under `shell -c`; long runs are split into
+// several scripts so each stays a valid argument
+static void run_in_shell(const workload_t *w, const char *label, const char *shell)
+{
+    size_t line_len = strlen(w->line) + 1;
+    int per_script = (int)(MAX_SCRIPT / line_len);
+    if (per_script < 1) return;
+    char *script = malloc(MAX_SCRIPT + 1);
+    if (!script) return;
+
+    uint64_t ns = 0;
+    for (int done = 0; done < w->ops;)
+    {
+        int n = w->ops - done < per_script ? w->ops - done : per_script;
+        size_t len = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            memcpy(script + len, w->line, line_len - 1);
+            len += line_len - 1;
+            script[len++] = '\n';
+        }
+        script[len] = '\0';
+
+        char *argv[] = { (char *)shell, "-c", script, NULL };
+        uint64_t t0 = foxy_clock_ns();
+        if (run_program(argv) < 0)
+        {
+            fprintf(stderr, "bench-e2e: could not run %s\n", shell);
+            free(script);
+            return;
+        }
+        ns += foxy_clock_ns() - t0;
+        done += n;
+    }
+    report(w, label, w->ops, ns);
+    free(script);
+}
+
+int main(int argc, char **argv)
+{
+    int scale = 1;
+    const char *env = getenv("E2E_SCALE");
+    if (env && atoi(env) > 0) scale = atoi(env);
+
+    // Comparison shells, resolved before leaving the build directory
+    const char *labels[] = { "foxy", "dash", "bash" };
+    char *shells[3] = { argc > 1 ? find_program(argv[1]) : NULL, find_program("dash"), find_program("bash") };
+    if (shells[0] && shells[0][0] != '/')
+    {
+        char cwd[4096], full[8192];
+        if (getcwd(cwd, sizeof(cwd)))
+        {
+            snprintf(full, sizeof(full), "%s/%s", cwd, shells[0]);
+            free(shells[0]);
+            shells[0] = strdup(full);
+        }
+    }
+
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "bench_tmp_%d", (int)getpid());
+    if (make_dir(tmp) != 0 || chdir(tmp) != 0)
+    {
+        perror("bench-e2e: temp dir");
+        return 1;
+    }
+    FILE *fp = fopen("in.txt", "w");
+    if (fp)
+    {
+        for (int i = 0; i < 1000; ++i) fprintf(fp, "line %d of the redirection input\n", i);
+        fclose(fp);
+    }
+
+    // Full paths, so dash and bash spawn them too instead of using builtins
+    char *t = find_program("true"), *f = find_program("false");
+    if (!t || !f)
+    {
+        fprintf(stderr, "bench-e2e: true and false must be on PATH\n");
+        return 1;
+    }
+
+    workload_t w[16];
+    int n = 0;
+    w[n] = (workload_t){ "spawn/true", "", 10000 * scale, 0 };
+    snprintf(w[n++].line, sizeof(w[0].line), "%s", t);
+    w[n] = (workload_t){ "redirect/out", "", 2000 * scale, 0 };
+    snprintf(w[n++].line, sizeof(w[0].line), "%s > out.txt", t);
+    w[n++] = (workload_t){ "redirect/in_out", "cat < in.txt > out.txt", 2000 * scale, 0 };
+    w[n] = (workload_t){ "chain/and10", "", 500 * scale, 0 };
+    for (int k = 0, len = 0; k < 10; ++k) len += snprintf(w[n].line + len, sizeof(w[0].line) - len, "%s%s", k ? " && " : "", t);
+    n++;
+    w[n] = (workload_t){ "chain/or10", "", 500 * scale, 0 };
+    for (int k = 0, len = 0; k < 10; ++k) len += snprintf(w[n].line + len, sizeof(w[0].line) - len, "%s%s", k ? " || " : "", k < 9 ? f : t);
+    n++;
+    int stages[] = { 2, 4, 8 };
+    for (int s = 0; s < 3; ++s)
+    {
+        workload_t *p = &w[n++];
+        static const char *names[] = { "pipe/2", "pipe/4", "pipe/8" };
+        *p = (workload_t){ names[s], "", 5 * scale, PIPE_BYTES };
+        int len = snprintf(p->line, sizeof(p->line), "head -c %u /dev/zero", PIPE_BYTES);
+        for (int k = 1; k < stages[s]; ++k) len += snprintf(p->line + len, sizeof(p->line) - len, " | cat");
+        snprintf(p->line + len, sizeof(p->line) - len, " > /dev/null");
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        run_in_process(&w[i]);
+        for (int s = 0; s < 3; ++s)
+        {
+            if (shells[s]) run_in_shell(&w[i], labels[s], shells[s]);
+        }
+    }
+
+    remove("in.txt");
+    remove("out.txt");
+    if (chdir("..") == 0) rmdir(tmp);
+    for (int s = 0; s < 3; ++s) free(shells[s]);
+    free(t);
+    free(f);
+    return 0;
+}
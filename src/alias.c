@@ -1,10 +1,9 @@
 #include "alias.h"
+#include "mem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_ALIASES 50
-
 typedef struct 
 {
     char *name;
@@ -27,8 +26,8 @@ int alias_add(const char *name, const char *value)
     {
         if (aliases[i].name && strcmp(aliases[i].name, name) == 0)
         {
-            free(aliases[i].value);
-            aliases[i].value = strdup(value);
+            mem_free(aliases[i].value);
+            aliases[i].value = mem_strdup(MEM_ALIAS, value);
             return 0;
         }
     }
@@ -38,8 +37,8 @@ int alias_add(const char *name, const char *value)
     {
         if (aliases[i].name == NULL)
         {
-            aliases[i].name = strdup(name);
-            aliases[i].value = strdup(value);
+            aliases[i].name = mem_strdup(MEM_ALIAS, name);
+            aliases[i].value = mem_strdup(MEM_ALIAS, value);
             return 0;
         }
     }
@@ -54,8 +53,8 @@ int alias_remove(const char *name)
     {
         if (aliases[i].name && strcmp(aliases[i].name, name) == 0)
         {
-            free(aliases[i].name);
-            free(aliases[i].value);
+            mem_free(aliases[i].name);
+            mem_free(aliases[i].value);
             aliases[i].name = NULL;
             aliases[i].value = NULL;
             return 0;
@@ -76,6 +75,16 @@ const char *alias_resolve(const char *name)
     return NULL;
 }
 
+int alias_names(const char **out, int max)
+{
+    int n = 0;
+    for (int i = 0; i < MAX_ALIASES && n < max; ++i)
+    {
+        if (aliases[i].name) out[n++] = aliases[i].name;
+    }
+    return n;
+}
+
 void alias_print_all()
 {
     for (int i = 0; i < MAX_ALIASES; ++i)
@@ -1,10 +1,13 @@
 #ifndef ALIAS_H
 #define ALIAS_H
 
+#define MAX_ALIASES 50
+
 void alias_init();
 int alias_add(const char *name, const char *value);
 int alias_remove(const char *name);
 const char *alias_resolve(const char *name);
 void alias_print_all();
+int alias_names(const char **out, int max); // defined names, for completion
 
 #endif // ALIAS_H
@@ -0,0 +1,585 @@
+#include "arith.h"
+#include "func.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#define setenv(name, value, overwrite) _putenv_s(name, value)
+#endif
+
+#define MAX_VAR_NAME 256
+
+/*
+ * An expression is parsed into a tree in a fixed array, so evaluating one
+ * allocates nothing, then walked. When a command is parsed the tree is also
+ * folded: operators whose operands are all numbers are computed once and the
+ * rest printed back as text, so a loop body keeps only the work that depends
+ * on variables.
+ */
+
+// Operators: the character, two characters as OP2, with ASSIGN for the
+// assignment forms ("=" is ASSIGN alone, "+=" is '+' | ASSIGN)
+#define OP2(a, b) ((a) << 8 | (b))
+#define ASSIGN 0x10000
+
+enum { T_END = -1, T_NUM = -2, T_NAME = -3, T_BAD = -4 };
+
+enum { A_NUM, A_VAR, A_UNARY, A_BINARY, A_TERNARY, A_ASSIGN, A_PREFIX, A_POSTFIX };
+
+typedef struct
+{
+    int kind;
+    int op;
+    int a, b, c;            // operands, as indexes into nodes
+    long long value;        // A_NUM
+    const char *name;       // variable or target, as written (maybe with $)
+    int name_len;
+} arith_node_t;
+
+typedef struct
+{
+    const char *p, *end;
+    const char *tok_at;     // peek() cache
+    int tok, tok_len;
+    arith_node_t nodes[MAX_ARITH_NODES];
+    int count;
+    int depth;
+    char error[128];        // first error, if any
+} arith_t;
+
+static int fail(arith_t *a, const char *msg)
+{
+    if (!a->error[0]) snprintf(a->error, sizeof(a->error), "%s", msg);
+    return -1;
+}
+
+// $1.., $#, NAME or $NAME at p; 0 if there is none
+static int name_len(const char *p, const char *end)
+{
+    const char *s = p;
+    if (s < end && *s == '$')
+    {
+        s++;
+        if (s < end && (isdigit((unsigned char)*s) || *s == '#')) return 2;
+    }
+    if (s >= end || !(isalpha((unsigned char)*s) || *s == '_')) return 0;
+    while (s < end && (isalnum((unsigned char)*s) || *s == '_')) s++;
+    return (int)(s - p);
+}
+
+static int scan(arith_t *a, int *len)
+{
+    *len = 0;
+    if (a->p >= a->end) return T_END;
+    if (isdigit((unsigned char)*a->p)) return T_NUM;
+    if ((*len = name_len(a->p, a->end)) > 0) return T_NAME;
+
+    // Longest match: <<= before <<, << before <= before <
+    char c = a->p[0];
+    char d = a->p + 1 < a->end ? a->p[1] : '\0';
+    char e = a->p + 2 < a->end ? a->p[2] : '\0';
+    *len = 2;
+    if (d == c && strchr("<>", c) && e == '=')
+    {
+        *len = 3;
+        return OP2(c, c) | ASSIGN;
+    }
+    if (d == c && strchr("&|+-<>*", c)) return OP2(c, c);
+    if (d == '=' && strchr("=!<>", c)) return OP2(c, '=');
+    if (d == '=' && strchr("+-*/%&^|", c)) return c | ASSIGN;
+    *len = 1;
+    if (c == '=') return ASSIGN;
+    return strchr("+-*/%<>&|^!~?:()", c) ? c : T_BAD;
+}
+
+// The token at a->p and its length, without consuming it. The parser asks
+// several times at one place (once per precedence level), so the last
+// answer is kept.
+static int peek(arith_t *a, int *len)
+{
+    while (a->p < a->end && isspace((unsigned char)*a->p)) a->p++;
+    if (a->p != a->tok_at)
+    {
+        a->tok_at = a->p;
+        a->tok = scan(a, &a->tok_len);
+    }
+    *len = a->tok_len;
+    return a->tok;
+}
+
+static int add_node(arith_t *a, int kind, int op, int x, int y, int z)
+{
+    if (a->count >= MAX_ARITH_NODES) return fail(a, "expression too long");
+    arith_node_t *n = &a->nodes[a->count];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->op = op;
+    n->a = x;
+    n->b = y;
+    n->c = z;
+    return a->count++;
+}
+
+static int add_name(arith_t *a, int kind, int op, int x, const char *name, int len)
+{
+    int n = add_node(a, kind, op, x, -1, -1);
+    if (n < 0) return -1;
+    a->nodes[n].name = name;
+    a->nodes[n].name_len = len;
+    return n;
+}
+
+static int parse_expr(arith_t *a);
+
+static int parse_primary(arith_t *a)
+{
+    int len, t = peek(a, &len);
+    if (t == T_NUM)
+    {
+        char *end;
+        errno = 0;
+        long long v = strtoll(a->p, &end, 0);
+        if (errno == ERANGE) return fail(a, "number too large");
+        if (end < a->end && (isalnum((unsigned char)*end) || *end == '_')) return fail(a, "bad number");
+        int n = add_node(a, A_NUM, 0, -1, -1, -1);
+        if (n < 0) return -1;
+        a->nodes[n].value = v;
+        a->p = end;
+        return n;
+    }
+    if (t == T_NAME)
+    {
+        const char *name = a->p;
+        a->p += len;
+        int oplen, op = peek(a, &oplen);
+        if (op == OP2('+', '+') || op == OP2('-', '-'))
+        {
+            a->p += oplen;
+            return add_name(a, A_POSTFIX, op, -1, name, len);
+        }
+        return add_name(a, A_VAR, 0, -1, name, len);
+    }
+    if (t == '(')
+    {
+        a->p += len;
+        int n = parse_expr(a);
+        if (n < 0) return -1;
+        if (peek(a, &len) != ')') return fail(a, "missing )");
+        a->p += len;
+        return n;
+    }
+    return fail(a, t == T_END ? "operand expected" : "syntax error");
+}
+
+static int parse_unary(arith_t *a)
+{
+    int len, op = peek(a, &len);
+    if (op == OP2('+', '+') || op == OP2('-', '-'))
+    {
+        a->p += len;
+        if (peek(a, &len) != T_NAME || a->p[0] == '$') return fail(a, "++ and -- need a variable");
+        const char *name = a->p;
+        a->p += len;
+        return add_name(a, A_PREFIX, op, -1, name, len);
+    }
+    if (op != '+' && op != '-' && op != '!' && op != '~') return parse_primary(a);
+
+    a->p += len;
+    if (++a->depth > MAX_ARITH_NODES) return fail(a, "expression too deep");
+    int x = parse_unary(a);
+    a->depth--;
+    if (x < 0) return -1;
+    return add_node(a, A_UNARY, op, x, -1, -1);
+}
+
+static int precedence(int op)
+{
+    switch (op)
+    {
+        case OP2('|', '|'): return 1;
+        case OP2('&', '&'): return 2;
+        case '|': return 3;
+        case '^': return 4;
+        case '&': return 5;
+        case OP2('=', '='): case OP2('!', '='): return 6;
+        case '<': case '>': case OP2('<', '='): case OP2('>', '='): return 7;
+        case OP2('<', '<'): case OP2('>', '>'): return 8;
+        case '+': case '-': return 9;
+        case '*': case '/': case '%': return 10;
+        case OP2('*', '*'): return 11;
+        default: return 0;
+    }
+}
+
+static int parse_binary(arith_t *a, int min_prec)
+{
+    int left = parse_unary(a);
+    while (left >= 0)
+    {
+        int len, op = peek(a, &len);
+        int prec = precedence(op);
+        if (prec == 0 || prec < min_prec) break;
+        a->p += len;
+        int right = parse_binary(a, op == OP2('*', '*') ? prec : prec + 1); // 2**3**2 is 2**9
+        if (right < 0) return -1;
+        left = add_node(a, A_BINARY, op, left, right, -1);
+    }
+    return left;
+}
+
+static int parse_ternary(arith_t *a)
+{
+    int len, cond = parse_binary(a, 1);
+    if (cond < 0 || peek(a, &len) != '?') return cond;
+    a->p += len;
+    int x = parse_expr(a);
+    if (x < 0) return -1;
+    if (peek(a, &len) != ':') return fail(a, "missing :");
+    a->p += len;
+    int y = parse_ternary(a);
+    if (y < 0) return -1;
+    return add_node(a, A_TERNARY, '?', cond, x, y);
+}
+
+// NAME op= expr, or a conditional
+static int parse_expr(arith_t *a)
+{
+    if (++a->depth > MAX_ARITH_NODES) return fail(a, "expression too deep");
+    int n, len, t = peek(a, &len);
+    const char *name = a->p;
+    int oplen, op = T_END;
+    if (t == T_NAME)
+    {
+        a->p += len;
+        op = peek(a, &oplen);
+    }
+    if (op >= 0 && (op & ASSIGN))
+    {
+        a->p += oplen;
+        int value = parse_expr(a);
+        n = value < 0 ? -1 : add_name(a, A_ASSIGN, op, value, name, len);
+    }
+    else
+    {
+        a->p = name;
+        n = parse_ternary(a);
+    }
+    a->depth--;
+    return n;
+}
+
+static int parse(arith_t *a, const char *expr, size_t len)
+{
+    a->p = expr;
+    a->end = expr + len;
+    a->tok_at = NULL;
+    a->count = 0;
+    a->depth = 0;
+    a->error[0] = '\0';
+
+    int tlen;
+    if (peek(a, &tlen) == T_END) return add_node(a, A_NUM, 0, -1, -1, -1); // $(( )) is 0
+    int root = parse_expr(a);
+    if (root >= 0 && peek(a, &tlen) != T_END) return fail(a, "syntax error");
+    return root;
+}
+
+static int copy_name(arith_t *a, const char *name, int len, char *buf)
+{
+    if (len >= MAX_VAR_NAME) return fail(a, "name too long");
+    memcpy(buf, name, len); // not snprintf: this is on every variable read
+    buf[len] = '\0';
+    return 0;
+}
+
+static int get_var(arith_t *a, const arith_node_t *n, long long *v)
+{
+    const char *name = n->name;
+    int len = n->name_len;
+    if (name[0] == '$')
+    {
+        name++;
+        len--;
+    }
+
+    const char *val;
+    char buf[MAX_VAR_NAME];
+    if (name[0] == '#')
+    {
+        *v = func_argc();
+        return 0;
+    }
+    if (isdigit((unsigned char)name[0]))
+    {
+        int i = name[0] - '0';
+        val = i == 0 ? "foxy" : i <= func_argc() ? func_argv()[i - 1] : NULL;
+    }
+    else
+    {
+        if (copy_name(a, name, len, buf)) return -1;
+        val = getenv(buf);
+    }
+    if (!val || !*val)
+    {
+        *v = 0;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    *v = strtoll(val, &end, 0);
+    while (isspace((unsigned char)*end)) end++;
+    if (errno == ERANGE || *end)
+    {
+        snprintf(a->error, sizeof(a->error), "%.*s: not a number: %s", n->name_len, n->name, val);
+        return -1;
+    }
+    return 0;
+}
+
+static int set_var(arith_t *a, const arith_node_t *n, long long v)
+{
+    char name[MAX_VAR_NAME], num[24];
+    if (n->name[0] == '$')
+    {
+        snprintf(a->error, sizeof(a->error), "%.*s: cannot assign", n->name_len, n->name);
+        return -1;
+    }
+    if (copy_name(a, n->name, n->name_len, name)) return -1;
+    snprintf(num, sizeof(num), "%lld", v);
+    if (setenv(name, num, 1) != 0) return fail(a, "cannot set variable");
+    return 0;
+}
+
+// Arithmetic wraps around like the unsigned C types instead of overflowing
+static int apply(arith_t *a, int op, long long x, long long y, long long *out)
+{
+    unsigned long long ux = (unsigned long long)x, uy = (unsigned long long)y;
+    switch (op)
+    {
+        case '+': *out = (long long)(ux + uy); break;
+        case '-': *out = (long long)(ux - uy); break;
+        case '*': *out = (long long)(ux * uy); break;
+        case '/':
+        case '%':
+            if (y == 0) return fail(a, "division by zero");
+            if (y == -1) *out = op == '/' ? (long long)(0 - ux) : 0; // LLONG_MIN / -1
+            else *out = op == '/' ? x / y : x % y;
+            break;
+        case OP2('*', '*'):
+            if (y < 0) return fail(a, "negative exponent");
+            for (*out = 1; y > 0; y >>= 1, ux *= ux)
+            {
+                if (y & 1) *out = (long long)((unsigned long long)*out * ux);
+            }
+            break;
+        case OP2('<', '<'): *out = (long long)(ux << (uy & 63)); break;
+        case OP2('>', '>'): *out = x >> (uy & 63); break;
+        case '<': *out = x < y; break;
+        case '>': *out = x > y; break;
+        case OP2('<', '='): *out = x <= y; break;
+        case OP2('>', '='): *out = x >= y; break;
+        case OP2('=', '='): *out = x == y; break;
+        case OP2('!', '='): *out = x != y; break;
+        case '&': *out = x & y; break;
+        case '|': *out = x | y; break;
+        case '^': *out = x ^ y; break;
+        default: return fail(a, "syntax error");
+    }
+    return 0;
+}
+
+static int eval(arith_t *a, int i, long long *out)
+{
+    const arith_node_t *n = &a->nodes[i];
+    long long x, y;
+    switch (n->kind)
+    {
+        case A_NUM:
+            *out = n->value;
+            return 0;
+
+        case A_VAR:
+            return get_var(a, n, out);
+
+        case A_UNARY:
+            if (eval(a, n->a, &x)) return -1;
+            if (n->op == '-') *out = (long long)(0 - (unsigned long long)x);
+            else if (n->op == '!') *out = !x;
+            else if (n->op == '~') *out = ~x;
+            else *out = x;
+            return 0;
+
+        case A_PREFIX:
+        case A_POSTFIX:
+            if (get_var(a, n, &x)) return -1;
+            if (apply(a, n->op == OP2('+', '+') ? '+' : '-', x, 1, &y) || set_var(a, n, y)) return -1;
+            *out = n->kind == A_PREFIX ? y : x;
+            return 0;
+
+        case A_ASSIGN:
+            if (eval(a, n->a, &y)) return -1;
+            if ((n->op & ~ASSIGN) && (get_var(a, n, &x) || apply(a, n->op & ~ASSIGN, x, y, &y))) return -1;
+            if (set_var(a, n, y)) return -1;
+            *out = y;
+            return 0;
+
+        case A_TERNARY:
+            if (eval(a, n->a, &x)) return -1;
+            return eval(a, x ? n->b : n->c, out);
+
+        default:
+            if (n->op == OP2('&', '&') || n->op == OP2('|', '|'))
+            {
+                if (eval(a, n->a, &x)) return -1;
+                if ((n->op == OP2('&', '&')) == !x)
+                {
+                    *out = x != 0; // decided by the left side
+                    return 0;
+                }
+                if (eval(a, n->b, &y)) return -1;
+                *out = y != 0;
+                return 0;
+            }
+            if (eval(a, n->a, &x) || eval(a, n->b, &y)) return -1;
+            return apply(a, n->op, x, y, out);
+    }
+}
+
+int arith_eval(const char *expr, size_t len, long long *result)
+{
+    arith_t a;
+    int root = parse(&a, expr, len);
+    if (root < 0 || eval(&a, root, result) != 0)
+    {
+        fprintf(stderr, "foxy: $((%.*s)): %s\n", (int)len, expr, a.error);
+        return -1;
+    }
+    return 0;
+}
+
+static int is_num(arith_t *a, int i)
+{
+    return a->nodes[i].kind == A_NUM;
+}
+
+// Compute what depends on no variable; 1 if anything changed
+static int fold(arith_t *a, int i)
+{
+    arith_node_t *n = &a->nodes[i];
+    int changed = 0;
+    if (n->kind == A_UNARY || n->kind == A_BINARY || n->kind == A_TERNARY || n->kind == A_ASSIGN) changed |= fold(a, n->a);
+    if (n->kind == A_BINARY || n->kind == A_TERNARY) changed |= fold(a, n->b);
+    if (n->kind == A_TERNARY) changed |= fold(a, n->c);
+
+    if (n->kind == A_TERNARY && is_num(a, n->a))
+    {
+        *n = a->nodes[a->nodes[n->a].value ? n->b : n->c];
+        return 1;
+    }
+    int constant = (n->kind == A_UNARY && is_num(a, n->a)) || (n->kind == A_BINARY && is_num(a, n->a) && is_num(a, n->b));
+    long long v;
+    if (!constant || eval(a, i, &v) != 0)
+    {
+        a->error[0] = '\0'; // 1/0 stays, to be reported if it runs
+        return changed;
+    }
+    n->kind = A_NUM;
+    n->value = v;
+    return 1;
+}
+
+static void emit(char *out, size_t size, size_t *len, const char *s, size_t n)
+{
+    if (*len + n < size) memcpy(out + *len, s, n);
+    *len += n;
+}
+
+static void emit_op(char *out, size_t size, size_t *len, int op)
+{
+    char text[4];
+    size_t n = 0;
+    int base = op & ~ASSIGN;
+    if (base > 0xff) text[n++] = (char)(base >> 8);
+    if (base) text[n++] = (char)(base & 0xff);
+    if (op & ASSIGN) text[n++] = '=';
+    emit(out, size, len, text, n);
+}
+
+// Back to text, each operator in parentheses so no precedence is lost
+static void print(arith_t *a, int i, char *out, size_t size, size_t *len)
+{
+    const arith_node_t *n = &a->nodes[i];
+    char num[32];
+    switch (n->kind)
+    {
+        case A_NUM:
+            if (n->value == LLONG_MIN) snprintf(num, sizeof(num), "(%lld-1)", n->value + 1);
+            else snprintf(num, sizeof(num), n->value < 0 ? "(%lld)" : "%lld", n->value);
+            emit(out, size, len, num, strlen(num));
+            return;
+        case A_VAR:
+            emit(out, size, len, n->name, n->name_len);
+            return;
+        case A_PREFIX:
+        case A_POSTFIX:
+            emit(out, size, len, "(", 1);
+            if (n->kind == A_PREFIX) emit_op(out, size, len, n->op);
+            emit(out, size, len, n->name, n->name_len);
+            if (n->kind == A_POSTFIX) emit_op(out, size, len, n->op);
+            emit(out, size, len, ")", 1);
+            return;
+        case A_ASSIGN:
+            emit(out, size, len, "(", 1);
+            emit(out, size, len, n->name, n->name_len);
+            emit_op(out, size, len, n->op);
+            print(a, n->a, out, size, len);
+            emit(out, size, len, ")", 1);
+            return;
+        case A_UNARY:
+            emit(out, size, len, "(", 1);
+            emit_op(out, size, len, n->op);
+            print(a, n->a, out, size, len);
+            emit(out, size, len, ")", 1);
+            return;
+        case A_TERNARY:
+            emit(out, size, len, "(", 1);
+            print(a, n->a, out, size, len);
+            emit(out, size, len, "?", 1);
+            print(a, n->b, out, size, len);
+            emit(out, size, len, ":", 1);
+            print(a, n->c, out, size, len);
+            emit(out, size, len, ")", 1);
+            return;
+        default:
+            emit(out, size, len, "(", 1);
+            print(a, n->a, out, size, len);
+            emit_op(out, size, len, n->op);
+            print(a, n->b, out, size, len);
+            emit(out, size, len, ")", 1);
+            return;
+    }
+}
+
+int arith_fold(const char *expr, size_t len, char *out, size_t out_size)
+{
+    arith_t a;
+    int root = parse(&a, expr, len);
+    if (root < 0) return 0;
+    int changed = fold(&a, root);
+    if (is_num(&a, root))
+    {
+        snprintf(out, out_size, "%lld", a.nodes[root].value);
+        return 2;
+    }
+    if (!changed) return 0;
+    size_t n = 0;
+    print(&a, root, out, out_size, &n);
+    if (n >= out_size) return 0;
+    out[n] = '\0';
+    return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stddef.h>
+
+#define MAX_ARITH_NODES 128 // numbers, names and operators in one $((...))
+
+/*
+ * $((expr)): 64-bit integer arithmetic with the C operators and **,
+ * comparisons (1 or 0), ?:, and assignment to shell variables (=, +=, ...,
+ * ++, --). Names may be written with or without $; unset or empty ones
+ * are 0.
+ */
+
+// Evaluate expr[0..len) (the text between "$((" and "))"); 0 on success,
+// else -1 after printing the error
+int arith_eval(const char *expr, size_t len, long long *result);
+
+// At parse time: expr[0..len) with its literal-only parts computed, in out.
+// Returns 2 if all of it is constant (out is the number), 1 if some part
+// folded, 0 if nothing did or it does not parse (left for arith_eval to
+// report when it runs).
+int arith_fold(const char *expr, size_t len, char *out, size_t out_size);
+
+#endif // ARITH_H
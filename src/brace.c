@@ -0,0 +1,269 @@
+#include "brace.h"
+#include "foxy.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define BRACE_BUF_MIN 256
+
+/*
+ * No word is rebuilt to expand the next brace in it. The text still to be
+ * read is a chain of spans on the C stack (an alternative, then what follows
+ * its closing brace, then what follows the enclosing one, ...), and words
+ * are assembled in one buffer: the text before a brace is written once and
+ * each alternative or range value is written after it in turn. Counting
+ * walks the same chains without writing.
+ */
+
+typedef struct span
+{
+    const char *s, *e;
+    const struct span *next;
+} span_t;
+
+typedef struct
+{
+    char *buf;
+    size_t cap;
+    brace_fn fn;
+    void *ctx;
+} gen_t;
+
+typedef struct
+{
+    long long from, step;   // step is negative when counting down
+    size_t count;
+    int width;              // zero-padded to this many characters, or 0
+    int is_char;
+} range_t;
+
+// The marked '}' closing the marked '{' at open; NULL if it is not in the
+// span. *comma: the first marked ',' at the top level, or NULL.
+static const char *find_close(const char *open, const char *e, const char **comma)
+{
+    int depth = 0;
+    *comma = NULL;
+    for (const char *p = open + 2; p + 1 < e; ++p)
+    {
+        if (*p != LEX_BRACE) continue;
+        p++;
+        if (*p == '{') depth++;
+        else if (*p == '}' && depth-- == 0) return p - 1;
+        else if (*p == ',' && depth == 0 && !*comma) *comma = p - 1;
+    }
+    return NULL;
+}
+
+// The end of the alternative starting at p: the next top-level comma or close
+static const char *alt_end(const char *p, const char *close)
+{
+    int depth = 0;
+    for (; p < close; ++p)
+    {
+        if (*p != LEX_BRACE) continue;
+        if (p[1] == '{') depth++;
+        else if (p[1] == '}') depth--;
+        else if (depth == 0) return p;
+        p++;
+    }
+    return close;
+}
+
+// The first brace expression in the span, with its close and comma
+static const char *find_open(const span_t *sp, const char **close, const char **comma)
+{
+    for (const char *p = sp->s; p + 1 < sp->e; ++p)
+    {
+        if (p[0] == LEX_BRACE && p[1] == '{' && (*close = find_close(p, sp->e, comma)) != NULL) return p;
+    }
+    return NULL;
+}
+
+static int parse_num(const char **p, const char *e, long long *v, int *padded)
+{
+    const char *s = *p, *digits = s + (s < e && (*s == '-' || *s == '+'));
+    const char *q = digits;
+    while (q < e && isdigit((unsigned char)*q)) q++;
+    if (q == digits || q - digits > 18) return 0;
+    *v = strtoll(s, NULL, 10);
+    *padded |= *digits == '0' && q - digits > 1;
+    *p = q;
+    return 1;
+}
+
+// s[0..e) as A..B or A..B..STEP, numbers or single letters
+static int parse_range(const char *s, const char *e, range_t *r)
+{
+    long long from, to, step = 1;
+    int padded = 0, is_char = 0;
+    const char *p = s;
+    if (e - s >= 4 && isalpha((unsigned char)s[0]) && s[1] == '.' && s[2] == '.' && isalpha((unsigned char)s[3]))
+    {
+        from = (unsigned char)s[0];
+        to = (unsigned char)s[3];
+        p = s + 4;
+        is_char = 1;
+    }
+    else
+    {
+        if (!parse_num(&p, e, &from, &padded) || e - p < 2 || p[0] != '.' || p[1] != '.') return 0;
+        int from_len = (int)(p - s);
+        const char *second = p += 2;
+        if (!parse_num(&p, e, &to, &padded)) return 0;
+        int to_len = (int)(p - second);
+        r->width = !padded ? 0 : from_len > to_len ? from_len : to_len;
+    }
+    if (p != e)
+    {
+        int unused = 0;
+        if (e - p < 3 || p[0] != '.' || p[1] != '.') return 0;
+        p += 2;
+        if (!parse_num(&p, e, &step, &unused) || p != e) return 0;
+        if (step < 0) step = -step;
+        if (step == 0) step = 1;
+    }
+    unsigned long long span = from <= to ? (unsigned long long)to - from : (unsigned long long)from - to;
+    r->from = from;
+    r->step = from <= to ? step : -step;
+    r->count = span / (unsigned long long)step + 1 > MAX_BRACE_WORDS ? MAX_BRACE_WORDS + 1 : (size_t)(span / step + 1);
+    r->is_char = is_char;
+    if (is_char) r->width = 0;
+    return 1;
+}
+
+static size_t count(const span_t *sp)
+{
+    while (sp && sp->s == sp->e) sp = sp->next;
+    if (!sp) return 1;
+
+    const char *close, *comma;
+    const char *open = find_open(sp, &close, &comma);
+    if (!open) return count(sp->next);
+
+    span_t after = { close + 2, sp->e, sp->next };
+    range_t r;
+    if (!comma && !parse_range(open + 2, close, &r))
+    {
+        span_t rest = { open + 2, sp->e, sp->next }; // not a range: plain text
+        return count(&rest);
+    }
+    if (!comma)
+    {
+        size_t n = count(&after);
+        return n > (MAX_BRACE_WORDS + 1) / r.count ? MAX_BRACE_WORDS + 1 : n * r.count;
+    }
+
+    size_t total = 0;
+    for (const char *a = open + 2; total <= MAX_BRACE_WORDS; a += 2)
+    {
+        const char *end = alt_end(a, close);
+        span_t part = { a, end, &after };
+        total += count(&part);
+        if (end == close) break;
+        a = end;
+    }
+    return total > MAX_BRACE_WORDS ? MAX_BRACE_WORDS + 1 : total;
+}
+
+static int reserve(gen_t *g, size_t need)
+{
+    if (need <= g->cap) return 0;
+    size_t cap = g->cap * 2 > need ? g->cap * 2 : need;
+    char *b = mem_realloc(MEM_EXEC, g->buf, cap);
+    if (!b)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return -1;
+    }
+    g->buf = b;
+    g->cap = cap;
+    return 0;
+}
+
+// Words continuing buf[0..len) with the chain at sp
+static int gen(gen_t *g, size_t len, const span_t *sp)
+{
+    while (sp && sp->s == sp->e) sp = sp->next;
+    if (!sp)
+    {
+        if (reserve(g, len + 1) != 0) return -1;
+        g->buf[len] = '\0';
+        return g->fn(g->buf, g->ctx);
+    }
+
+    const char *close = NULL, *comma = NULL;
+    const char *open = find_open(sp, &close, &comma);
+    const char *stop = open ? open : sp->e;
+
+    // The text up to the brace, with any unpaired marks dropped
+    if (reserve(g, len + (size_t)(stop - sp->s) + 1) != 0) return -1;
+    for (const char *p = sp->s; p < stop; ++p)
+    {
+        if (*p != LEX_BRACE) g->buf[len++] = *p;
+    }
+    if (!open) return gen(g, len, sp->next);
+
+    span_t after = { close + 2, sp->e, sp->next };
+    range_t r;
+    if (!comma && !parse_range(open + 2, close, &r))
+    {
+        g->buf[len] = '{';
+        span_t rest = { open + 2, sp->e, sp->next };
+        return gen(g, len + 1, &rest);
+    }
+    if (!comma)
+    {
+        if (reserve(g, len + 24) != 0) return -1;
+        long long v = r.from;
+        for (size_t i = 0; i < r.count; ++i, v += r.step)
+        {
+            int n = r.is_char ? (g->buf[len] = (char)v, 1) : snprintf(g->buf + len, 24, "%0*lld", r.width, v);
+            int status = gen(g, len + (size_t)n, &after);
+            if (status) return status;
+        }
+        return 0;
+    }
+
+    for (const char *a = open + 2;; a += 2)
+    {
+        const char *end = alt_end(a, close);
+        span_t part = { a, end, &after };
+        int status = gen(g, len, &part);
+        if (status || end == close) return status;
+        a = end;
+    }
+}
+
+int brace_has(const char *word)
+{
+    return strchr(word, LEX_BRACE) != NULL;
+}
+
+size_t brace_count(const char *word)
+{
+    span_t all = { word, word + strlen(word), NULL };
+    return count(&all);
+}
+
+int brace_each(const char *word, brace_fn fn, void *ctx)
+{
+    size_t len = strlen(word);
+    gen_t g = { NULL, 0, fn, ctx };
+    if (reserve(&g, len + 1 > BRACE_BUF_MIN ? len + 1 : BRACE_BUF_MIN) != 0) return -1;
+    span_t all = { word, word + len, NULL };
+    int status = gen(&g, 0, &all);
+    mem_free(g.buf);
+    return status;
+}
+
+void brace_strip(char *word)
+{
+    char *out = word;
+    for (; *word; ++word)
+    {
+        if (*word != LEX_BRACE) *out++ = *word;
+    }
+    *out = '\0';
+}
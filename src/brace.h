@@ -0,0 +1,32 @@
+#ifndef BRACE_H
+#define BRACE_H
+
+#include <stddef.h>
+
+#define MAX_BRACE_WORDS 10000000 // words one brace expression may produce
+
+/*
+ * Brace expansion: a{b,c}d is abd acd, {1..5} is 1 2 3 4 5, {01..10..3} is
+ * 01 04 07 10 and {a..e} is a b c d e. The lexer puts LEX_BRACE before the
+ * {, the commas and the } of an unquoted expression that has a comma or ..
+ * at its top level, so "{a,b}", {} and {x} are plain text.
+ */
+
+// Called with each word; nonzero stops the expansion and is returned
+typedef int (*brace_fn)(char *word, void *ctx);
+
+// 1 if word has a brace expression
+int brace_has(const char *word);
+
+// How many words word expands to (at most MAX_BRACE_WORDS + 1)
+size_t brace_count(const char *word);
+
+// Call fn with each word, in order, without its LEX_BRACE marks. The word
+// is in a buffer that the next one overwrites. Returns 0, fn's nonzero
+// value, or -1 if out of memory (after printing the error).
+int brace_each(const char *word, brace_fn fn, void *ctx);
+
+// Remove the LEX_BRACE marks from word, in place
+void brace_strip(char *word);
+
+#endif // BRACE_H
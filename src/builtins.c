@@ -5,10 +5,33 @@
 #include <unistd.h>
 
 #include "alias.h"
+#include "history.h"
+#include "mem.h"
+#include "prompt.h"
+#include "trace.h"
 
-int builtin_dispatch(char **tokens)
+#ifdef _WIN32
+#define setenv(name, value, overwrite) _putenv_s(name, value)
+#endif
+
+const char *builtin_names[] =
+{
+    "alias", "cd", "each-batch", "echo", "exit", "export", "fg", "help", "history", "jobs", "memstats", "prompt", "trace", "unalias", NULL
+};
+
+int is_builtin(const char *name)
+{
+    for (int i = 0; builtin_names[i]; ++i)
+    {
+        if (strcmp(builtin_names[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+int builtin_dispatch(char **tokens, int *status)
 {
     if (!tokens || !tokens[0]) return 0;
+    *status = 0;
 
     char *cmd = tokens[0];
 
@@ -24,27 +47,46 @@ int builtin_dispatch(char **tokens)
             if (chdir(tokens[1]) != 0)
             {
                 perror("foxy: cd");
+                *status = 1;
+            }
+            else
+            {
+                prompt_cwd_changed();
             }
         }
         else
         {
             fprintf(stderr, "foxy: cd: missing argument\n");
+            *status = 1;
         }
         return 1;
     }
     else if (strcmp(cmd, "help") == 0)
     {
         printf("Foxy Shell - Version 0.0.1\n\n");
-        printf("ALIAS    Define or display aliases (alias name=value).\n");
-        printf("CD       Change the current directory.\n");
-        printf("ECHO     Display messages.\n");
-        printf("EXIT     Quits the Foxy shell.\n");
-        printf("EXPORT   Set environment variable (export VAR=VAL).\n");
-        printf("FG       Brings a background job to the foreground (fg %%id).\n");
-        printf("HELP     Provides Help information for Foxy commands.\n");
-        printf("JOBS     Lists active background jobs.\n");
-        printf("PROMPT   Customize the shell prompt (e.g., prompt $CWD> ).\n");
-        printf("UNALIAS  Remove an alias.\n");
+        printf("ALIAS      Define or display aliases (alias name=value).\n");
+        printf("CD         Change the current directory.\n");
+        printf("EACH-BATCH Run a command too long for the system in batches, like xargs.\n");
+        printf("           each-batch [-P JOBS] [-k KEEP] COMMAND ARGS...\n");
+        printf("ECHO       Display messages.\n");
+        printf("EXIT       Quits the Foxy shell.\n");
+        printf("EXPORT     Set environment variable (export VAR=VAL).\n");
+        printf("FG         Brings a background job to the foreground (fg %%id).\n");
+        printf("HELP       Provides Help information for Foxy commands.\n");
+        printf("HISTORY    Show history; -s slowest, -f failed (history [-s|-f] [N]).\n");
+        printf("JOBS       Lists active background jobs.\n");
+        printf("MEMSTATS   Show memory use per subsystem: live, peak, allocations per line.\n");
+        printf("PROMPT     Customize the shell prompt (e.g., prompt '$GIT$GITDIRTY $CWD> ').\n");
+        printf("           Segments: $CWD $GIT $GITDIRTY $STATUS $DURATION, \\n for a newline.\n");
+        printf("TRACE      Record execution events (trace [on|off|clear|dump FILE]).\n");
+        printf("UNALIAS    Remove an alias.\n");
+        printf("\nControl flow: for X in WORDS; do ...; done   while|until COMMANDS; do ...; done\n");
+        printf("              if COMMANDS; then ...; [elif COMMANDS; then ...;] [else ...;] fi\n");
+        printf("Functions:    NAME() { ...; }   then NAME ARGS, with $1..$9, $# and $@\n");
+        printf("Arithmetic:   $((EXPR)), e.g. $((i + 1)), $((n *= 2)), $((a > b ? a : b))\n");
+        printf("Braces:       a{b,c}  {1..10}  {01..99..2}  {a..z}\n");
+        printf("Globbing:     *  ?  [abc]  [!a-z]  and ** for any depth, e.g. src/**/*.c\n");
+        printf("Substitution: <(CMD) and >(CMD) as files, e.g. diff <(sort a) <(sort b)\n");
         printf("\nExternal commands (ping, whoami, etc.) are executed from the system PATH.\n");
         return 1;
     }
@@ -80,6 +122,71 @@ int builtin_dispatch(char **tokens)
         }
         return 1;
     }
+    else if (strcmp(cmd, "history") == 0)
+    {
+        // history [N] | history -s [N] (slowest) | history -f [N] (failed)
+        int n = 20;
+        char mode = 0;
+        for (int i = 1; tokens[i]; ++i)
+        {
+            if (strcmp(tokens[i], "-s") == 0 || strcmp(tokens[i], "--slowest") == 0) mode = 's';
+            else if (strcmp(tokens[i], "-f") == 0 || strcmp(tokens[i], "--failed") == 0) mode = 'f';
+            else if (atoi(tokens[i]) > 0) n = atoi(tokens[i]);
+            else
+            {
+                fprintf(stderr, "foxy: history: usage: history [-s|-f] [N]\n");
+                *status = 1;
+                return 1;
+            }
+        }
+        if (mode == 's') history_print_slowest(n);
+        else if (mode == 'f') history_print_failed(n);
+        else history_print_recent(n);
+        return 1;
+    }
+    else if (strcmp(cmd, "memstats") == 0)
+    {
+        mem_print_stats();
+        return 1;
+    }
+    else if (strcmp(cmd, "trace") == 0)
+    {
+        // trace | trace on | trace off | trace clear | trace dump FILE
+        if (!tokens[1])
+        {
+            printf("trace is %s\n", TRACE_ENABLED() ? "on" : "off");
+        }
+        else if (strcmp(tokens[1], "on") == 0)
+        {
+            if (trace_set(1) != 0)
+            {
+                fprintf(stderr, "foxy: trace: out of memory\n");
+                *status = 1;
+            }
+        }
+        else if (strcmp(tokens[1], "off") == 0)
+        {
+            trace_set(0);
+        }
+        else if (strcmp(tokens[1], "clear") == 0)
+        {
+            trace_clear();
+        }
+        else if (strcmp(tokens[1], "dump") == 0 && tokens[2])
+        {
+            if (trace_dump(tokens[2]) != 0)
+            {
+                perror("foxy: trace");
+                *status = 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "foxy: trace: usage: trace [on|off|clear|dump FILE]\n");
+            *status = 1;
+        }
+        return 1;
+    }
     else if (strcmp(cmd, "jobs") == 0)
     {
         job_print_all();
@@ -94,11 +201,13 @@ int builtin_dispatch(char **tokens)
             if (job_to_foreground(id) != 0)
             {
                 // Error printed by job_to_foreground
+                *status = 1;
             }
         }
         else
         {
              fprintf(stderr, "foxy: fg: missing job id\n");
+             *status = 1;
         }
         return 1;
     }
@@ -127,35 +236,52 @@ int builtin_dispatch(char **tokens)
                 // If val is quoted in input, lexer might have stripped quotes if full string was quoted?
                 // Or if user typed: alias name="foo bar" -> tokens[1] = name=foo bar
                 
-                alias_add(arg, val);
+                if (alias_add(arg, val) != 0) *status = 1;
             }
             else
             {
                 // Show specific alias? "alias name"
                  const char *v = alias_resolve(arg);
                  if (v) printf("%s='%s'\n", arg, v);
-                 else fprintf(stderr, "foxy: alias %s not found\n", arg);
+                 else
+                 {
+                     fprintf(stderr, "foxy: alias %s not found\n", arg);
+                     *status = 1;
+                 }
             }
         }
         return 1;
     }
     else if (strcmp(cmd, "unalias") == 0)
     {
-        if (tokens[1]) alias_remove(tokens[1]);
-        else fprintf(stderr, "foxy: unalias: missing name\n");
+        if (tokens[1])
+        {
+            if (alias_remove(tokens[1]) != 0)
+            {
+                fprintf(stderr, "foxy: unalias: %s not found\n", tokens[1]);
+                *status = 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "foxy: unalias: missing name\n");
+            *status = 1;
+        }
         return 1;
     }
     else if (strcmp(cmd, "export") == 0)
     {
-        if (tokens[1])
+        char *eq = tokens[1] ? strchr(tokens[1], '=') : NULL;
+        if (eq) // export VAR=VAL; a bare VAR is already exported
         {
-             // export VAR=VAL
-             // or export VAR (implied?)
-             // Windows _putenv takes "VAR=VAL" directly.
-             if (_putenv(tokens[1]) != 0)
-             {
-                 perror("foxy: export");
-             }
+            *eq = '\0';
+            int err = setenv(tokens[1], eq + 1, 1);
+            *eq = '=';
+            if (err != 0)
+            {
+                perror("foxy: export");
+                *status = 1;
+            }
         }
         return 1;
     }
@@ -0,0 +1,534 @@
+#include "complete.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "worker.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_SEP ';'
+#else
+#include <dirent.h>
+#define PATH_SEP ':'
+#endif
+
+#define MAX_DIR_CACHE 8
+#define PATH_RECHECK_SECS 2
+
+/*
+ * Radix trie over a directory's sorted names. Every node covers the run
+ * names[lo..hi) sharing its first `depth` bytes, so a prefix lookup walks
+ * at most one node per distinct branch point and ends with a ready-made
+ * sorted run of matches. A name that ends exactly at a node is names[lo].
+ */
+typedef struct
+{
+    uint32_t lo, hi;
+    uint32_t depth;
+    uint32_t child, next; // first child, next sibling; 0 = none (0 is the root)
+} trie_node_t;
+
+typedef struct
+{
+    char *arena;          // the names, back to back
+    const char **names;   // sorted
+    size_t count;
+    trie_node_t *nodes;
+    size_t node_count, node_cap;
+} name_index_t;
+
+typedef struct
+{
+    char *dir;
+    time_t mtime;
+    long mtime_ns;
+    int racy;             // listed in the second the directory last changed
+    name_index_t ix;
+    unsigned long used;   // for LRU eviction
+} dir_cache_t;
+
+static dir_cache_t cache[MAX_DIR_CACHE];
+static unsigned long use_clock;
+
+/*
+ * Command names from PATH. The worker thread keeps a listing per PATH
+ * directory, re-reads only directories whose mtime moved, and leaves a
+ * merged index in cmd_ready. The main thread adopts it on its next lookup,
+ * so nothing it is still using gets freed under it.
+ */
+typedef struct
+{
+    char *dir;
+    time_t mtime;
+    long mtime_ns;
+    int racy;
+    char *arena;
+    const char **names;
+    size_t count;
+} path_dir_t;
+
+static path_dir_t *path_dirs; // worker thread only
+static size_t path_dir_count;
+static _Atomic(name_index_t *) cmd_ready;
+static atomic_int cmd_busy;
+static name_index_t *cmd_index; // main thread only
+static char *cmd_path;          // PATH the index was last requested for
+static time_t cmd_checked;
+
+// Byte order, except that dot-files come first so they can be skipped as a block
+static int cmp_name(const void *a, const void *b)
+{
+    const char *x = *(const char *const *)a, *y = *(const char *const *)b;
+    if ((x[0] == '.') != (y[0] == '.')) return x[0] == '.' ? -1 : 1;
+    return strcmp(x, y);
+}
+
+static void index_free(name_index_t *ix)
+{
+    free(ix->arena);
+    free(ix->names);
+    free(ix->nodes);
+    memset(ix, 0, sizeof(*ix));
+}
+
+static void cache_free(dir_cache_t *c)
+{
+    free(c->dir);
+    index_free(&c->ix);
+    memset(c, 0, sizeof(*c));
+}
+
+static long stat_mtime_ns(const struct stat *st)
+{
+#if defined(__linux__)
+    return st->st_mtim.tv_nsec;
+#else
+    (void)st;
+    return 0;
+#endif
+}
+
+static size_t common_len(const char *a, const char *b)
+{
+    size_t i = 0;
+    while (a[i] && a[i] == b[i]) i++;
+    return i;
+}
+
+static int trie_build(name_index_t *c, uint32_t lo, uint32_t hi, uint32_t *out)
+{
+    if (c->node_count == c->node_cap)
+    {
+        size_t new_cap = c->node_cap ? c->node_cap * 2 : 64;
+        trie_node_t *n = realloc(c->nodes, sizeof(trie_node_t) * new_cap);
+        if (!n) return -1;
+        c->nodes = n;
+        c->node_cap = new_cap;
+    }
+    uint32_t id = (uint32_t)c->node_count++;
+    *out = id;
+
+    // Sorted runs: the first and last names share exactly the run's prefix
+    uint32_t depth = hi - lo == 1 ? (uint32_t)strlen(c->names[lo]) : (uint32_t)common_len(c->names[lo], c->names[hi - 1]);
+    c->nodes[id] = (trie_node_t){ lo, hi, depth, 0, 0 };
+
+    uint32_t i = lo, last = 0;
+    if (c->names[i][depth] == '\0') i++;
+    while (i < hi)
+    {
+        unsigned char ch = (unsigned char)c->names[i][depth];
+        uint32_t j = i + 1;
+        while (j < hi && (unsigned char)c->names[j][depth] == ch) j++;
+
+        uint32_t child;
+        if (trie_build(c, i, j, &child) != 0) return -1;
+        if (last) c->nodes[last].next = child;
+        else c->nodes[id].child = child;
+        last = child;
+        i = j;
+    }
+    return 0;
+}
+
+static int is_command(const char *dir, const char *name)
+{
+#ifdef _WIN32
+    (void)dir;
+    static const char *exts[] = { ".exe", ".com", ".bat", ".cmd", NULL };
+    const char *dot = strrchr(name, '.');
+    if (!dot) return 0;
+    for (int i = 0; exts[i]; ++i)
+    {
+        if (_stricmp(dot, exts[i]) == 0) return 1;
+    }
+    return 0;
+#else
+    char path[4096];
+    struct stat st;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) return 0;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111);
+#endif
+}
+
+// Unsorted names in dir (executables only, if commands is set)
+static int list_dir(const char *dir, int commands, char **arena_out, const char ***names_out, size_t *count_out)
+{
+    size_t arena_len = 0, arena_cap = 4096, count = 0, cap = 256;
+    char *arena = malloc(arena_cap);
+    size_t *offsets = malloc(sizeof(size_t) * cap);
+    if (!arena || !offsets)
+    {
+        free(arena);
+        free(offsets);
+        return -1;
+    }
+
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATA ffd;
+    HANDLE h = FindFirstFile(pattern, &ffd);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        free(arena);
+        free(offsets);
+        return -1;
+    }
+    do
+    {
+        const char *name = ffd.cFileName;
+#else
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        free(arena);
+        free(offsets);
+        return -1;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        const char *name = de->d_name;
+#endif
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (commands && !is_command(dir, name)) continue;
+        size_t len = strlen(name) + 1;
+        if (arena_len + len > arena_cap)
+        {
+            size_t new_cap = arena_cap * 2;
+            while (arena_len + len > new_cap) new_cap *= 2;
+            char *a = realloc(arena, new_cap);
+            if (!a) break;
+            arena = a;
+            arena_cap = new_cap;
+        }
+        if (count == cap)
+        {
+            size_t *o = realloc(offsets, sizeof(size_t) * cap * 2);
+            if (!o) break;
+            offsets = o;
+            cap *= 2;
+        }
+        memcpy(arena + arena_len, name, len);
+        offsets[count++] = arena_len;
+        arena_len += len;
+#ifdef _WIN32
+    } while (FindNextFile(h, &ffd));
+    FindClose(h);
+#else
+    }
+    closedir(d);
+#endif
+
+    // The arena may have moved while growing, so pointers are taken last
+    const char **names = malloc(sizeof(char *) * (count ? count : 1));
+    if (!names)
+    {
+        free(arena);
+        free(offsets);
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) names[i] = arena + offsets[i];
+    free(offsets);
+
+    *arena_out = arena;
+    *names_out = names;
+    *count_out = count;
+    return 0;
+}
+
+// Sort the names (dropping repeats if asked) and index them; the index
+// takes ownership of both arrays
+static int index_build(name_index_t *ix, char *arena, const char **names, size_t count, int unique)
+{
+    qsort(names, count, sizeof(char *), cmp_name);
+    if (unique && count > 0)
+    {
+        size_t u = 1;
+        for (size_t i = 1; i < count; ++i)
+        {
+            if (strcmp(names[u - 1], names[i]) != 0) names[u++] = names[i];
+        }
+        count = u;
+    }
+    *ix = (name_index_t){ arena, names, count, NULL, 0, 0 };
+    uint32_t root;
+    if (count > 0 && trie_build(ix, 0, (uint32_t)count, &root) != 0)
+    {
+        index_free(ix);
+        return -1;
+    }
+    return 0;
+}
+
+// Sorted run of names starting with prefix
+static size_t index_find(const name_index_t *ix, const char *prefix, size_t plen, const char *const **names)
+{
+    *names = (const char *const *)ix->names;
+    if (ix->count == 0) return 0;
+
+    const trie_node_t *n = &ix->nodes[0];
+    while (plen > n->depth)
+    {
+        unsigned char ch = (unsigned char)prefix[n->depth];
+        uint32_t k = n->child;
+        while (k && (unsigned char)ix->names[ix->nodes[k].lo][n->depth] != ch) k = ix->nodes[k].next;
+        if (!k) return 0;
+        n = &ix->nodes[k];
+    }
+    if (strncmp(ix->names[n->lo], prefix, plen) != 0) return 0;
+
+    uint32_t lo = n->lo;
+    if (plen == 0)
+    {
+        while (lo < n->hi && ix->names[lo][0] == '.') lo++;
+    }
+    *names = (const char *const *)ix->names + lo;
+    return n->hi - lo;
+}
+
+// Cached listing of dir, re-read when the directory's mtime moves
+static dir_cache_t *cache_get(const char *dir)
+{
+    struct stat st;
+    if (stat(dir, &st) != 0) return NULL;
+
+    dir_cache_t *c = NULL, *victim = &cache[0];
+    for (int i = 0; i < MAX_DIR_CACHE; ++i)
+    {
+        if (cache[i].dir && strcmp(cache[i].dir, dir) == 0) c = &cache[i];
+        if (cache[i].used < victim->used) victim = &cache[i];
+    }
+
+    if (c && !c->racy && c->mtime == st.st_mtime && c->mtime_ns == stat_mtime_ns(&st))
+    {
+        c->used = ++use_clock;
+        return c;
+    }
+
+    if (!c) c = victim;
+    cache_free(c);
+    char *arena;
+    const char **names;
+    size_t count;
+    if (list_dir(dir, 0, &arena, &names, &count) != 0) return NULL;
+    if (index_build(&c->ix, arena, names, count, 0) != 0) return NULL;
+    c->dir = strdup(dir);
+    c->mtime = st.st_mtime;
+    c->mtime_ns = stat_mtime_ns(&st);
+    // A change later in the same second would not move a coarse mtime
+    c->racy = st.st_mtime >= time(NULL) - 1;
+    c->used = ++use_clock;
+    if (!c->dir)
+    {
+        cache_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+int complete_files(const char *dir, const char *prefix, size_t plen, const char *const **names, size_t *count)
+{
+    dir_cache_t *c = cache_get(dir && *dir ? dir : ".");
+    if (!c) return -1;
+    *count = index_find(&c->ix, prefix, plen, names);
+    return 0;
+}
+
+static void path_dir_free(path_dir_t *d)
+{
+    free(d->dir);
+    free(d->arena);
+    free(d->names);
+}
+
+// Worker job: bring the per-directory listings up to date with PATH (arg)
+static void path_refresh(void *arg)
+{
+    char *path = arg;
+    size_t cap = 1;
+    for (const char *p = path; *p; ++p) cap += *p == PATH_SEP;
+
+    path_dir_t *dirs = calloc(cap, sizeof(path_dir_t));
+    if (!dirs)
+    {
+        free(path);
+        atomic_store(&cmd_busy, 0);
+        return;
+    }
+
+    size_t n = 0, total = 0, bytes = 0;
+    int changed = 0;
+    for (char *dir = path, *end; dir; dir = end)
+    {
+        end = strchr(dir, PATH_SEP);
+        if (end) *end++ = '\0';
+        if (!*dir) continue;
+
+        // Reuse the previous listing while the directory is unchanged
+        path_dir_t *old = NULL;
+        for (size_t i = 0; i < path_dir_count; ++i)
+        {
+            if (path_dirs[i].dir && strcmp(path_dirs[i].dir, dir) == 0) { old = &path_dirs[i]; break; }
+        }
+        struct stat st;
+        if (stat(dir, &st) != 0) continue;
+        if (old && !old->racy && old->mtime == st.st_mtime && old->mtime_ns == stat_mtime_ns(&st))
+        {
+            dirs[n] = *old;
+            memset(old, 0, sizeof(*old));
+        }
+        else
+        {
+            path_dir_t d = { strdup(dir), st.st_mtime, stat_mtime_ns(&st), st.st_mtime >= time(NULL) - 1, NULL, NULL, 0 };
+            if (!d.dir || list_dir(dir, 1, &d.arena, &d.names, &d.count) != 0)
+            {
+                free(d.dir);
+                continue;
+            }
+            dirs[n] = d;
+            changed = 1;
+        }
+        total += dirs[n].count;
+        for (size_t i = 0; i < dirs[n].count; ++i) bytes += strlen(dirs[n].names[i]) + 1;
+        n++;
+    }
+
+    // Directories that left PATH also change the answer
+    for (size_t i = 0; i < path_dir_count; ++i)
+    {
+        if (path_dirs[i].dir) changed = 1;
+        path_dir_free(&path_dirs[i]);
+    }
+    free(path_dirs);
+    path_dirs = dirs;
+    path_dir_count = n;
+    free(path);
+
+    name_index_t *ix = changed ? calloc(1, sizeof(name_index_t)) : NULL;
+    char *arena = ix ? malloc(bytes ? bytes : 1) : NULL;
+    const char **names = arena ? malloc(sizeof(char *) * (total ? total : 1)) : NULL;
+    if (!names)
+    {
+        free(ix);
+        free(arena);
+        atomic_store(&cmd_busy, 0);
+        return;
+    }
+
+    size_t k = 0, off = 0;
+    for (size_t d = 0; d < n; ++d)
+    {
+        for (size_t i = 0; i < dirs[d].count; ++i)
+        {
+            size_t len = strlen(dirs[d].names[i]) + 1;
+            memcpy(arena + off, dirs[d].names[i], len);
+            names[k++] = arena + off;
+            off += len;
+        }
+    }
+    // The same name in several PATH directories is listed once
+    if (index_build(ix, arena, names, k, 1) != 0)
+    {
+        free(ix);
+        atomic_store(&cmd_busy, 0);
+        return;
+    }
+
+    name_index_t *stale = atomic_exchange(&cmd_ready, ix);
+    if (stale)
+    {
+        // Never picked up by the main thread
+        index_free(stale);
+        free(stale);
+    }
+    atomic_store(&cmd_busy, 0);
+}
+
+void complete_commands_refresh()
+{
+    const char *path = getenv("PATH");
+    if (!path) path = "";
+    time_t now = time(NULL);
+    int path_changed = !cmd_path || strcmp(cmd_path, path) != 0;
+    if (!path_changed && now - cmd_checked < PATH_RECHECK_SECS) return;
+    if (atomic_load(&cmd_busy)) return;
+
+    char *copy = strdup(path);
+    char *seen = strdup(path);
+    if (!copy || !seen)
+    {
+        free(copy);
+        free(seen);
+        return;
+    }
+    atomic_store(&cmd_busy, 1);
+    if (worker_submit(path_refresh, copy) != 0)
+    {
+        atomic_store(&cmd_busy, 0);
+        free(copy);
+        free(seen);
+        return;
+    }
+    free(cmd_path);
+    cmd_path = seen;
+    cmd_checked = now;
+}
+
+int complete_commands(const char *prefix, size_t plen, const char *const **names, size_t *count)
+{
+    name_index_t *fresh = atomic_exchange(&cmd_ready, NULL);
+    if (fresh)
+    {
+        if (cmd_index)
+        {
+            index_free(cmd_index);
+            free(cmd_index);
+        }
+        cmd_index = fresh;
+    }
+    complete_commands_refresh(); // for next time; this lookup uses what is there
+
+    *names = NULL;
+    *count = 0;
+    if (!cmd_index) return -1;
+    *count = index_find(cmd_index, prefix, plen, names);
+    return 0;
+}
+
+size_t complete_common(const char *const *names, size_t count)
+{
+    if (count == 0) return 0;
+    size_t n = strlen(names[0]);
+    for (size_t i = 1; i < count && n > 0; ++i)
+    {
+        size_t k = 0;
+        while (k < n && names[i][k] == names[0][k]) k++;
+        n = k;
+    }
+    return n;
+}
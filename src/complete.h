@@ -0,0 +1,22 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+
+// Entries of dir starting with prefix, as a sorted run of names. The names
+// stay valid until the next complete_files() call. Returns -1 if the
+// directory cannot be read. Dot-files only match a prefix starting with '.'.
+int complete_files(const char *dir, const char *prefix, size_t plen, const char *const **names, size_t *count);
+
+// Start (or repeat, when PATH or a PATH directory changed) indexing the
+// executables on PATH in the background
+void complete_commands_refresh();
+
+// Executables on PATH starting with prefix, as a sorted run of names valid
+// until the next call. Returns -1 while the first index is still being built.
+int complete_commands(const char *prefix, size_t plen, const char *const **names, size_t *count);
+
+// Length of the prefix shared by all names
+size_t complete_common(const char *const *names, size_t count);
+
+#endif // COMPLETE_H
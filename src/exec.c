@@ -1,4 +1,10 @@
 #include "foxy.h"
+#include "arith.h"
+#include "brace.h"
+#include "func.h"
+#include "glob.h"
+#include "mem.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,15 +22,722 @@
 #define execvp _execvp
 #define WIFEXITED(x) 1
 #define WEXITSTATUS(x) (x)
+#define setenv(name, value, overwrite) _putenv_s(name, value)
 #else
+#include <errno.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <time.h>
+#define _P_WAIT 0
+#define _P_NOWAIT 1
+extern char **environ;
 #endif
 
-int builtin_dispatch(char **tokens);
+#define MAX_PIPE_PIDS 64
+#define MAX_BATCH_JOBS 64       // each-batch -P
+#define BATCH_HEADROOM 4096     // bytes of the argument limit left unused
+#define MAX_SUBSTS 32           // <(...) and >(...) open at once
+#define MAX_VAR_NAME 256
 
+int builtin_dispatch(char **tokens, int *status);
+
+volatile sig_atomic_t foxy_interrupted = 0;
+
+/*
+ * Process substitution: <(cmd) runs cmd with its output on a pipe and
+ * stands for /dev/fd/N, the shell's end of it, so a program reads cmd's
+ * output as a file; >(cmd) is the same the other way round. The end stays
+ * close-on-exec in the shell and is handed to each program started while
+ * the command runs; then it is closed and cmd is waited for. Windows has
+ * no /dev/fd: cmd writes a temporary file first, or reads it afterwards.
+ */
+typedef struct
+{
+#ifdef _WIN32
+    char *path;         // the temporary file
+    char *text;         // >(cmd): run on the file once the command is done
+#else
+    int fd;
+    pid_t pid;          // 0 if it is not ours to wait for
+#endif
+} subst_t;
+
+static subst_t substs[MAX_SUBSTS];
+static int subst_count;
+static int subst_bg;    // the command being expanded runs with &
+
+#ifdef _WIN32
+#define save_fd dup
+#else
+// Saved descriptors must not leak into the programs we start
+static int save_fd(int fd)
+{
+    return fcntl(fd, F_DUPFD_CLOEXEC, 10);
+}
+
+// Pipe ends are close-on-exec; dup2 onto 0/1 clears it where it is wanted
+static int pipe_cloexec(int fds[2])
+{
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+// Left-hand sides of pipes, reaped once the right-hand side is done
+static pid_t pipe_pids[MAX_PIPE_PIDS];
+static int pipe_pid_count = 0;
+
+// The exit status of a program started with _P_NOWAIT
+static int exit_status(int st)
+{
+    if (WIFEXITED(st)) return WEXITSTATUS(st);
+    return 128 + WTERMSIG(st);
+}
+
+static int wait_program(pid_t pid)
+{
+    int st;
+    while (waitpid(pid, &st, 0) < 0)
+    {
+        if (errno != EINTR) return 1;
+    }
+    return exit_status(st);
+}
+
+// Same contract as _spawnvp: exit status for _P_WAIT, the pid for _P_NOWAIT,
+// -1 if the program could not be started
+static intptr_t spawn_program(int mode, char **argv)
+{
+    pid_t pid;
+    fflush(stdout);
+    uint64_t t = TRACE_START();
+    posix_spawn_file_actions_t actions, *fa = NULL;
+    if (subst_count > 0 && posix_spawn_file_actions_init(&actions) == 0)
+    {
+        // dup2 of a descriptor onto itself clears close-on-exec in the child
+        for (int i = 0; i < subst_count; ++i) posix_spawn_file_actions_adddup2(&actions, substs[i].fd, substs[i].fd);
+        fa = &actions;
+    }
+    int err = posix_spawnp(&pid, argv[0], fa, NULL, argv, environ);
+    if (fa) posix_spawn_file_actions_destroy(fa);
+    TRACE_SPAN("spawn", t, argv[0]);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    if (mode == _P_NOWAIT) return pid;
+
+    t = TRACE_START();
+    int status = wait_program(pid);
+    TRACE_SPAN("wait", t, argv[0]);
+    return status;
+}
+#endif
+
+// Open path onto fd (0 or 1)
+static int redirect_fd(const char *path, int flags, int fd)
+{
+    int f = open(path, flags, 0644);
+    if (f < 0) { perror(path); return -1; }
+    dup2(f, fd);
+    close(f);
+    return 0;
+}
+
+static int out_flags(node_t *node)
+{
+    int flags = O_WRONLY | O_CREAT;
+    if (node->cmd.append_out) flags |= O_APPEND;
+    else flags |= O_TRUNC;
+    return flags;
+}
+
+static void restore_fd(int saved, int fd)
+{
+    if (saved == -1) return;
+    dup2(saved, fd);
+    close(saved);
+}
+
+/*
+ * A word with a brace expression first becomes its words (brace.h), made
+ * one at a time into the argument list. Words reach the executor with
+ * LEX_VAR NAME LEX_VAR where the line had $NAME. Expanding here rather
+ * than in the lexer means a loop body parsed once still sees each
+ * iteration's values. Values are not split into words. $1.., $# and $@
+ * are the positional parameters (func.h); a word that is just $@ becomes
+ * one word per parameter. $((...)) is computed in place (arith.h), and
+ * <(cmd) and >(cmd) start cmd and become a path to read or write it by.
+ * Then a word with unquoted *, ? or [ becomes the paths it matches, or
+ * stays as written if none do (glob.h); a pattern that came from a value
+ * is not one. Expanding prints its own errors.
+ */
+static int put_str(char **out, size_t *len, size_t *cap, const char *s, size_t n)
+{
+    if (*len + n + 1 > *cap)
+    {
+        size_t new_cap = (*len + n + 1) * 2;
+        char *tmp = mem_realloc(MEM_EXEC, *out, new_cap);
+        if (!tmp) return -1;
+        *out = tmp;
+        *cap = new_cap;
+    }
+    memcpy(*out + *len, s, n);
+    *len += n;
+    (*out)[*len] = '\0';
+    return 0;
+}
+
+static int put_var(char **out, size_t *len, size_t *cap, const char *name)
+{
+    char num[16];
+    const char *val;
+    if (strcmp(name, "#") == 0)
+    {
+        snprintf(num, sizeof(num), "%d", func_argc());
+        val = num;
+    }
+    else if (strcmp(name, "@") == 0)
+    {
+        for (int i = 0; i < func_argc(); ++i)
+        {
+            if (i > 0 && put_str(out, len, cap, " ", 1) < 0) return -1;
+            if (put_str(out, len, cap, func_argv()[i], strlen(func_argv()[i])) < 0) return -1;
+        }
+        return 0;
+    }
+    else if (name[0] >= '0' && name[0] <= '9')
+    {
+        int n = name[0] - '0';
+        val = n == 0 ? "foxy" : n <= func_argc() ? func_argv()[n - 1] : NULL;
+    }
+    else
+    {
+        val = getenv(name);
+    }
+    return val ? put_str(out, len, cap, val, strlen(val)) : 0;
+}
+
+// Run cmd[0..len) as a command line; with last, its last command may
+// replace the process
+static int run_text(const char *cmd, size_t len, int last)
+{
+    char *line = mem_alloc(MEM_EXEC, len + 1);
+    if (!line)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return 1;
+    }
+    memcpy(line, cmd, len);
+    line[len] = '\0';
+
+    int status = 2;
+    token_list_t tokens = { 0 };
+    lex_err_t err;
+    if (tokenize_line(line, &tokens, &err) != 0)
+    {
+        fprintf(stderr, "foxy: lex error %d\n", err);
+    }
+    else
+    {
+        node_t *ast = parse_tokens(&tokens);
+        if (ast) status = last ? exec_node_last(ast) : exec_node(ast);
+        free_ast(ast);
+    }
+    free_token_list(&tokens);
+    mem_free(line);
+    return status;
+}
+
+// Start <(cmd) or >(cmd) (dir is '<' or '>') and put the path it stands
+// for in path
+static int start_subst(char dir, const char *cmd, size_t len, char *path, size_t size)
+{
+    if (subst_count == MAX_SUBSTS)
+    {
+        fprintf(stderr, "foxy: too many process substitutions\n");
+        return -1;
+    }
+#ifdef _WIN32
+    subst_t s = { _tempnam(NULL, "foxy"), NULL };
+    if (!s.path)
+    {
+        perror("foxy: temporary file");
+        return -1;
+    }
+    if (dir == '<')
+    {
+        fflush(stdout);
+        int saved = save_fd(1);
+        if (redirect_fd(s.path, O_WRONLY | O_CREAT | O_TRUNC, 1) == 0) run_text(cmd, len, 0);
+        fflush(stdout);
+        restore_fd(saved, 1);
+    }
+    else if (!(s.text = mem_alloc(MEM_EXEC, len + 1)))
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        free(s.path);
+        return -1;
+    }
+    else
+    {
+        memcpy(s.text, cmd, len);
+        s.text[len] = '\0';
+    }
+    snprintf(path, size, "%s", s.path);
+    substs[subst_count++] = s;
+    return 0;
+#else
+    int fds[2];
+    if (pipe_cloexec(fds) != 0)
+    {
+        perror("foxy: pipe");
+        return -1;
+    }
+    int mine = dir == '<' ? fds[0] : fds[1], theirs = dir == '<' ? fds[1] : fds[0];
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("foxy: fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        if (subst_bg && fork() != 0) _exit(0); // with &, left for init to reap
+        dup2(theirs, dir == '<' ? 1 : 0);
+        close(fds[0]);
+        close(fds[1]);
+        while (subst_count > 0) close(substs[--subst_count].fd);
+        int status = run_text(cmd, len, 1);
+        fflush(NULL);
+        _exit(status);
+    }
+    close(theirs);
+    if (subst_bg)
+    {
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+        pid = 0;
+    }
+    snprintf(path, size, "/dev/fd/%d", mine);
+    substs[subst_count++] = (subst_t){ mine, pid };
+    return 0;
+#endif
+}
+
+// Close the substitutions started since mark and wait for their commands;
+// for the left side of a pipe (async), the pipe waits for them instead
+static void end_substs(int mark, int async)
+{
+    while (subst_count > mark)
+    {
+        subst_t *s = &substs[--subst_count];
+#ifdef _WIN32
+        (void)async;
+        if (s->text)
+        {
+            int saved = save_fd(0);
+            if (redirect_fd(s->path, O_RDONLY, 0) == 0) run_text(s->text, strlen(s->text), 0);
+            restore_fd(saved, 0);
+            mem_free(s->text);
+        }
+        remove(s->path);
+        free(s->path);
+#else
+        close(s->fd);
+        if (!s->pid) continue;
+        if (async && pipe_pid_count < MAX_PIPE_PIDS) pipe_pids[pipe_pid_count++] = s->pid;
+        else while (waitpid(s->pid, NULL, 0) < 0 && errno == EINTR) {}
+#endif
+    }
+}
+
+static int needs_expand(const char *w)
+{
+    return strpbrk(w, (const char[]){ LEX_VAR, LEX_ARITH, LEX_GLOB, LEX_BRACE, LEX_SUBST, '\0' }) != NULL;
+}
+
+static char *copy_exec(const char *s)
+{
+    char *c = mem_strdup(MEM_EXEC, s);
+    if (!c) fprintf(stderr, "foxy: out of memory\n");
+    return c;
+}
+
+static char *expand_word(const char *w)
+{
+    static const char marks[] = { LEX_VAR, LEX_ARITH, LEX_SUBST, '\0' };
+    char *out = NULL;
+    size_t len = 0, cap = 0;
+    int err = put_str(&out, &len, &cap, "", 0);
+
+    for (const char *p = w; *p && !err;)
+    {
+        const char *mark = strpbrk(p, marks);
+        size_t n = mark ? (size_t)(mark - p) : strlen(p);
+        if ((err = put_str(&out, &len, &cap, p, n)) < 0 || !mark) break;
+
+        const char *end = strchr(mark + 1, *mark);
+        if (!end) end = mark + strlen(mark);
+        if (*mark == LEX_ARITH)
+        {
+            long long v;
+            char num[24];
+            if (arith_eval(mark + 1, (size_t)(end - mark - 1), &v) != 0)
+            {
+                mem_free(out);
+                return NULL;
+            }
+            snprintf(num, sizeof(num), "%lld", v);
+            err = put_str(&out, &len, &cap, num, strlen(num));
+        }
+        else if (*mark == LEX_SUBST)
+        {
+            char path[1024];
+            if (end - mark < 2 || start_subst(mark[1], mark + 2, (size_t)(end - mark - 2), path, sizeof(path)) != 0)
+            {
+                mem_free(out);
+                return NULL;
+            }
+            err = put_str(&out, &len, &cap, path, strlen(path));
+        }
+        else
+        {
+            char name[MAX_VAR_NAME];
+            snprintf(name, sizeof(name), "%.*s", (int)(end - mark - 1), mark + 1);
+            err = put_var(&out, &len, &cap, name);
+        }
+        p = *end ? end + 1 : end;
+    }
+    if (err)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        mem_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Expanded word w (taken) as the paths it matches, in g; g->count is 0
+// and w has lost its marks if it is not a pattern or matches nothing
+static int glob_word(char *w, glob_list_t *g)
+{
+    g->paths = NULL;
+    g->count = 0;
+    if (!glob_has_magic(w)) return 0;
+    if (glob_expand(w, g) != 0)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return -1;
+    }
+    if (g->count == 0) glob_strip(w);
+    return 0;
+}
+
+// argv being built: room for cap words and a NULL, and zeroed past count
+typedef struct
+{
+    char **v;
+    int count, cap;
+} args_t;
+
+static int grow_args(args_t *a, size_t extra)
+{
+    if (extra == 0) return 0;
+    char **grown = mem_realloc(MEM_EXEC, a->v, sizeof(char *) * (a->cap + extra + 1));
+    if (!grown)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return -1;
+    }
+    memset(grown + a->cap + 1, 0, sizeof(char *) * extra);
+    a->v = grown;
+    a->cap += (int)extra;
+    return 0;
+}
+
+// Add expanded word w (taken, may be NULL after an error) to a
+static int put_arg(args_t *a, char *w)
+{
+    glob_list_t g;
+    if (!w || glob_word(w, &g) != 0)
+    {
+        mem_free(w);
+        return -1;
+    }
+    if (g.count == 0)
+    {
+        a->v[a->count++] = w;
+        return 0;
+    }
+    mem_free(w);
+    int ok = grow_args(a, g.count - 1) == 0;
+    for (size_t i = 0; ok && i < g.count; ++i) ok = (a->v[a->count++] = copy_exec(g.paths[i])) != NULL;
+    glob_free(&g);
+    return ok ? 0 : -1;
+}
+
+static int put_brace_word(char *w, void *a)
+{
+    return put_arg(a, needs_expand(w) ? expand_word(w) : copy_exec(w));
+}
+
+static int too_many_words()
+{
+    fprintf(stderr, "foxy: brace expansion: more than %d words\n", MAX_BRACE_WORDS);
+    return -1;
+}
+
+// The words of brace expression w go straight into a, which is sized for
+// all of them first
+static int put_braces(args_t *a, const char *w)
+{
+    size_t n = brace_count(w);
+    if (n > MAX_BRACE_WORDS) return too_many_words();
+    if (grow_args(a, n - 1) != 0) return -1;
+    return brace_each(w, put_brace_word, a) == 0 ? 0 : -1;
+}
+
+// A redirection target: a pattern is taken as written
+static char *expand_path(const char *w)
+{
+    char *x = expand_word(w);
+    if (x) glob_strip(x);
+    if (x) brace_strip(x);
+    return x;
+}
+
+// A word that is exactly $@
+static int is_all_args(const char *w)
+{
+    return w[0] == LEX_VAR && w[1] == '@' && w[2] == LEX_VAR && w[3] == '\0';
+}
+
+static void free_expanded(node_t *x)
+{
+    if (x->cmd.args)
+    {
+        for (int i = 0; x->cmd.args[i]; ++i) mem_free(x->cmd.args[i]);
+        mem_free(x->cmd.args);
+    }
+    mem_free(x->cmd.infile);
+    mem_free(x->cmd.outfile);
+}
+
+// x = node with its words expanded, for one run; free with free_expanded()
+static int expand_cmd(const node_t *node, node_t *x)
+{
+    *x = *node;
+    x->cmd.expand = 0;
+    x->cmd.infile = x->cmd.outfile = NULL;
+
+    args_t a = { NULL, 0, 0 };
+    for (int i = 0; node->cmd.args[i]; ++i) a.cap += is_all_args(node->cmd.args[i]) ? func_argc() : 1;
+    a.v = mem_calloc(MEM_EXEC, a.cap + 1, sizeof(char *));
+    if (!a.v)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return -1;
+    }
+    int ok = 1;
+    for (int i = 0; ok && node->cmd.args[i]; ++i)
+    {
+        const char *w = node->cmd.args[i];
+        if (is_all_args(w)) for (int k = 0; ok && k < func_argc(); ++k) ok = (a.v[a.count++] = copy_exec(func_argv()[k])) != NULL;
+        else if (brace_has(w)) ok = put_braces(&a, w) == 0;
+        else ok = put_arg(&a, expand_word(w)) == 0;
+    }
+    x->cmd.args = a.v;
+    if (ok && node->cmd.infile) ok = (x->cmd.infile = expand_path(node->cmd.infile)) != NULL;
+    if (ok && node->cmd.outfile) ok = (x->cmd.outfile = expand_path(node->cmd.outfile)) != NULL;
+    if (!ok)
+    {
+        free_expanded(x);
+        return -1;
+    }
+    return 0;
+}
+
+static void spawn_failed(const char *name)
+{
+#ifdef _WIN32
+    (void)name;
+    perror("foxy: spawn");
+#else
+    if (errno == ENOENT) fprintf(stderr, "foxy: %s: command not found\n", name);
+    else fprintf(stderr, "foxy: %s: %s\n", name, strerror(errno));
+#endif
+}
+
+/*
+ * each-batch [-P JOBS] [-k KEEP] COMMAND ARGS...: run COMMAND as often as
+ * it takes to pass all of ARGS without going over the system's limit on
+ * the size of one program's arguments, as xargs does. The first KEEP
+ * arguments (by default the leading -options) go to every batch. Batches
+ * run one after another, or JOBS at a time; the status is the highest any
+ * batch returned.
+ */
+static int is_each_batch(const char *name)
+{
+    return strcmp(name, "each-batch") == 0;
+}
+
+// Bytes one program's arguments may take
+static size_t batch_limit()
+{
+#ifdef _WIN32
+    return 32767 - BATCH_HEADROOM; // the whole command line; the environment is apart
+#else
+    long max = sysconf(_SC_ARG_MAX);
+    size_t used = BATCH_HEADROOM;
+    for (char **e = environ; *e; ++e) used += strlen(*e) + 1 + sizeof(char *);
+    if (max <= 0) max = 131072;
+    return (size_t)max > used ? (size_t)max - used : 0;
+#endif
+}
+
+static size_t arg_cost(const char *arg)
+{
+#ifdef _WIN32
+    return strlen(arg) + 3; // a separating space, and quotes if it needs them
+#else
+    return strlen(arg) + 1 + sizeof(char *);
+#endif
+}
+
+static intptr_t start_program(char **argv)
+{
+#ifdef _WIN32
+    return _spawnvp(_P_NOWAIT, argv[0], (const char * const *)argv);
+#else
+    return spawn_program(_P_NOWAIT, argv);
+#endif
+}
+
+static int finish_program(intptr_t id)
+{
+#ifdef _WIN32
+    int st = 1;
+    _cwait(&st, id, 0);
+    return st;
+#else
+    return wait_program((pid_t)id);
+#endif
+}
+
+// Wait for whichever of the n running programs ends first: returns its slot
+// and puts its status in *status
+static int finish_any(const intptr_t *running, int n, int *status)
+{
 #ifdef _WIN32
-// Windows-specific spawn helper
+    DWORD r = WaitForMultipleObjects((DWORD)n, (const HANDLE *)running, FALSE, INFINITE);
+    int k = r < WAIT_OBJECT_0 + (DWORD)n ? (int)(r - WAIT_OBJECT_0) : 0;
+    *status = finish_program(running[k]);
+    return k;
+#else
+    // Poll only our own pids: waiting for any child would reap jobs too
+    struct timespec tick = { 0, 1000000 };
+    for (;;)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            int st;
+            pid_t r = waitpid((pid_t)running[k], &st, WNOHANG);
+            if (r == 0 || (r < 0 && errno == EINTR)) continue;
+            *status = r < 0 ? 1 : exit_status(st);
+            return k;
+        }
+        nanosleep(&tick, NULL);
+    }
+#endif
+}
+
+static int run_batches(char **argv)
+{
+    int jobs = 1, keep = -1, i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i + 1]; i += 2)
+    {
+        if (strcmp(argv[i], "-P") == 0) jobs = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) keep = atoi(argv[i + 1]);
+        else break;
+    }
+    if (!argv[i] || argv[i][0] == '-')
+    {
+        fprintf(stderr, "foxy: usage: each-batch [-P JOBS] [-k KEEP] COMMAND ARGS...\n");
+        return 2;
+    }
+    if (jobs < 1) jobs = 1;
+    if (jobs > MAX_BATCH_JOBS) jobs = MAX_BATCH_JOBS;
+
+    char **cmd = argv + i;
+    int count = 0, fixed = 1;
+    while (cmd[count]) count++;
+    if (keep < 0) while (fixed < count && cmd[fixed][0] == '-') fixed++;
+    else fixed = keep + 1 < count ? keep + 1 : count;
+
+    char **batch = mem_alloc(MEM_EXEC, sizeof(char *) * (count + 1));
+    if (!batch)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        return 1;
+    }
+    size_t limit = batch_limit(), fixed_cost = 0;
+    for (int k = 0; k < fixed; ++k)
+    {
+        batch[k] = cmd[k];
+        fixed_cost += arg_cost(cmd[k]);
+    }
+
+    intptr_t running[MAX_BATCH_JOBS];
+    int n_running = 0, status = 0, next = fixed;
+    uint64_t t = TRACE_START();
+    do
+    {
+        // At least one argument per batch, even one too big to pass alone
+        int k = fixed;
+        size_t cost = fixed_cost;
+        while (next < count && (k == fixed || cost + arg_cost(cmd[next]) <= limit))
+        {
+            cost += arg_cost(cmd[next]);
+            batch[k++] = cmd[next++];
+        }
+        batch[k] = NULL;
+
+        if (n_running == jobs)
+        {
+            int st;
+            int k = finish_any(running, n_running, &st);
+            if (st > status) status = st;
+            running[k] = running[--n_running]; // the slot is free
+        }
+        intptr_t id = start_program(batch);
+        if (id == -1)
+        {
+            spawn_failed(cmd[0]);
+            status = 127;
+            break;
+        }
+        running[n_running++] = id;
+    } while (next < count && !foxy_interrupted);
+
+    for (int k = 0; k < n_running; ++k)
+    {
+        int st = finish_program(running[k]);
+        if (st > status) status = st;
+    }
+    TRACE_SPAN("each-batch", t, cmd[0]);
+    mem_free(batch);
+    return status;
+}
+
+static int run_async(node_t *node, const char *name, int bg_mode);
+
 static int spawn_command(node_t *node, int input_fd, int output_fd)
 {
     // Save standard FDs
@@ -33,33 +746,34 @@ static int spawn_command(node_t *node, int input_fd, int output_fd)
     
     if (input_fd != -1)
     {
-        saved_stdin = dup(0);
+        saved_stdin = save_fd(0);
         dup2(input_fd, 0);
     }
     else if (node->cmd.infile)
     {
-        saved_stdin = dup(0);
-        int fd = open(node->cmd.infile, O_RDONLY);
-        if (fd < 0) { perror(node->cmd.infile); return 1; }
-        dup2(fd, 0);
-        close(fd);
+        saved_stdin = save_fd(0);
+        if (redirect_fd(node->cmd.infile, O_RDONLY, 0) != 0)
+        {
+            restore_fd(saved_stdin, 0);
+            return 1;
+        }
     }
 
     if (output_fd != -1)
     {
-        saved_stdout = dup(1);
+        saved_stdout = save_fd(1);
         dup2(output_fd, 1);
     }
     else if (node->cmd.outfile)
     {
-        saved_stdout = dup(1);
-        int flags = O_WRONLY | O_CREAT;
-        if (node->cmd.append_out) flags |= O_APPEND;
-        else flags |= O_TRUNC;
-        int fd = open(node->cmd.outfile, flags, 0644);
-        if (fd < 0) { perror(node->cmd.outfile); return 1; }
-        dup2(fd, 1);
-        close(fd);
+        fflush(stdout);
+        saved_stdout = save_fd(1);
+        if (redirect_fd(node->cmd.outfile, out_flags(node), 1) != 0)
+        {
+            restore_fd(saved_stdout, 1);
+            restore_fd(saved_stdin, 0);
+            return 1;
+        }
     }
 
     // Check builtin
@@ -68,17 +782,41 @@ static int spawn_command(node_t *node, int input_fd, int output_fd)
     int mode = (node->cmd.bg_mode > 0) ? _P_NOWAIT : _P_WAIT;
     int status = 0;
 
-    if (builtin_dispatch(argv))
+    uint64_t t = TRACE_START();
+    if (mode == _P_WAIT && is_each_batch(argv[0]))
+    {
+        status = run_batches(argv);
+    }
+    else if (node->cmd.bg_mode == 2 && is_builtin(argv[0]))
     {
-        status = 0; 
+        status = run_async(node, argv[0], 2);
+    }
+    else if (builtin_dispatch(argv, &status))
+    {
+        TRACE_SPAN("builtin", t, argv[0]);
+        fflush(stdout); // before stdout is switched back
+    }
+    else if (mode == _P_WAIT && func_call(argv, &status))
+    {
+        TRACE_SPAN("function", t, argv[0]);
+        fflush(stdout);
+    }
+    else if (mode == _P_NOWAIT && (func_exists(argv[0]) || is_each_batch(argv[0])))
+    {
+        status = run_async(node, argv[0], node->cmd.bg_mode);
     }
     else
     {
         // Not a builtin, spawn
-        int ret = _spawnvp(mode, argv[0], (const char * const *)argv);
+#ifdef _WIN32
+        intptr_t ret = _spawnvp(mode, argv[0], (const char * const *)argv);
+        TRACE_SPAN(mode == _P_WAIT ? "spawn+wait" : "spawn", t, argv[0]);
+#else
+        intptr_t ret = spawn_program(mode, argv);
+#endif
         if (ret == -1)
         {
-            perror("foxy: spawn");
+            spawn_failed(argv[0]);
             status = 127;
         }
         else
@@ -89,29 +827,265 @@ static int spawn_command(node_t *node, int input_fd, int output_fd)
                  // returning 0 to executor to signify "started bg"
                  if (node->cmd.bg_mode == 1) // Only track explicit background jobs
                  {
-                     job_add((intptr_t)ret, argv[0]); 
+                     job_add(ret, argv[0]); 
                  }
+#ifndef _WIN32
+                 else if (pipe_pid_count < MAX_PIPE_PIDS)
+                 {
+                     pipe_pids[pipe_pid_count++] = (pid_t)ret;
+                 }
+#endif
                  status = 0; 
             }
             else
             {
-                status = ret;
+                status = (int)ret;
             }
         }
     }
 
     // Restore Standard FDs
-    if (saved_stdin != -1)
+    restore_fd(saved_stdin, 0);
+    restore_fd(saved_stdout, 1);
+
+    return status;
+}
+
+static int exec_replace(node_t *node);
+
+// A simple command; with last, it may replace the shell (foxy -c)
+static int run_cmd(node_t *node, int last)
+{
+    if (!node->cmd.expand) return last ? exec_replace(node) : spawn_command(node, -1, -1);
+
+    node_t x;
+    int mark = subst_count, status = 1;
+    subst_bg = node->cmd.bg_mode == 1;
+    int err = expand_cmd(node, &x);
+    subst_bg = 0;
+    if (!err)
+    {
+        // exec would close the substitutions' descriptors, so spawn instead
+        if (x.cmd.args[0]) status = last && subst_count == mark ? exec_replace(&x) : spawn_command(&x, -1, -1);
+        else status = 0; // just $@ with none
+        free_expanded(&x);
+    }
+    end_substs(mark, node->cmd.bg_mode == 2);
+    return status;
+}
+
+static int set_var(const char *name, const char *value)
+{
+    if (setenv(name, value, 1) != 0)
+    {
+        perror("foxy: for");
+        return -1;
+    }
+    return 0;
+}
+
+// Run the body of for loop node for each word w expands to
+static int for_word(node_t *node, const char *w, int *status)
+{
+    char *value = NULL;
+    glob_list_t g = { NULL, 0 };
+    int mark = subst_count;
+    if (needs_expand(w) && (!(value = expand_word(w)) || glob_word(value, &g) != 0))
+    {
+        mem_free(value);
+        end_substs(mark, 0);
+        return -1;
+    }
+    int err = 0;
+    if (g.count == 0 && !(err = set_var(node->ctl.var, value ? value : w))) *status = exec_node(node->ctl.body);
+    for (size_t i = 0; i < g.count && !err && !foxy_interrupted; ++i)
+    {
+        if (!(err = set_var(node->ctl.var, g.paths[i]))) *status = exec_node(node->ctl.body);
+    }
+    glob_free(&g);
+    mem_free(value);
+    end_substs(mark, 0);
+    return err;
+}
+
+typedef struct
+{
+    node_t *node;
+    int status;
+} for_ctx_t;
+
+// Each word of a brace expression is run as it is made
+static int for_brace_word(char *w, void *ctx)
+{
+    for_ctx_t *f = ctx;
+    if (foxy_interrupted) return 1;
+    return for_word(f->node, w, &f->status) != 0 ? -1 : 0;
+}
+
+// The loop or if itself; Ctrl+C stops a loop before its next iteration
+static int run_compound(node_t *node)
+{
+    int status = 0;
+    switch (node->type)
+    {
+        case NODE_FOR:
+            for (char **w = node->ctl.words; *w && !foxy_interrupted; ++w)
+            {
+                if (is_all_args(*w))
+                {
+                    for (int i = 0; i < func_argc() && !foxy_interrupted; ++i)
+                    {
+                        if (set_var(node->ctl.var, func_argv()[i])) return 1;
+                        status = exec_node(node->ctl.body);
+                    }
+                    continue;
+                }
+                int err = 0;
+                if (brace_has(*w))
+                {
+                    for_ctx_t f = { node, status };
+                    err = brace_count(*w) > MAX_BRACE_WORDS ? too_many_words() : brace_each(*w, for_brace_word, &f) < 0;
+                    status = f.status;
+                }
+                else
+                {
+                    err = for_word(node, *w, &status) != 0;
+                }
+                if (err) return 1;
+            }
+            return status;
+
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            while (!foxy_interrupted && (exec_node(node->ctl.cond) == 0) == (node->type == NODE_WHILE))
+            {
+                status = exec_node(node->ctl.body);
+            }
+            return status;
+
+        case NODE_IF:
+            if (exec_node(node->ctl.cond) == 0) return exec_node(node->ctl.body);
+            return exec_node(node->ctl.other);
+
+        default:
+            return 1;
+    }
+}
+
+// With the redirections written after done / fi
+static int exec_compound(node_t *node)
+{
+    char *in = NULL, *out = NULL;
+    const char *infile = node->ctl.infile, *outfile = node->ctl.outfile;
+    int mark = subst_count;
+    if ((infile && needs_expand(infile) && !(infile = in = expand_path(infile))) ||
+        (outfile && needs_expand(outfile) && !(outfile = out = expand_path(outfile))))
     {
-        dup2(saved_stdin, 0);
-        close(saved_stdin);
+        mem_free(in);
+        end_substs(mark, 0);
+        return 1;
     }
-    if (saved_stdout != -1)
+
+    int saved_stdin = -1, saved_stdout = -1, status = 1, ok = 1;
+    if (infile)
+    {
+        saved_stdin = save_fd(0);
+        ok = redirect_fd(infile, O_RDONLY, 0) == 0;
+    }
+    if (ok && outfile)
     {
-        dup2(saved_stdout, 1);
-        close(saved_stdout);
+        fflush(stdout);
+        saved_stdout = save_fd(1);
+        int flags = O_WRONLY | O_CREAT | (node->ctl.append_out ? O_APPEND : O_TRUNC);
+        ok = redirect_fd(outfile, flags, 1) == 0;
+    }
+    if (ok)
+    {
+        status = run_compound(node);
+        fflush(stdout);
     }
 
+    restore_fd(saved_stdin, 0);
+    restore_fd(saved_stdout, 1);
+    mem_free(in);
+    mem_free(out);
+    end_substs(mark, 0);
+    return status;
+}
+
+// A loop or if, a builtin, function call or each-batch (whose redirections
+// are in place)
+static int run_in_shell(node_t *node)
+{
+    if (node->type != NODE_CMD) return exec_compound(node);
+    if (is_each_batch(node->cmd.args[0])) return run_batches(node->cmd.args);
+    int status = 1;
+    if (builtin_dispatch(node->cmd.args, &status)) return status;
+    func_call(node->cmd.args, &status);
+    return status;
+}
+
+/*
+ * A loop, if or function call that runs beside the shell: in the background
+ * (&), or as the left side of a pipe, where the right side must be reading
+ * at the same time (so a builtin there too, or a long history or echo fills
+ * the pipe and never returns). On POSIX it runs in a forked copy of the shell. Windows
+ * has no fork: a background one runs in the foreground, and pipes are
+ * handled by exec_pipe_buffered().
+ */
+static int run_async(node_t *node, const char *name, int bg_mode)
+{
+#ifdef _WIN32
+    if (bg_mode == 1) fprintf(stderr, "foxy: %s: runs in the foreground on Windows\n", name);
+    return run_in_shell(node);
+#else
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("foxy: fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        int status = run_in_shell(node);
+        fflush(NULL);
+        _exit(status);
+    }
+    if (bg_mode == 1) job_add(pid, name);
+    else if (pipe_pid_count < MAX_PIPE_PIDS) pipe_pids[pipe_pid_count++] = pid;
+    return 0;
+#endif
+}
+
+static int exec_compound_async(node_t *node)
+{
+    static const char *names[] = { [NODE_FOR] = "for", [NODE_WHILE] = "while", [NODE_UNTIL] = "until", [NODE_IF] = "if" };
+    return run_async(node, names[node->type], node->ctl.bg_mode);
+}
+
+#ifdef _WIN32
+// left | right where left runs in the shell (a loop, if, builtin or function): left's
+// output goes to a temporary file first, which is then right's input
+static int exec_pipe_buffered(node_t *node)
+{
+    FILE *tmp = tmpfile();
+    if (!tmp) { perror("foxy: pipe"); return 1; }
+
+    fflush(stdout);
+    int saved_stdout = save_fd(1);
+    dup2(fileno(tmp), 1);
+    exec_node(node->binary.left);
+    fflush(stdout);
+    restore_fd(saved_stdout, 1);
+
+    _lseek(fileno(tmp), 0, SEEK_SET);
+    int saved_stdin = save_fd(0);
+    dup2(fileno(tmp), 0);
+    int status = exec_node(node->binary.right);
+    restore_fd(saved_stdin, 0);
+    fclose(tmp);
     return status;
 }
 #endif
@@ -123,11 +1097,21 @@ int exec_node(node_t *node)
     switch (node->type)
     {
         case NODE_CMD:
-#ifdef _WIN32
-            return spawn_command(node, -1, -1);
-#else
-            return 0; 
-#endif
+            return run_cmd(node, 0);
+
+        case NODE_FOR:
+        case NODE_WHILE:
+        case NODE_UNTIL:
+        case NODE_IF:
+            if (node->ctl.bg_mode) return exec_compound_async(node);
+            return exec_compound(node);
+
+        case NODE_FUNC:
+        {
+            node_t *body = copy_ast(node->ctl.body);
+            if (!body) { fprintf(stderr, "foxy: out of memory\n"); return 1; }
+            return func_define(node->ctl.var, body) == 0 ? 0 : 1;
+        }
             
         case NODE_SEQ:
             exec_node(node->binary.left);
@@ -149,13 +1133,20 @@ int exec_node(node_t *node)
         
         case NODE_PIPE:
         {
-#ifdef _WIN32
             int pfds[2];
+#ifdef _WIN32
+            node_t *left = node->binary.left;
+            if (left->type >= NODE_FOR || (left->type == NODE_CMD && (is_builtin(left->cmd.args[0]) || func_exists(left->cmd.args[0]) || is_each_batch(left->cmd.args[0])))) return exec_pipe_buffered(node);
             if (_pipe(pfds, 4096, _O_BINARY) == -1) { perror("pipe"); return 1; }
+#else
+            if (pipe_cloexec(pfds) == -1) { perror("pipe"); return 1; }
+            int reap_from = pipe_pid_count;
+#endif
             
             // Left command async
-            int saved_stdout = dup(1);
-            int saved_stdin = dup(0);
+            fflush(stdout);
+            int saved_stdout = save_fd(1);
+            int saved_stdin = save_fd(0);
             
             dup2(pfds[1], 1);
             close(pfds[1]); 
@@ -163,6 +1154,7 @@ int exec_node(node_t *node)
             // Hack: Mark left as background to force _P_NOWAIT
             // Accessing union members: depends on type
             if (node->binary.left->type == NODE_CMD) node->binary.left->cmd.bg_mode = 2; // PIPE_ASYNC
+            else if (node->binary.left->type >= NODE_FOR) node->binary.left->ctl.bg_mode = 2;
             else node->binary.left->binary.bg_mode = 2;
 
             exec_node(node->binary.left); // Ignoring handle
@@ -177,14 +1169,78 @@ int exec_node(node_t *node)
             
             dup2(saved_stdin, 0);
             close(saved_stdin);
-            
-            return stat2;
-#else
-            return 1;
+
+#ifndef _WIN32
+            uint64_t t = TRACE_START();
+            while (pipe_pid_count > reap_from)
+            {
+                int st;
+                pid_t pid = pipe_pids[--pipe_pid_count];
+                while (waitpid(pid, &st, 0) < 0 && errno == EINTR) {}
+            }
+            TRACE_SPAN("wait pipe", t, NULL);
 #endif
+            return stat2;
         }
         
         default:
             return 1;
     }
 }
+
+/*
+ * Run a command that is the last thing the shell will do (foxy -c): an
+ * external program replaces the shell instead of being spawned and waited
+ * for. Windows has no exec that keeps the process, so there it is spawned.
+ */
+static int exec_replace(node_t *node)
+{
+#ifndef _WIN32
+    char **argv = node->cmd.args;
+    if (node->cmd.bg_mode == 0 && argv && argv[0] && !is_builtin(argv[0]) && !func_exists(argv[0]))
+    {
+        if (node->cmd.infile && redirect_fd(node->cmd.infile, O_RDONLY, 0) != 0) return 1;
+        if (node->cmd.outfile && redirect_fd(node->cmd.outfile, out_flags(node), 1) != 0) return 1;
+        TRACE_EVENT("exec", argv[0]);
+        trace_exit(); // nothing runs after a successful exec
+        fflush(NULL);
+        execvp(argv[0], argv);
+        if (errno == ENOENT) fprintf(stderr, "foxy: %s: command not found\n", argv[0]);
+        else fprintf(stderr, "foxy: %s: %s\n", argv[0], strerror(errno));
+        return 127;
+    }
+#endif
+    return spawn_command(node, -1, -1);
+}
+
+int exec_node_last(node_t *node)
+{
+    if (!node) return 0;
+
+    switch (node->type)
+    {
+        case NODE_CMD:
+            return run_cmd(node, 1);
+
+        case NODE_SEQ:
+            exec_node(node->binary.left);
+            return exec_node_last(node->binary.right);
+
+        case NODE_AND:
+        {
+            int status = exec_node(node->binary.left);
+            if (status == 0) return exec_node_last(node->binary.right);
+            return status;
+        }
+
+        case NODE_OR:
+        {
+            int status = exec_node(node->binary.left);
+            if (status != 0) return exec_node_last(node->binary.right);
+            return status;
+        }
+
+        default:
+            return exec_node(node);
+    }
+}
@@ -2,8 +2,9 @@
 #define FOXY_H
 
 #include <stddef.h>
+#include <signal.h>
 
-typedef enum { LEX_OK = 0, LEX_ERR_UNCLOSED_QUOTE = 1, LEX_ERR_OOM = 2 } lex_err_t;
+typedef enum { LEX_OK = 0, LEX_ERR_UNCLOSED_QUOTE = 1, LEX_ERR_OOM = 2, LEX_ERR_UNCLOSED_ARITH = 3, LEX_ERR_UNCLOSED_SUBST = 4 } lex_err_t;
 
 #include "jobs.h"
 
@@ -11,14 +12,68 @@ typedef struct
 {
     char **items;
     size_t count;
+    size_t cap;         // slots allocated in items
 
 } token_list_t;
 
 /* Lexer API */
 int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode);
 void free_token_list(token_list_t *t);
+// Replace t's first token with all of front's, which t takes over (front is
+// left empty); -1 if out of memory
+int splice_tokens(token_list_t *t, token_list_t *front);
 
-int builtin_dispatch(char **tokens);
+// $NAME is not expanded by the lexer but kept as LEX_VAR NAME LEX_VAR, so a
+// loop body parsed once sees the value current at each run; quoted and
+// escaped dollars are plain '$'. A newline outside quotes becomes ";".
+#define LEX_VAR '\x01'
+// $((expr)) is kept as LEX_ARITH expr LEX_ARITH, expr as written (arith.h)
+#define LEX_ARITH '\x02'
+// An unquoted *, ? or [ is kept as LEX_GLOB followed by the character (glob.h)
+#define LEX_GLOB '\x03'
+// So is each {, comma and } of an unquoted brace expression (brace.h)
+#define LEX_BRACE '\x04'
+// <(cmd) and >(cmd) are kept as LEX_SUBST, '<' or '>', cmd as written, LEX_SUBST
+#define LEX_SUBST '\x05'
+
+// Nonzero for for, do, done, if, ... (keywords only where a command starts)
+int is_keyword(const char *word, size_t len);
+
+/* Highlighting (lexer.c) */
+typedef enum
+{
+    HL_PLAIN,
+    HL_COMMAND,
+    HL_BUILTIN,        // builtins, aliases and functions
+    HL_UNKNOWN_CMD,
+    HL_STRING,
+    HL_OPERATOR,
+    HL_VARIABLE
+} hl_class_t;
+
+// Scanner state before a byte; a scan can resume wherever in_word is 0
+typedef struct
+{
+    unsigned char mode;      // normal, quotes, escape
+    unsigned char expect;    // next word is a command
+    unsigned char redirect;  // next word is a file name
+    unsigned char in_word;
+    unsigned char is_cmd;    // current word is a command
+    unsigned char var;       // inside $NAME (2: just after the $)
+    unsigned char arith;     // inside $((...)) or <(...): 1 + open parentheses
+} lex_state_t;
+
+#define LEX_STATE_INIT ((lex_state_t){ 0, 1, 0, 0, 0, 0, 0 })
+
+typedef hl_class_t (*lex_cmd_fn)(const char *word, size_t len);
+
+// Classify line[from..len) into classes[], recording states[from..len]
+// (states[from] must hold the state to resume from)
+void lex_highlight(const char *line, size_t len, size_t from, lex_state_t *states, unsigned char *classes, lex_cmd_fn classify);
+
+int builtin_dispatch(char **tokens, int *status); // 1 if handled; *status is its exit status
+extern const char *builtin_names[]; // NULL-terminated, for completion
+int is_builtin(const char *name);
 
 /* AST */
 typedef enum 
@@ -28,6 +83,11 @@ typedef enum
     NODE_SEQ,      // ;
     NODE_AND,      // &&
     NODE_OR,       // ||
+    NODE_FOR,      // for NAME in WORDS; do BODY; done
+    NODE_WHILE,    // while COND; do BODY; done
+    NODE_UNTIL,    // until COND; do BODY; done
+    NODE_IF,       // if COND; then BODY; [elif ...|else OTHER;] fi
+    NODE_FUNC,     // NAME() { BODY; } defines a function
 } node_type_t;
 
 typedef struct node_t 
@@ -42,6 +102,7 @@ typedef struct node_t
             char *outfile;     // > or >>
             int append_out;    // 1 if >>, 0 if >
             int bg_mode;       // 0=FG, 1=BG(&), 2=PIPE_ASYNC
+            int expand;        // some word holds LEX_VAR references
         } cmd;
 
         struct 
@@ -50,15 +111,37 @@ typedef struct node_t
             struct node_t *right;
             int bg_mode; 
         } binary;
+
+        struct
+        {
+            struct node_t *cond;   // while, until, if
+            struct node_t *body;   // loop body, or the then-branch
+            struct node_t *other;  // if: the elif (a NODE_IF) or else list
+            char *var;             // for: loop variable; function name
+            char **words;          // for: values, NULL terminated
+            char *infile;          // redirections after done / fi
+            char *outfile;
+            int append_out;
+            int bg_mode;           // as for cmd
+        } ctl;
     };
 } node_t;
 
 /* Parser API */
 node_t *parse_tokens(token_list_t *tokens);
 void free_ast(node_t *node);
+node_t *copy_ast(const node_t *node); // NULL if out of memory
+// After parse_tokens() returned NULL: 1 if the input ended inside a for,
+// while, until, if or function body, so more lines are needed rather than
+// an error
+int parse_needs_more();
 
 /* Executor API */
 int exec_node(node_t *node);
+// As exec_node, but the last command replaces the shell (for foxy -c)
+int exec_node_last(node_t *node);
+// Set by the SIGINT handler; loops stop at their next iteration
+extern volatile sig_atomic_t foxy_interrupted;
 
 /* Prompt API */
 void set_prompt_format(const char *fmt);
@@ -0,0 +1,152 @@
+#include "func.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUNC_TABLE_MIN 16   // slots; a power of two
+
+/*
+ * A body is shared by the table and every call of it in progress, so a
+ * function that redefines itself (or another running one) does not free
+ * the tree it is executing.
+ */
+typedef struct
+{
+    node_t *ast;
+    int refs;
+} func_body_t;
+
+typedef struct
+{
+    char *name;         // NULL: empty slot
+    func_body_t *body;
+} func_t;
+
+// Open addressing with linear probing; functions are never removed
+static func_t *table;
+static size_t table_cap, table_count;
+
+static char **args;     // $1.. of the current call
+static int arg_count;
+static int depth;
+
+static size_t hash(const char *s)
+{
+    size_t h = 2166136261u; // FNV-1a
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static func_t *slot_for(func_t *t, size_t cap, const char *name)
+{
+    size_t i = hash(name) & (cap - 1);
+    while (t[i].name && strcmp(t[i].name, name) != 0) i = (i + 1) & (cap - 1);
+    return &t[i];
+}
+
+static void body_release(func_body_t *b)
+{
+    if (--b->refs > 0) return;
+    free_ast(b->ast);
+    mem_free(b);
+}
+
+static int grow()
+{
+    size_t cap = table_cap ? table_cap * 2 : FUNC_TABLE_MIN;
+    func_t *t = mem_calloc(MEM_FUNCS, cap, sizeof(func_t));
+    if (!t) return -1;
+    for (size_t i = 0; i < table_cap; ++i)
+    {
+        if (table[i].name) *slot_for(t, cap, table[i].name) = table[i];
+    }
+    mem_free(table);
+    table = t;
+    table_cap = cap;
+    return 0;
+}
+
+int func_define(const char *name, node_t *body)
+{
+    func_body_t *b = mem_alloc(MEM_FUNCS, sizeof(func_body_t));
+    if (!b || ((table_count + 1) * 4 > table_cap * 3 && grow() != 0))
+    {
+        mem_free(b);
+        free_ast(body);
+        fprintf(stderr, "foxy: out of memory\n");
+        return -1;
+    }
+    b->ast = body;
+    b->refs = 1;
+
+    func_t *f = slot_for(table, table_cap, name);
+    if (f->name)
+    {
+        body_release(f->body);
+    }
+    else
+    {
+        f->name = mem_strdup(MEM_FUNCS, name);
+        if (!f->name)
+        {
+            body_release(b);
+            fprintf(stderr, "foxy: out of memory\n");
+            return -1;
+        }
+        table_count++;
+    }
+    f->body = b;
+    return 0;
+}
+
+int func_exists(const char *name)
+{
+    return table_count > 0 && slot_for(table, table_cap, name)->name != NULL;
+}
+
+int func_call(char **argv, int *status)
+{
+    if (table_count == 0) return 0;
+    func_t *f = slot_for(table, table_cap, argv[0]);
+    if (!f->name) return 0;
+
+    if (depth >= MAX_FUNC_DEPTH)
+    {
+        fprintf(stderr, "foxy: %s: functions nested too deeply\n", argv[0]);
+        *status = 1;
+        return 1;
+    }
+
+    func_body_t *b = f->body;
+    b->refs++;
+    char **saved_args = args;
+    int saved_count = arg_count;
+    args = argv + 1;
+    for (arg_count = 0; args[arg_count]; ++arg_count) {}
+
+    depth++;
+    *status = exec_node(b->ast);
+    depth--;
+
+    args = saved_args;
+    arg_count = saved_count;
+    body_release(b);
+    return 1;
+}
+
+void func_set_args(int argc, char **argv)
+{
+    args = argv;
+    arg_count = argc;
+}
+
+int func_argc()
+{
+    return arg_count;
+}
+
+char **func_argv()
+{
+    return args;
+}
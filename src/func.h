@@ -0,0 +1,22 @@
+#ifndef FUNC_H
+#define FUNC_H
+
+#include "foxy.h"
+
+#define MAX_FUNC_DEPTH 256  // nested calls, so runaway recursion stops
+
+// Define or replace name with body (taking ownership of body)
+int func_define(const char *name, node_t *body);
+int func_exists(const char *name);
+
+// Run function argv[0] with $1.. = argv[1..]. Returns 0 if there is no
+// such function, else 1 with its exit status in *status.
+int func_call(char **argv, int *status);
+
+// Positional parameters ($1.., $#, $@) of the function running now, or of
+// the script when none is
+void func_set_args(int argc, char **argv);
+int func_argc();
+char **func_argv();
+
+#endif // FUNC_H
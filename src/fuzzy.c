@@ -0,0 +1,217 @@
+#include "fuzzy.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Scoring weights, in the spirit of fzf's v1 algorithm */
+#define SCORE_MATCH 16
+#define GAP_START 3
+#define GAP_EXTEND 1
+#define BONUS_BOUNDARY 8
+#define BONUS_CAMEL 7
+#define BONUS_CONSECUTIVE 4
+
+#define NEAR_BYTES 8     // looked at one by one before a vector scan
+#define MAX_PATTERN 256  // longer patterns are cut here
+
+/*
+ * Bits 0-25 are the letters a-z (folded), then digits and the separators
+ * that commonly appear in commands. Everything else shares the top bit.
+ */
+static uint32_t char_bit(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z') return 1u << (c - 'a');
+    if (c >= 'A' && c <= 'Z') return 1u << (c - 'A');
+    if (c >= '0' && c <= '9') return 1u << 26;
+    if (c == '-') return 1u << 27;
+    if (c == '_') return 1u << 28;
+    if (c == '.') return 1u << 29;
+    if (c == '/' || c == '\\') return 1u << 30;
+    return 1u << 31;
+}
+
+uint32_t fuzzy_mask(const char *s, size_t len)
+{
+    uint32_t m = 0;
+    for (size_t i = 0; i < len; ++i) m |= char_bit((unsigned char)s[i]);
+    return m;
+}
+
+size_t fuzzy_filter(const uint32_t *masks, size_t n, uint32_t need, uint32_t *out)
+{
+    size_t k = 0, i = 0;
+#ifdef __SSE2__
+    // Four candidates per step; the compare yields one lane per hit
+    __m128i q = _mm_set1_epi32((int)need);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i m = _mm_loadu_si128((const __m128i *)(masks + i));
+        __m128i hit = _mm_cmpeq_epi32(_mm_and_si128(m, q), q);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        while (bits)
+        {
+            int b = __builtin_ctz((unsigned int)bits);
+            out[k++] = (uint32_t)(i + (size_t)b);
+            bits &= bits - 1;
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        if ((masks[i] & need) == need) out[k++] = (uint32_t)i;
+    }
+    return k;
+}
+
+static int is_separator(unsigned char c)
+{
+    return c == ' ' || c == '/' || c == '\\' || c == '-' || c == '_' || c == '.' || c == '=' || c == ':';
+}
+
+static int boundary_bonus(unsigned char prev, unsigned char c)
+{
+    if (is_separator(prev)) return BONUS_BOUNDARY;
+    if (prev >= 'a' && prev <= 'z' && c >= 'A' && c <= 'Z') return BONUS_CAMEL;
+    return 0;
+}
+
+// ASCII case folding without a locale lookup per character
+static unsigned char fold_char(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c | 0x20) : c;
+}
+
+// First i in [from, n) where s[i] is a or b, or n
+static inline size_t find_next(const char *s, size_t from, size_t n, char a, char b)
+{
+    // Matches are mostly close by: look a few bytes ahead before the vector scan
+    size_t probe = from + NEAR_BYTES < n ? from + NEAR_BYTES : n;
+    for (; from < probe; ++from)
+    {
+        if (s[from] == a || s[from] == b) return from;
+    }
+#ifdef __SSE2__
+    // Then sixteen bytes per compare; the mask has one bit per hit
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; from + 16 <= n; from += 16)
+    {
+        __m128i t = _mm_loadu_si128((const __m128i *)(s + from));
+        int bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(t, va), _mm_cmpeq_epi8(t, vb)));
+        if (bits) return from + (size_t)__builtin_ctz((unsigned int)bits);
+    }
+#endif
+    for (; from < n; ++from)
+    {
+        if (s[from] == a || s[from] == b) return from;
+    }
+    return n;
+}
+
+// Last i < to where s[i] is a or b (there is one)
+static inline size_t find_prev(const char *s, size_t to, char a, char b)
+{
+    size_t probe = to > NEAR_BYTES ? to - NEAR_BYTES : 0;
+    while (to > probe)
+    {
+        if (s[--to] == a || s[to] == b) return to;
+    }
+#ifdef __SSE2__
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; to >= 16; to -= 16)
+    {
+        __m128i t = _mm_loadu_si128((const __m128i *)(s + to - 16));
+        int bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(t, va), _mm_cmpeq_epi8(t, vb)));
+        if (bits) return to - 16 + (size_t)(31 - __builtin_clz((unsigned int)bits));
+    }
+#endif
+    while (to > 0)
+    {
+        if (s[--to] == a || s[to] == b) return to;
+    }
+    return 0;
+}
+
+/*
+ * Each pattern character is searched for directly, a few bytes ahead and
+ * then 16 bytes per compare against both of its cases, and the score is
+ * worked out from where the matches fall, a gap being the distance between
+ * two of them. Long gaps cost one compare per 16 bytes instead of a loop
+ * iteration per byte.
+ */
+int fuzzy_score(const char *pattern, size_t plen, const char *text, size_t tlen)
+{
+    if (plen == 0) return 0;
+    if (plen > tlen) return -1;
+
+    // Both cases of each pattern character, or the same one twice
+    char lo[MAX_PATTERN], up[MAX_PATTERN];
+    if (plen > MAX_PATTERN) plen = MAX_PATTERN;
+    int fold = 1;
+    for (size_t i = 0; i < plen; ++i)
+    {
+        if (pattern[i] >= 'A' && pattern[i] <= 'Z') { fold = 0; break; }
+    }
+    for (size_t i = 0; i < plen; ++i)
+    {
+        lo[i] = fold ? (char)fold_char((unsigned char)pattern[i]) : pattern[i];
+        up[i] = fold && lo[i] >= 'a' && lo[i] <= 'z' ? (char)(lo[i] - 0x20) : lo[i];
+    }
+
+    // Forward: where does the first complete subsequence end?
+    size_t end = 0;
+    for (size_t pi = 0; pi < plen; ++pi)
+    {
+        end = find_next(text, end, tlen, lo[pi], up[pi]);
+        if (end == tlen) return -1;
+        end++;
+    }
+
+    // Backward: the tightest window ending there
+    size_t start = end;
+    for (size_t pi = plen; pi-- > 0;) start = find_prev(text, start, lo[pi], up[pi]);
+
+    // The matches from start; the last one is at end - 1
+    int score = 0;
+    for (size_t pi = 0, i = start; pi < plen; ++pi)
+    {
+        size_t m = find_next(text, i, end, lo[pi], up[pi]);
+        int bonus = boundary_bonus(m ? (unsigned char)text[m - 1] : ' ', (unsigned char)text[m]);
+        if (pi == 0) bonus *= 2;
+        else if (m == i) bonus += BONUS_CONSECUTIVE;
+        else score -= GAP_START + (int)(m - i - 1) * GAP_EXTEND;
+        score += SCORE_MATCH + bonus;
+        i = m + 1;
+    }
+
+    return score < 0 ? 0 : score;
+}
+
+int fuzzy_best(const char *pattern, const char *const *cands, size_t n)
+{
+    if (n == 0) return -1;
+    size_t plen = strlen(pattern);
+
+    uint32_t *masks = malloc(sizeof(uint32_t) * n * 2);
+    if (!masks) return -1;
+    uint32_t *hits = masks + n;
+    for (size_t i = 0; i < n; ++i) masks[i] = fuzzy_mask(cands[i], strlen(cands[i]));
+
+    int best = -1, best_score = -1;
+    size_t nhits = fuzzy_filter(masks, n, fuzzy_mask(pattern, plen), hits);
+    for (size_t k = 0; k < nhits; ++k)
+    {
+        const char *c = cands[hits[k]];
+        int s = fuzzy_score(pattern, plen, c, strlen(c));
+        if (s > best_score)
+        {
+            best_score = s;
+            best = (int)hits[k];
+        }
+    }
+
+    free(masks);
+    return best;
+}
@@ -0,0 +1,20 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Character classes present in s (letters case-folded), for prefiltering
+uint32_t fuzzy_mask(const char *s, size_t len);
+
+// Writes the indices i < n with (masks[i] & need) == need; returns the count
+size_t fuzzy_filter(const uint32_t *masks, size_t n, uint32_t need, uint32_t *out);
+
+// Subsequence score of pattern in text (higher is better), or -1 if no match.
+// Matching is case-insensitive unless the pattern has an upper-case letter.
+int fuzzy_score(const char *pattern, size_t plen, const char *text, size_t tlen);
+
+// Index of the best-scoring candidate, or -1 if none match
+int fuzzy_best(const char *pattern, const char *const *cands, size_t n);
+
+#endif // FUZZY_H
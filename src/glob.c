@@ -0,0 +1,807 @@
+#include "glob.h"
+#include "foxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define lstat stat
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define GLOB_DIR_BUF 65536  // bytes read per getdents64 call
+
+/*
+ * A pattern is split at '/' into segments. A segment without pattern
+ * characters is appended without reading any directory; the others are
+ * compiled once into a small program, with a literal tail (".c" of "*.c")
+ * checked first so most names are rejected without running the rest.
+ *
+ * The walk is a set of tasks (a path and the segment to match in it). Each
+ * walker keeps its own deque: it takes its newest task, depth first, and an
+ * idle walker steals the oldest task of another, which is nearest the root
+ * and so the largest piece of tree. Without ** there is little to walk and
+ * the shell's own thread does it alone.
+ */
+
+enum { OP_LIT, OP_ANY, OP_STAR, OP_CLASS };
+
+typedef struct
+{
+    unsigned char kind;
+    unsigned char ch;       // OP_LIT
+    unsigned short cls;     // OP_CLASS: index into classes
+} glob_op_t;
+
+enum { SEG_LITERAL, SEG_MATCH, SEG_RECURSE };
+
+typedef struct
+{
+    int kind;
+    char *text;                     // SEG_LITERAL, marks removed
+    glob_op_t *ops;
+    int n_ops;
+    unsigned char (*classes)[32];   // bitmaps of [...] sets
+    const glob_op_t *tail;          // literal ops after the last *
+    int n_tail;
+    int min_len;                    // names shorter than this cannot match
+    int dot;                        // starts with a literal '.'
+} seg_t;
+
+typedef struct
+{
+    seg_t *segs;
+    int count;
+    int dirs_only;      // ended in '/': only directories, written with '/'
+    char *root;         // "/" for an absolute pattern, else ""
+} pattern_t;
+
+enum { ENT_FILE, ENT_DIR, ENT_LINK, ENT_UNKNOWN };
+
+/* Compiling */
+
+static int is_sep(char c)
+{
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+static int fold_case(int c)
+{
+#ifdef _WIN32
+    return tolower(c); // Windows file names ignore case
+#else
+    return c;
+#endif
+}
+
+static void class_set(unsigned char *bits, int c)
+{
+    c = fold_case(c);
+    bits[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+// [...] starting after the '['; returns the length used, or 0 if it is not
+// closed within s[0..len) (then the '[' is an ordinary character)
+static int compile_class(const char *s, int len, unsigned char *bits)
+{
+    int i = 0, negate = 0;
+    if (i < len && (s[i] == '!' || s[i] == '^'))
+    {
+        negate = 1;
+        i++;
+    }
+    int first = i;
+    memset(bits, 0, 32);
+    while (i < len && (s[i] != ']' || i == first))
+    {
+        if (s[i] == LEX_GLOB) { i++; continue; }
+        unsigned char lo = (unsigned char)s[i++];
+        if (i + 1 < len && s[i] == '-' && s[i + 1] != ']')
+        {
+            unsigned char hi = (unsigned char)s[i + 1];
+            for (int c = lo; c <= hi; ++c) class_set(bits, c);
+            i += 2;
+        }
+        else
+        {
+            class_set(bits, lo);
+        }
+    }
+    if (i >= len) return 0;
+    if (negate)
+    {
+        for (int b = 0; b < 32; ++b) bits[b] = (unsigned char)~bits[b];
+    }
+    bits[0] &= (unsigned char)~1; // never the terminating NUL
+    return i + 1;
+}
+
+// s[0..len), still with its LEX_GLOB marks
+static int compile_seg(seg_t *seg, const char *s, int len)
+{
+    memset(seg, 0, sizeof(*seg));
+    seg->ops = malloc(sizeof(glob_op_t) * (len + 1));
+    seg->classes = malloc(32 * (len + 1));
+    if (!seg->ops || !seg->classes) return -1;
+
+    int magic = 0, n_classes = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        glob_op_t op = { OP_LIT, (unsigned char)s[i], 0 };
+        if (s[i] == LEX_GLOB && i + 1 < len)
+        {
+            char m = s[++i];
+            if (m == '*' && seg->n_ops > 0 && seg->ops[seg->n_ops - 1].kind == OP_STAR) continue;
+            if (m == '*') op.kind = OP_STAR;
+            else if (m == '?') op.kind = OP_ANY;
+            else
+            {
+                int used = compile_class(s + i + 1, len - i - 1, seg->classes[n_classes]);
+                if (used)
+                {
+                    op.kind = OP_CLASS;
+                    op.cls = (unsigned short)n_classes++;
+                    i += used;
+                }
+                else
+                {
+                    op.ch = (unsigned char)m;
+                }
+            }
+            magic |= op.kind != OP_LIT;
+        }
+        else if (s[i] == LEX_GLOB)
+        {
+            continue;
+        }
+        seg->ops[seg->n_ops++] = op;
+    }
+
+    seg->dot = seg->n_ops > 0 && seg->ops[0].kind == OP_LIT && seg->ops[0].ch == '.';
+    if (!magic)
+    {
+        seg->kind = SEG_LITERAL;
+        seg->text = malloc(seg->n_ops + 1);
+        if (!seg->text) return -1;
+        for (int i = 0; i < seg->n_ops; ++i) seg->text[i] = (char)seg->ops[i].ch;
+        seg->text[seg->n_ops] = '\0';
+        return 0;
+    }
+    if (seg->n_ops == 1 && seg->ops[0].kind == OP_STAR && len == 4 && s[2] == LEX_GLOB && s[3] == '*')
+    {
+        seg->kind = SEG_RECURSE; // exactly **
+        return 0;
+    }
+
+    seg->kind = SEG_MATCH;
+    seg->n_tail = 0;
+    for (int i = 0; i < seg->n_ops; ++i)
+    {
+        if (seg->ops[i].kind != OP_STAR) seg->min_len++;
+        if (seg->ops[i].kind == OP_LIT) seg->n_tail++;
+        else seg->n_tail = 0;
+    }
+    if (seg->n_tail == seg->n_ops || seg->ops[seg->n_ops - seg->n_tail - 1].kind != OP_STAR) seg->n_tail = 0;
+    seg->tail = seg->ops + seg->n_ops - seg->n_tail;
+    return 0;
+}
+
+static void free_pattern(pattern_t *p)
+{
+    for (int i = 0; i < p->count; ++i)
+    {
+        free(p->segs[i].text);
+        free(p->segs[i].ops);
+        free(p->segs[i].classes);
+    }
+    free(p->segs);
+    p->segs = NULL;
+    p->count = 0;
+}
+
+// 1 if some segment has pattern characters, 0 if none, -1 out of memory
+static int compile(pattern_t *p, const char *word)
+{
+    memset(p, 0, sizeof(*p));
+    int n = 1;
+    for (const char *c = word; *c; ++c) n += is_sep(*c);
+    p->segs = calloc(n, sizeof(seg_t));
+    if (!p->segs) return -1;
+
+    const char *s = word;
+    p->root = "";
+    if (is_sep(*s))
+    {
+        p->root = "/";
+        while (is_sep(*s)) s++;
+    }
+
+    int magic = 0;
+    while (*s)
+    {
+        const char *end = s;
+        while (*end && !is_sep(*end)) end++;
+        seg_t *seg = &p->segs[p->count];
+        int ok = compile_seg(seg, s, (int)(end - s));
+        p->count++;
+        if (ok != 0) { free_pattern(p); return -1; }
+        magic |= seg->kind != SEG_LITERAL;
+
+        // a/**/**/b is a/**/b, which also keeps paths from being found twice
+        if (seg->kind == SEG_RECURSE && p->count > 1 && p->segs[p->count - 2].kind == SEG_RECURSE)
+        {
+            free(seg->ops);
+            free(seg->classes);
+            p->count--;
+        }
+        s = end;
+        while (is_sep(*s)) s++;
+        if (!*s && is_sep(end[0])) p->dirs_only = 1;
+    }
+    return magic;
+}
+
+/* Matching */
+
+static int op_matches(const seg_t *seg, const glob_op_t *op, unsigned char c)
+{
+    switch (op->kind)
+    {
+        case OP_LIT: return fold_case(op->ch) == fold_case(c);
+        case OP_ANY: return 1;
+        default:
+        {
+            int f = fold_case(c);
+            return (seg->classes[op->cls][f >> 3] >> (f & 7)) & 1;
+        }
+    }
+}
+
+// One backtracking point is enough: a later * can only widen what the
+// earlier one had to cover
+static int seg_match(const seg_t *seg, const char *name, size_t len)
+{
+    if ((int)len < seg->min_len) return 0;
+    if (name[0] == '.' && !seg->dot) return 0;
+    for (int i = 0; i < seg->n_tail; ++i)
+    {
+        if (!op_matches(seg, &seg->tail[i], (unsigned char)name[len - seg->n_tail + i])) return 0;
+    }
+
+    const glob_op_t *op = seg->ops, *end = seg->ops + seg->n_ops;
+    const glob_op_t *star_op = NULL;
+    const char *star_at = NULL;
+    while (*name)
+    {
+        if (op < end && op->kind == OP_STAR)
+        {
+            star_op = ++op;
+            star_at = name;
+        }
+        else if (op < end && op_matches(seg, op, (unsigned char)*name))
+        {
+            op++;
+            name++;
+        }
+        else if (star_op)
+        {
+            op = star_op;
+            name = ++star_at;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    while (op < end && op->kind == OP_STAR) op++;
+    return op == end;
+}
+
+/* Reading directories */
+
+typedef struct
+{
+#ifdef _WIN32
+    HANDLE h;
+    WIN32_FIND_DATA fd;
+    int first;
+#elif defined(__linux__)
+    int fd;
+    char *buf;
+    long len, pos;
+#else
+    DIR *d;
+#endif
+} dir_reader_t;
+
+#ifdef __linux__
+struct linux_dirent64
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+// buf: GLOB_DIR_BUF bytes, used on Linux
+static int dir_open(dir_reader_t *r, const char *path, char *buf)
+{
+    if (!*path) path = ".";
+#ifdef _WIN32
+    (void)buf;
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", path);
+    r->h = FindFirstFile(pattern, &r->fd);
+    r->first = 1;
+    return r->h == INVALID_HANDLE_VALUE ? -1 : 0;
+#elif defined(__linux__)
+    // getdents64 straight into a large buffer: no DIR, few system calls
+    r->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    r->buf = buf;
+    r->len = r->pos = 0;
+    return r->fd < 0 ? -1 : 0;
+#else
+    (void)buf;
+    r->d = opendir(path);
+    return r->d ? 0 : -1;
+#endif
+}
+
+static const char *dir_next(dir_reader_t *r, int *type)
+{
+#ifdef _WIN32
+    if (!r->first && !FindNextFile(r->h, &r->fd)) return NULL;
+    r->first = 0;
+    DWORD a = r->fd.dwFileAttributes;
+    *type = (a & FILE_ATTRIBUTE_REPARSE_POINT) ? ENT_LINK : (a & FILE_ATTRIBUTE_DIRECTORY) ? ENT_DIR : ENT_FILE;
+    return r->fd.cFileName;
+#elif defined(__linux__)
+    if (r->pos >= r->len)
+    {
+        r->len = syscall(SYS_getdents64, r->fd, r->buf, GLOB_DIR_BUF);
+        r->pos = 0;
+        if (r->len <= 0) return NULL;
+    }
+    struct linux_dirent64 *de = (struct linux_dirent64 *)(r->buf + r->pos);
+    r->pos += de->d_reclen;
+    *type = de->d_type == DT_DIR ? ENT_DIR : de->d_type == DT_LNK ? ENT_LINK : de->d_type == DT_UNKNOWN ? ENT_UNKNOWN : ENT_FILE;
+    return de->d_name;
+#else
+    struct dirent *de = readdir(r->d);
+    if (!de) return NULL;
+    *type = de->d_type == DT_DIR ? ENT_DIR : de->d_type == DT_LNK ? ENT_LINK : de->d_type == DT_UNKNOWN ? ENT_UNKNOWN : ENT_FILE;
+    return de->d_name;
+#endif
+}
+
+static void dir_close(dir_reader_t *r)
+{
+#ifdef _WIN32
+    FindClose(r->h);
+#elif defined(__linux__)
+    close(r->fd);
+#else
+    closedir(r->d);
+#endif
+}
+
+// Links are followed when a pattern names a directory (*/x), not when **
+// walks the tree, which could otherwise loop
+static int is_dir(const char *path, int type, int follow)
+{
+    if (type == ENT_DIR || type == ENT_FILE) return type == ENT_DIR;
+    if (type == ENT_LINK && !follow) return 0;
+    struct stat st;
+    return (follow ? stat(path, &st) : lstat(path, &st)) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Walking */
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION lock_t;
+#define lock_init(l) InitializeCriticalSection(l)
+#define lock_free(l) DeleteCriticalSection(l)
+#define lock_take(l) EnterCriticalSection(l)
+#define lock_give(l) LeaveCriticalSection(l)
+#define yield() SwitchToThread()
+#else
+typedef pthread_mutex_t lock_t;
+#define lock_init(l) pthread_mutex_init(l, NULL)
+#define lock_free(l) pthread_mutex_destroy(l)
+#define lock_take(l) pthread_mutex_lock(l)
+#define lock_give(l) pthread_mutex_unlock(l)
+#define yield() sched_yield()
+#endif
+
+typedef struct
+{
+    char *path;
+    int seg;
+} task_t;
+
+typedef struct
+{
+    lock_t lock;
+    task_t *tasks;      // tasks[head..count): the owner works at the end,
+    size_t head, count, cap; // thieves take from head
+    char **matches;
+    size_t n_matches, cap_matches;
+    char *dir_buf;
+} walker_t;
+
+typedef struct
+{
+    const pattern_t *pat;
+    walker_t walkers[MAX_GLOB_THREADS];
+    int n_walkers;
+    atomic_size_t pending;  // tasks queued or running
+    atomic_int failed;
+} walk_t;
+
+typedef struct
+{
+    walk_t *walk;
+    int id;
+} walker_arg_t;
+
+static char *join(const char *dir, const char *name)
+{
+    size_t a = strlen(dir), b = strlen(name);
+    int sep = a > 0 && !is_sep(dir[a - 1]);
+    char *p = malloc(a + sep + b + 1);
+    if (!p) return NULL;
+    memcpy(p, dir, a);
+    if (sep) p[a] = '/';
+    memcpy(p + a + sep, name, b + 1);
+    return p;
+}
+
+static void push(walk_t *wk, walker_t *w, char *path, int seg)
+{
+    if (!path) { atomic_store(&wk->failed, 1); return; }
+    lock_take(&w->lock);
+    if (w->head == w->count) w->head = w->count = 0;
+    if (w->count == w->cap)
+    {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        task_t *t = realloc(w->tasks, sizeof(task_t) * cap);
+        if (!t)
+        {
+            lock_give(&w->lock);
+            free(path);
+            atomic_store(&wk->failed, 1);
+            return;
+        }
+        w->tasks = t;
+        w->cap = cap;
+    }
+    w->tasks[w->count++] = (task_t){ path, seg };
+    atomic_fetch_add(&wk->pending, 1);
+    lock_give(&w->lock);
+}
+
+static int pop(walker_t *w, task_t *t)
+{
+    int ok = 0;
+    lock_take(&w->lock);
+    if (w->count > w->head)
+    {
+        *t = w->tasks[--w->count];
+        ok = 1;
+    }
+    lock_give(&w->lock);
+    return ok;
+}
+
+static int steal(walk_t *wk, int id, task_t *t)
+{
+    for (int i = 1; i < wk->n_walkers; ++i)
+    {
+        walker_t *v = &wk->walkers[(id + i) % wk->n_walkers];
+        int ok = 0;
+        lock_take(&v->lock);
+        if (v->count > v->head)
+        {
+            *t = v->tasks[v->head++];
+            ok = 1;
+        }
+        lock_give(&v->lock);
+        if (ok) return 1;
+    }
+    return 0;
+}
+
+// Takes path
+static void emit(walk_t *wk, walker_t *w, char *path)
+{
+    if (path && wk->pat->dirs_only)
+    {
+        size_t n = strlen(path);
+        char *slashed = realloc(path, n + 2);
+        if (!slashed) free(path);
+        else memcpy(slashed + n, "/", 2);
+        path = slashed;
+    }
+    if (!path) { atomic_store(&wk->failed, 1); return; }
+    if (w->n_matches == w->cap_matches)
+    {
+        size_t cap = w->cap_matches ? w->cap_matches * 2 : 64;
+        char **m = realloc(w->matches, sizeof(char *) * cap);
+        if (!m)
+        {
+            free(path);
+            atomic_store(&wk->failed, 1);
+            return;
+        }
+        w->matches = m;
+        w->cap_matches = cap;
+    }
+    w->matches[w->n_matches++] = path;
+}
+
+static void run_task(walk_t *wk, walker_t *w, task_t t)
+{
+    const pattern_t *p = wk->pat;
+    if (t.seg == p->count)
+    {
+        if (*t.path) emit(wk, w, t.path); // the end of a/** is a itself
+        else free(t.path);
+        return;
+    }
+
+    const seg_t *seg = &p->segs[t.seg];
+    int last = t.seg + 1 == p->count;
+    if (seg->kind == SEG_LITERAL)
+    {
+        char *next = join(t.path, seg->text);
+        free(t.path);
+        struct stat st;
+        if (!last) push(wk, w, next, t.seg + 1); // a missing one fails to open later
+        else if (next && lstat(next, &st) == 0 && (!p->dirs_only || S_ISDIR(st.st_mode))) emit(wk, w, next);
+        else free(next);
+        return;
+    }
+
+    if (seg->kind == SEG_RECURSE) push(wk, w, strdup(t.path), t.seg + 1); // ** as no directory at all
+
+    dir_reader_t r;
+    if (dir_open(&r, t.path, w->dir_buf) != 0)
+    {
+        free(t.path);
+        return;
+    }
+    const char *name;
+    int type;
+    while ((name = dir_next(&r, &type)) != NULL && !atomic_load_explicit(&wk->failed, memory_order_relaxed))
+    {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        if (seg->kind == SEG_RECURSE)
+        {
+            if (name[0] == '.') continue;
+            char *path = join(t.path, name);
+            if (path && is_dir(path, type, 0)) push(wk, w, path, t.seg);
+            else if (path && last && !p->dirs_only) emit(wk, w, path);
+            else if (!path) atomic_store(&wk->failed, 1);
+            else free(path);
+            continue;
+        }
+        if (!seg_match(seg, name, strlen(name))) continue;
+        char *path = join(t.path, name);
+        if (!path) atomic_store(&wk->failed, 1);
+        else if (last && !p->dirs_only) emit(wk, w, path);
+        else if (is_dir(path, type, 1)) last ? emit(wk, w, path) : push(wk, w, path, t.seg + 1);
+        else free(path);
+    }
+    dir_close(&r);
+    free(t.path);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void work(walk_t *wk, int id)
+{
+    walker_t *w = &wk->walkers[id];
+    task_t t;
+    while (1)
+    {
+        if (pop(w, &t) || steal(wk, id, &t))
+        {
+            run_task(wk, w, t);
+            atomic_fetch_sub(&wk->pending, 1);
+        }
+        else if (atomic_load(&wk->pending) == 0)
+        {
+            break;
+        }
+        else
+        {
+            yield();
+        }
+    }
+    // Each walker sorts its own matches; glob_expand merges the runs
+    if (w->n_matches > 1) qsort(w->matches, w->n_matches, sizeof(char *), compare_paths);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI walker_main(void *p)
+{
+    walker_arg_t *a = p;
+    work(a->walk, a->id);
+    return 0;
+}
+#else
+static void *walker_main(void *p)
+{
+    walker_arg_t *a = p;
+    work(a->walk, a->id);
+    return NULL;
+}
+#endif
+
+static int walker_count(const pattern_t *p)
+{
+    int recurse = 0;
+    for (int i = 0; i < p->count; ++i) recurse |= p->segs[i].kind == SEG_RECURSE;
+    if (!recurse) return 1;
+
+    const char *env = getenv("FOXY_GLOB_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        n = (int)si.dwNumberOfProcessors;
+#else
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    return n < 1 ? 1 : n > MAX_GLOB_THREADS ? MAX_GLOB_THREADS : n;
+}
+
+// Merge the walkers' sorted runs into out
+static int merge(walk_t *wk, glob_list_t *out)
+{
+    size_t total = 0, at[MAX_GLOB_THREADS] = { 0 };
+    for (int i = 0; i < wk->n_walkers; ++i) total += wk->walkers[i].n_matches;
+    if (total == 0) return 0;
+    out->paths = malloc(sizeof(char *) * (total + 1));
+    if (!out->paths) return -1;
+    while (out->count < total)
+    {
+        int best = -1;
+        for (int i = 0; i < wk->n_walkers; ++i)
+        {
+            walker_t *w = &wk->walkers[i];
+            if (at[i] < w->n_matches && (best < 0 || strcmp(w->matches[at[i]], wk->walkers[best].matches[at[best]]) < 0)) best = i;
+        }
+        out->paths[out->count++] = wk->walkers[best].matches[at[best]++];
+    }
+    out->paths[total] = NULL;
+    for (int i = 0; i < wk->n_walkers; ++i) wk->walkers[i].n_matches = 0; // now owned by out
+    return 0;
+}
+
+int glob_has_magic(const char *word)
+{
+    return strchr(word, LEX_GLOB) != NULL;
+}
+
+int glob_expand(const char *word, glob_list_t *out)
+{
+    out->paths = NULL;
+    out->count = 0;
+    pattern_t pat;
+    int magic = compile(&pat, word);
+    if (magic <= 0)
+    {
+        free_pattern(&pat);
+        return magic; // nothing to match: the word as written
+    }
+
+    walk_t *wk = calloc(1, sizeof(walk_t));
+    char *start = strdup(pat.root);
+    if (!wk || !start)
+    {
+        free(wk);
+        free(start);
+        free_pattern(&pat);
+        return -1;
+    }
+    wk->pat = &pat;
+    wk->n_walkers = walker_count(&pat);
+    for (int i = 0; i < wk->n_walkers; ++i) lock_init(&wk->walkers[i].lock);
+
+    int ok = 1;
+    for (int i = 0; i < wk->n_walkers && ok; ++i) ok = (wk->walkers[i].dir_buf = malloc(GLOB_DIR_BUF)) != NULL;
+    walker_arg_t args[MAX_GLOB_THREADS];
+#ifdef _WIN32
+    HANDLE threads[MAX_GLOB_THREADS];
+#else
+    pthread_t threads[MAX_GLOB_THREADS];
+#endif
+    int started = 0;
+    if (ok)
+    {
+        push(wk, &wk->walkers[0], start, 0);
+        // Walkers that fail to start just leave more for the others
+        for (int i = 1; i < wk->n_walkers; ++i)
+        {
+            args[i] = (walker_arg_t){ wk, i };
+#ifdef _WIN32
+            threads[started] = CreateThread(NULL, 0, walker_main, &args[i], 0, NULL);
+            if (threads[started]) started++;
+#else
+            if (pthread_create(&threads[started], NULL, walker_main, &args[i]) == 0) started++;
+#endif
+        }
+        work(wk, 0);
+        for (int i = 0; i < started; ++i)
+        {
+#ifdef _WIN32
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+#else
+            pthread_join(threads[i], NULL);
+#endif
+        }
+    }
+    else
+    {
+        free(start);
+    }
+
+    int status = ok && !atomic_load(&wk->failed) ? merge(wk, out) : -1;
+    for (int i = 0; i < wk->n_walkers; ++i)
+    {
+        walker_t *w = &wk->walkers[i];
+        for (size_t j = 0; j < w->n_matches; ++j) free(w->matches[j]);
+        free(w->matches);
+        free(w->tasks);
+        free(w->dir_buf);
+        lock_free(&w->lock);
+    }
+    free(wk);
+    free_pattern(&pat);
+    if (status != 0) glob_free(out);
+    return status;
+}
+
+void glob_free(glob_list_t *list)
+{
+    for (size_t i = 0; i < list->count; ++i) free(list->paths[i]);
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+}
+
+void glob_strip(char *word)
+{
+    char *out = word;
+    for (; *word; ++word)
+    {
+        if (*word != LEX_GLOB) *out++ = *word;
+    }
+    *out = '\0';
+}
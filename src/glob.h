@@ -0,0 +1,33 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <stddef.h>
+
+#define MAX_GLOB_THREADS 16 // walkers for **; FOXY_GLOB_THREADS picks fewer
+
+/*
+ * Pathname expansion. The lexer puts LEX_GLOB before each *, ? and [ that
+ * was not quoted or escaped, and only those are patterns: "*.c" and \*.c
+ * stay literal. A path segment that is just ** matches any number of
+ * directories, walked by several threads. Names starting with . are only
+ * matched by a pattern that starts with a literal dot.
+ */
+
+typedef struct
+{
+    char **paths;   // sorted; plain malloc, as the walkers allocate them
+    size_t count;
+} glob_list_t;
+
+// 1 if word has a pattern character for glob_expand()
+int glob_has_magic(const char *word);
+
+// The paths matching word, in out. Returns 0 (out->count may be 0: no
+// match, and the word should stay as written) or -1 if out of memory.
+int glob_expand(const char *word, glob_list_t *out);
+void glob_free(glob_list_t *list);
+
+// Remove the LEX_GLOB marks from word, in place
+void glob_strip(char *word);
+
+#endif // GLOB_H
@@ -0,0 +1,1174 @@
+#include "history.h"
+#include "fuzzy.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define HISTORY_FILE ".foxy_history"
+#define HISTORY_TMP_FILE ".foxy_history.tmp"
+#define DEFAULT_HISTORY_SIZE 100000
+#define MIN_HISTORY_SIZE 16
+#define INITIAL_RING_CAP 256
+#define RECORD_BYTES 4096 // longer commands get a heap buffer
+#define MIN_COMPACT_BYTES (64 * 1024)
+#define TRI_BUCKETS 65536
+#define MAX_TERM 256
+#define MAX_RANKED 64
+
+/*
+ * An entry is either a view into the mapped history file or an owned copy
+ * (commands typed in this session). Views are never NUL-terminated.
+ */
+typedef struct
+{
+    const char *text;
+    unsigned int len;
+    unsigned char owned;
+    unsigned char superseded; // a newer entry has the same text
+} hist_entry_t;
+
+/*
+ * In-memory history is a ring buffer. Slots are grown by doubling up to
+ * ring_max; once full, the oldest entry is overwritten and ring_head
+ * advances, so adding a command is O(1) regardless of size.
+ */
+static hist_entry_t *ring;
+static size_t ring_cap;   // allocated slots
+static size_t ring_max;   // configured history size
+static size_t ring_head;  // slot of the oldest entry
+static size_t ring_count;
+static size_t ring_bytes; // text bytes held, for compaction
+
+/*
+ * The history file is mapped at load time and not read any further until
+ * something asks for an entry; history_index() then walks back from the end
+ * of the mapping for the newest ring_max lines. Startup cost is independent
+ * of the file size.
+ */
+static const char *map_base;
+static size_t map_len;
+static int map_heap; // 1 if map_base is a heap fallback copy
+static int indexed;
+
+/*
+ * New entries are appended to the history file through one O_APPEND fd,
+ * each as one write of one whole line as soon as it is added, so other
+ * sessions see it at their next prompt and a crash never leaves a torn
+ * line.
+ */
+static int hist_fd = -1;
+static size_t file_bytes; // size of the history file, for compaction
+
+/*
+ * Several sessions share the history file. A writer takes an advisory lock
+ * and first ingests whatever other sessions appended since known_end, so
+ * the file and every session agree on the order. Between writes,
+ * history_sync() picks up complete new lines without locking.
+ */
+static size_t known_end; // bytes of the history file already seen
+
+static int map_file(const char *path, const char **base, size_t *len, int *heap)
+{
+    *base = NULL;
+    *len = 0;
+    *heap = 0;
+
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size <= 0)
+    {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+
+#ifdef _WIN32
+    HANDLE mh = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mh)
+    {
+        *base = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mh);
+    }
+#else
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) *base = p;
+#endif
+
+    if (!*base)
+    {
+        // No mapping available: fall back to one read into the heap
+        char *buf = mem_alloc(MEM_HISTORY, size);
+        size_t got = 0;
+        while (buf && got < size)
+        {
+            ssize_t n = read(fd, buf + got, size - got);
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+        if (!buf || got == 0) { mem_free(buf); close(fd); return -1; }
+        *base = buf;
+        size = got;
+        *heap = 1;
+    }
+
+    close(fd);
+    *len = size;
+    return 0;
+}
+
+static void unmap_file(const char *base, size_t len, int heap)
+{
+    if (!base) return;
+    if (heap) { mem_free((void *)base); return; }
+#ifdef _WIN32
+    (void)len;
+    UnmapViewOfFile(base);
+#else
+    munmap((void *)base, len);
+#endif
+}
+
+/*
+ * Reverse search uses a trigram index: every 3-byte window of an entry
+ * hashes to a bucket holding the ascending sequence numbers of the entries
+ * that contain it. An entry's sequence number is first_seq + its ring
+ * index. Evicted entries leave stale (too small) numbers behind, which are
+ * skipped on lookup and swept out once enough have accumulated.
+ *
+ * The index is built on the first search that needs it and then kept up to
+ * date by ring_push().
+ */
+typedef struct
+{
+    unsigned int *seqs;
+    unsigned int len;
+    unsigned int cap;
+} posting_t;
+
+static posting_t *tri_index;
+static unsigned int first_seq;  // sequence number of the oldest entry
+static unsigned int tri_swept;  // first_seq at the last stale sweep
+static unsigned int hist_gen;   // bumped whenever the set of entries changes
+
+/*
+ * Result of the last search. A term that extends it can only match entries
+ * at or before that match, so typing narrows from there instead of starting
+ * over at the newest entry.
+ */
+static char last_term[MAX_TERM];
+static size_t last_tlen;        // 0 = nothing cached
+static unsigned int last_gen;
+static int last_match;
+
+/*
+ * Fuzzy search keeps a class mask per ring slot (see fuzzy_mask) so the
+ * prefilter is one vector pass over a flat array, plus a table of distinct
+ * texts with their use count and newest sequence number for frecency.
+ * Older copies of a text are flagged superseded and never ranked. Unlike
+ * the trigram index, this is built whenever the ring is, by history_index()
+ * and ring_rebuild(), because Up/Down and compaction need the superseded
+ * flags too; ring_push() maintains it from then on. history_index() runs on
+ * the first lookup, not at startup.
+ */
+typedef struct
+{
+    unsigned int hash;
+    unsigned int seq;   // newest entry with this text
+    unsigned int uses;  // 0 = empty slot
+} freq_slot_t;
+
+static uint32_t *masks;        // by ring slot
+static uint32_t *slot_uses;    // by ring slot, valid for the newest copy
+static freq_slot_t *freq;
+static size_t freq_cap;        // power of two
+static size_t freq_used;
+
+// Survivors of the last fuzzy search, reused when the pattern grows
+static char fz_term[MAX_TERM];
+static size_t fz_tlen;
+static unsigned int fz_gen;
+static uint32_t *fz_surv;
+static size_t fz_n;
+static uint32_t *fz_scratch;
+static size_t fz_cap;
+
+static unsigned int tri_hash(const char *p)
+{
+    unsigned int v = ((unsigned int)(unsigned char)p[0] << 16) |
+                     ((unsigned int)(unsigned char)p[1] << 8) |
+                     (unsigned int)(unsigned char)p[2];
+    return (v * 2654435761u) >> 16;
+}
+
+static void tri_reset()
+{
+    if (tri_index)
+    {
+        for (size_t i = 0; i < TRI_BUCKETS; ++i) mem_free(tri_index[i].seqs);
+        mem_free(tri_index);
+        tri_index = NULL;
+    }
+    last_tlen = 0;
+}
+
+static int tri_add(unsigned int seq, const char *text, size_t len)
+{
+    for (size_t i = 0; i + 3 <= len; ++i)
+    {
+        posting_t *pl = &tri_index[tri_hash(text + i)];
+        if (pl->len > 0 && pl->seqs[pl->len - 1] == seq) continue;
+        if (pl->len == pl->cap)
+        {
+            unsigned int new_cap = pl->cap ? pl->cap * 2 : 4;
+            unsigned int *tmp = mem_realloc(MEM_HISTORY, pl->seqs, sizeof(unsigned int) * new_cap);
+            if (!tmp) return -1;
+            pl->seqs = tmp;
+            pl->cap = new_cap;
+        }
+        pl->seqs[pl->len++] = seq;
+    }
+    return 0;
+}
+
+// First position >= from whose value is >= key (exponential, then binary)
+static size_t gallop(const unsigned int *a, size_t n, size_t from, unsigned int key)
+{
+    size_t step = 1, lo = from, hi = from;
+    while (hi < n && a[hi] < key)
+    {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n) hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void tri_sweep()
+{
+    for (size_t i = 0; i < TRI_BUCKETS; ++i)
+    {
+        posting_t *pl = &tri_index[i];
+        size_t stale = gallop(pl->seqs, pl->len, 0, first_seq);
+        if (stale == 0) continue;
+        memmove(pl->seqs, pl->seqs + stale, sizeof(unsigned int) * (pl->len - stale));
+        pl->len -= (unsigned int)stale;
+    }
+    tri_swept = first_seq;
+}
+
+static unsigned int text_hash(const char *p, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (unsigned char)p[i]) * 16777619u;
+    return h;
+}
+
+static void rank_reset()
+{
+    mem_free(masks);
+    masks = NULL;
+    mem_free(slot_uses);
+    slot_uses = NULL;
+    mem_free(freq);
+    freq = NULL;
+    freq_cap = freq_used = 0;
+    mem_free(fz_surv);
+    mem_free(fz_scratch);
+    fz_surv = fz_scratch = NULL;
+    fz_n = fz_cap = 0;
+    fz_tlen = 0;
+}
+
+static hist_entry_t *ring_at(size_t index);
+
+static size_t freq_find(const char *text, size_t len, unsigned int h)
+{
+    size_t i = h & (freq_cap - 1);
+    while (freq[i].uses)
+    {
+        if (freq[i].hash == h)
+        {
+            hist_entry_t *e = ring_at(freq[i].seq - first_seq);
+            if (e->len == len && memcmp(e->text, text, len) == 0) return i;
+        }
+        i = (i + 1) & (freq_cap - 1);
+    }
+    return i;
+}
+
+static int freq_grow()
+{
+    size_t new_cap = freq_cap ? freq_cap * 2 : 1024;
+    freq_slot_t *tab = mem_calloc(MEM_HISTORY, new_cap, sizeof(freq_slot_t));
+    if (!tab) return -1;
+    for (size_t i = 0; i < freq_cap; ++i)
+    {
+        if (!freq[i].uses) continue;
+        size_t j = freq[i].hash & (new_cap - 1);
+        while (tab[j].uses) j = (j + 1) & (new_cap - 1);
+        tab[j] = freq[i];
+    }
+    mem_free(freq);
+    freq = tab;
+    freq_cap = new_cap;
+    return 0;
+}
+
+static size_t seq_slot(unsigned int seq)
+{
+    return (ring_head + (seq - first_seq)) % ring_cap;
+}
+
+// Record a use of the entry in ring slot `slot`, sequence number seq
+static int freq_add(unsigned int seq, size_t slot)
+{
+    if ((freq_used + 1) * 2 > freq_cap && freq_grow() != 0) return -1;
+    hist_entry_t *e = &ring[slot];
+    unsigned int h = text_hash(e->text, e->len);
+    size_t i = freq_find(e->text, e->len, h);
+    if (freq[i].uses)
+    {
+        ring[seq_slot(freq[i].seq)].superseded = 1;
+        freq[i].seq = seq;
+        freq[i].uses++;
+    }
+    else
+    {
+        freq[i] = (freq_slot_t){ h, seq, 1 };
+        freq_used++;
+    }
+    slot_uses[slot] = freq[i].uses;
+    return 0;
+}
+
+// Forget one use of an entry that is about to be evicted
+static void freq_drop(hist_entry_t *e)
+{
+    unsigned int h = text_hash(e->text, e->len);
+    size_t i = freq_find(e->text, e->len, h);
+    if (!freq[i].uses) return;
+    if (--freq[i].uses > 0)
+    {
+        slot_uses[seq_slot(freq[i].seq)] = freq[i].uses;
+        return;
+    }
+
+    // Backward-shift deletion keeps probe chains intact
+    size_t mask = freq_cap - 1, j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (!freq[j].uses) break;
+        size_t k = freq[j].hash & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            freq[i] = freq[j];
+            i = j;
+        }
+    }
+    freq[i].uses = 0;
+    freq_used--;
+}
+
+static void entry_release(hist_entry_t *e)
+{
+    if (e->owned) mem_free((void *)e->text);
+    ring_bytes -= e->len + 1;
+    e->text = NULL;
+    e->len = 0;
+    e->owned = 0;
+    e->superseded = 0;
+}
+
+static void ring_push(hist_entry_t entry)
+{
+    hist_gen++;
+    if (ring_count == ring_max)
+    {
+        size_t slot = ring_head;
+        if (freq) freq_drop(&ring[slot]);
+        entry_release(&ring[slot]);
+        ring[slot] = entry;
+        ring_head = (ring_head + 1) % ring_cap;
+        ring_bytes += entry.len + 1;
+        first_seq++;
+
+        unsigned int seq = first_seq + (unsigned int)ring_count - 1;
+        if (tri_index)
+        {
+            if (tri_add(seq, entry.text, entry.len) != 0) tri_reset();
+            else if (first_seq - tri_swept > ring_max / 2) tri_sweep();
+        }
+        if (masks)
+        {
+            masks[slot] = fuzzy_mask(entry.text, entry.len);
+            if (freq_add(seq, slot) != 0) rank_reset();
+        }
+        return;
+    }
+
+    if (ring_count == ring_cap)
+    {
+        // ring_head stays 0 until the ring is full, so realloc keeps order
+        size_t new_cap = ring_cap ? ring_cap * 2 : INITIAL_RING_CAP;
+        if (new_cap > ring_max) new_cap = ring_max;
+        hist_entry_t *tmp = mem_realloc(MEM_HISTORY, ring, sizeof(hist_entry_t) * new_cap);
+        if (!tmp)
+        {
+            // Out of memory: keep what we have and start recycling slots
+            ring_max = ring_count;
+            if (ring_max == 0)
+            {
+                if (entry.owned) mem_free((void *)entry.text);
+                return;
+            }
+            ring_push(entry);
+            return;
+        }
+        ring = tmp;
+        ring_cap = new_cap;
+        if (masks)
+        {
+            uint32_t *m = mem_realloc(MEM_HISTORY, masks, sizeof(uint32_t) * new_cap);
+            if (m) masks = m;
+            uint32_t *u = m ? mem_realloc(MEM_HISTORY, slot_uses, sizeof(uint32_t) * new_cap) : NULL;
+            if (u) slot_uses = u;
+            else rank_reset();
+        }
+    }
+
+    size_t slot = ring_count++;
+    ring[slot] = entry;
+    ring_bytes += entry.len + 1;
+
+    unsigned int seq = first_seq + (unsigned int)slot;
+    if (tri_index && tri_add(seq, entry.text, entry.len) != 0) tri_reset();
+    if (masks)
+    {
+        masks[slot] = fuzzy_mask(entry.text, entry.len);
+        if (freq_add(seq, slot) != 0) rank_reset();
+    }
+}
+
+static hist_entry_t *ring_at(size_t index)
+{
+    return &ring[(ring_head + index) % ring_cap];
+}
+
+static void ring_reset()
+{
+    for (size_t i = 0; i < ring_count; ++i) entry_release(ring_at(i));
+    mem_free(ring);
+    ring = NULL;
+    ring_cap = 0;
+    ring_head = 0;
+    ring_count = 0;
+    ring_bytes = 0;
+    first_seq = 0;
+    tri_swept = 0;
+    hist_gen++;
+    tri_reset();
+    rank_reset();
+}
+
+static int rank_build();
+
+// Replace the ring with `n` entries (oldest first); their ownership moves over
+static void ring_rebuild(hist_entry_t *entries, size_t n)
+{
+    mem_free(ring);
+    ring = NULL;
+    ring_cap = 0;
+    ring_head = 0;
+    ring_count = 0;
+    ring_bytes = 0;
+    first_seq = 0;
+    tri_swept = 0;
+    tri_reset();
+    rank_reset();
+
+    for (size_t i = 0; i < n; ++i) ring_push(entries[i]);
+    rank_build(); // marks older duplicates as superseded
+}
+
+// Build the ring from the tail of the mapping, ahead of this session's entries
+static void history_index()
+{
+    if (indexed) return;
+    indexed = 1;
+    if (!map_base || ring_count >= ring_max)
+    {
+        rank_build();
+        return;
+    }
+
+    size_t want = ring_max - ring_count;
+    hist_entry_t *tail = mem_alloc(MEM_HISTORY, sizeof(hist_entry_t) * (want < 4096 ? want : 4096));
+    size_t tail_cap = want < 4096 ? want : 4096;
+    size_t n = 0;
+    if (!tail) return;
+
+    const char *p = map_base + map_len;
+    while (n < want && p > map_base)
+    {
+        const char *q = p;
+        while (q > map_base && q[-1] != '\n') --q;
+
+        size_t len = (size_t)(p - q);
+        if (len > 0 && q[len - 1] == '\r') len--;
+        if (len > 0)
+        {
+            if (n == tail_cap)
+            {
+                size_t new_cap = tail_cap * 2 > want ? want : tail_cap * 2;
+                hist_entry_t *tmp = mem_realloc(MEM_HISTORY, tail, sizeof(hist_entry_t) * new_cap);
+                if (!tmp) break;
+                tail = tmp;
+                tail_cap = new_cap;
+            }
+            tail[n++] = (hist_entry_t){ q, (unsigned int)len, 0, 0 };
+        }
+
+        if (q == map_base) break;
+        p = q - 1;
+    }
+
+    // File lines oldest first, then this session's entries, which are newer
+    size_t session = ring_count;
+    hist_entry_t *all = mem_alloc(MEM_HISTORY, sizeof(hist_entry_t) * (n + session));
+    if (!all) { mem_free(tail); return; }
+    for (size_t i = 0; i < n; ++i) all[i] = tail[n - 1 - i];
+    for (size_t i = 0; i < session; ++i) all[n + i] = *ring_at(i);
+
+    ring_rebuild(all, n + session);
+    mem_free(all);
+    mem_free(tail);
+}
+
+void history_init()
+{
+    ring_reset();
+    unmap_file(map_base, map_len, map_heap);
+    map_base = NULL;
+    map_len = 0;
+    indexed = 0;
+
+    ring_max = DEFAULT_HISTORY_SIZE;
+    const char *env = getenv("FOXY_HISTSIZE");
+    if (env)
+    {
+        long n = atol(env);
+        if (n >= MIN_HISTORY_SIZE) ring_max = (size_t)n;
+    }
+
+    file_bytes = 0;
+    known_end = 0;
+}
+
+void history_load()
+{
+    if (map_file(HISTORY_FILE, &map_base, &map_len, &map_heap) != 0) return;
+    file_bytes = map_len;
+    known_end = map_len;
+    indexed = 0;
+}
+
+int history_length()
+{
+    history_index();
+    return (int)ring_count;
+}
+
+const char *history_entry(int index, size_t *len)
+{
+    history_index();
+    if (index < 0 || (size_t)index >= ring_count)
+    {
+        if (len) *len = 0;
+        return NULL;
+    }
+    hist_entry_t *e = ring_at((size_t)index);
+    if (e->superseded)
+    {
+        // A newer entry has the same text
+        if (len) *len = 0;
+        return NULL;
+    }
+    if (len) *len = e->len;
+    return e->text;
+}
+
+void history_print_recent(int n)
+{
+    int count = history_length();
+    for (int i = count > n ? count - n : 0; i < count; ++i)
+    {
+        size_t len;
+        const char *e = history_entry(i, &len);
+        if (e) printf("%5d  %.*s\n", i + 1, (int)len, e);
+    }
+}
+
+static const char *mem_find(const char *hay, size_t hlen, const char *needle, size_t nlen)
+{
+    if (nlen == 0) return hay;
+    if (nlen > hlen) return NULL;
+    const char *last = hay + hlen - nlen;
+    for (const char *p = hay; p <= last; ++p)
+    {
+        p = memchr(p, needle[0], (size_t)(last - p) + 1);
+        if (!p) return NULL;
+        if (memcmp(p, needle, nlen) == 0) return p;
+    }
+    return NULL;
+}
+
+static int tri_build()
+{
+    if (tri_index) return 0;
+    tri_index = mem_calloc(MEM_HISTORY, TRI_BUCKETS, sizeof(posting_t));
+    if (!tri_index) return -1;
+    for (size_t i = 0; i < ring_count; ++i)
+    {
+        hist_entry_t *e = ring_at(i);
+        if (tri_add(first_seq + (unsigned int)i, e->text, e->len) != 0)
+        {
+            tri_reset();
+            return -1;
+        }
+    }
+    tri_swept = first_seq;
+    return 0;
+}
+
+// Number of elements of a[0..n) that are <= key, galloping down from n
+static size_t gallop_back(const unsigned int *a, size_t n, unsigned int key)
+{
+    size_t step = 1, lo = n, hi = n;
+    while (lo > 0 && a[lo - 1] > key)
+    {
+        hi = lo - 1;
+        lo = lo > step ? lo - step : 0;
+        step *= 2;
+    }
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] <= key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+typedef struct
+{
+    const posting_t *pl;
+    size_t pos; // elements still in play: pl->seqs[0..pos)
+} cursor_t;
+
+static int cursor_cmp(const void *a, const void *b)
+{
+    unsigned int la = ((const cursor_t *)a)->pl->len, lb = ((const cursor_t *)b)->pl->len;
+    return (la > lb) - (la < lb);
+}
+
+/*
+ * Newest entry below `before` whose sequence number is in every trigram
+ * list of `term` and that really contains it. The lists are walked from the
+ * top in lockstep (leapfrog join), so the cost depends on how far back the
+ * match is, not on how many entries share a trigram.
+ */
+static int tri_search(const char *term, size_t tlen, int before)
+{
+    cursor_t cur[MAX_TERM];
+    size_t ncur = 0;
+    for (size_t i = 0; i + 3 <= tlen && ncur < MAX_TERM; ++i)
+    {
+        const posting_t *pl = &tri_index[tri_hash(term + i)];
+        int dup = 0;
+        for (size_t k = 0; k < ncur && !dup; ++k) dup = (cur[k].pl == pl);
+        if (!dup) cur[ncur++] = (cursor_t){ pl, pl->len };
+    }
+    qsort(cur, ncur, sizeof(cursor_t), cursor_cmp); // shortest list leads
+
+    unsigned int want = first_seq + (unsigned int)before - 1;
+    while (1)
+    {
+        size_t agree = 0;
+        for (size_t k = 0; k < ncur && agree < ncur; ++k)
+        {
+            cur[k].pos = gallop_back(cur[k].pl->seqs, cur[k].pos, want);
+            if (cur[k].pos == 0) return -1;
+            unsigned int got = cur[k].pl->seqs[cur[k].pos - 1];
+            if (got < first_seq) return -1;
+            if (got < want)
+            {
+                want = got;
+                agree = 0;
+                k = (size_t)-1; // restart the round at the new position
+                continue;
+            }
+            agree++;
+        }
+
+        hist_entry_t *e = ring_at(want - first_seq);
+        if (!e->superseded && mem_find(e->text, e->len, term, tlen)) return (int)(want - first_seq);
+        if (want == first_seq) return -1;
+        want--;
+    }
+}
+
+int history_find(const char *term, int before)
+{
+    history_index();
+    size_t tlen = strlen(term);
+    if (before > (int)ring_count) before = (int)ring_count;
+    if (before <= 0) return -1;
+
+    // A longer version of the last term can only match at or before its match
+    int narrowed = before;
+    if (last_tlen > 0 && last_gen == hist_gen && last_tlen <= tlen && memcmp(last_term, term, last_tlen) == 0 &&
+        before == (int)ring_count)
+    {
+        if (last_match < 0) return -1;
+        narrowed = last_match + 1;
+    }
+
+    int match = -1;
+    if (tlen >= 3 && tri_build() == 0)
+    {
+        match = tri_search(term, tlen, narrowed);
+    }
+    else
+    {
+        // Terms shorter than a trigram match almost anything; scan from newest
+        for (int i = narrowed - 1; i >= 0; --i)
+        {
+            hist_entry_t *e = ring_at((size_t)i);
+            if (!e->superseded && mem_find(e->text, e->len, term, tlen)) { match = i; break; }
+        }
+    }
+
+    if (before == (int)ring_count && tlen < MAX_TERM)
+    {
+        memcpy(last_term, term, tlen);
+        last_tlen = tlen;
+        last_gen = hist_gen;
+        last_match = match;
+    }
+    return match;
+}
+
+static int rank_build()
+{
+    if (masks) return 0;
+    masks = mem_alloc(MEM_HISTORY, sizeof(uint32_t) * (ring_cap ? ring_cap : 1));
+    slot_uses = mem_alloc(MEM_HISTORY, sizeof(uint32_t) * (ring_cap ? ring_cap : 1));
+    if (!masks || !slot_uses)
+    {
+        rank_reset();
+        return -1;
+    }
+    for (size_t i = 0; i < ring_count; ++i)
+    {
+        size_t slot = (ring_head + i) % ring_cap;
+        hist_entry_t *e = &ring[slot];
+        e->superseded = 0;
+        masks[slot] = fuzzy_mask(e->text, e->len);
+        if (freq_add(first_seq + (unsigned int)i, slot) != 0)
+        {
+            rank_reset();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Recent and frequently used commands rank higher
+static int frecency(unsigned int uses, unsigned int age)
+{
+    int recency = age < 10 ? 100 : age < 100 ? 70 : age < 1000 ? 50 : age < 10000 ? 30 : 10;
+    int weight = 1;
+    while (uses > 1 && weight < 16)
+    {
+        uses >>= 1;
+        weight++;
+    }
+    return recency * weight;
+}
+
+int history_fuzzy(const char *pattern, int *out, int max)
+{
+    history_index();
+    if (max > MAX_RANKED) max = MAX_RANKED;
+    if (ring_count == 0 || max <= 0 || rank_build() != 0) return 0;
+
+    if (fz_cap < ring_cap)
+    {
+        uint32_t *a = mem_realloc(MEM_HISTORY, fz_surv, sizeof(uint32_t) * ring_cap);
+        if (a) fz_surv = a;
+        uint32_t *b = mem_realloc(MEM_HISTORY, fz_scratch, sizeof(uint32_t) * ring_cap);
+        if (b) fz_scratch = b;
+        if (!a || !b) { rank_reset(); return 0; }
+        fz_cap = ring_cap;
+        fz_tlen = 0;
+    }
+
+    size_t plen = strlen(pattern);
+    uint32_t need = fuzzy_mask(pattern, plen);
+
+    // Candidate slots: last survivors if the pattern only grew, else every slot
+    uint32_t *cand = fz_scratch;
+    size_t ncand;
+    if (fz_tlen > 0 && fz_gen == hist_gen && fz_tlen <= plen && memcmp(fz_term, pattern, fz_tlen) == 0)
+    {
+        ncand = 0;
+        for (size_t i = 0; i < fz_n; ++i)
+        {
+            if ((masks[fz_surv[i]] & need) == need) cand[ncand++] = fz_surv[i];
+        }
+    }
+    else
+    {
+        ncand = fuzzy_filter(masks, ring_count, need, cand);
+    }
+
+    int top_rank[MAX_RANKED];
+    int n = 0;
+    size_t nsurv = 0;
+    unsigned int newest = first_seq + (unsigned int)ring_count - 1;
+    for (size_t k = 0; k < ncand; ++k)
+    {
+        size_t slot = cand[k];
+        hist_entry_t *e = &ring[slot];
+        if (e->superseded) continue;
+        int score = fuzzy_score(pattern, plen, e->text, e->len);
+        if (score < 0) continue;
+        fz_surv[nsurv++] = (uint32_t)slot;
+
+        int index = (int)((slot + ring_cap - ring_head) % ring_cap);
+        unsigned int seq = first_seq + (unsigned int)index;
+        int rank = score * 16 + frecency(slot_uses[slot], newest - seq);
+
+        // Insertion into the top list; ties go to the newer entry
+        int pos = n < max ? n++ : max;
+        while (pos > 0 && (top_rank[pos - 1] < rank || (top_rank[pos - 1] == rank && out[pos - 1] < index)))
+        {
+            if (pos < max)
+            {
+                top_rank[pos] = top_rank[pos - 1];
+                out[pos] = out[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max)
+        {
+            top_rank[pos] = rank;
+            out[pos] = index;
+        }
+    }
+
+    fz_n = nsurv;
+    fz_gen = hist_gen;
+    if (plen > 0 && plen < MAX_TERM)
+    {
+        memcpy(fz_term, pattern, plen);
+        fz_tlen = plen;
+    }
+    else fz_tlen = 0;
+    return n;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int lock_fd(int fd, int lock)
+{
+#ifdef _WIN32
+    // Windows locks are mandatory, so lock one byte far past any real EOF
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.OffsetHigh = 0x40000000;
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (lock) return LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov) ? 0 : -1;
+    return UnlockFileEx(h, 0, 1, 0, &ov) ? 0 : -1;
+#else
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = lock ? F_WRLCK : F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) == -1)
+    {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+#endif
+}
+
+// Did another session compact (replace) the file since we opened it?
+static int file_replaced(int fd)
+{
+#ifdef _WIN32
+    (void)fd;
+    return 0; // compaction rewrites in place on Windows
+#else
+    struct stat a, b;
+    if (fstat(fd, &a) != 0 || stat(HISTORY_FILE, &b) != 0) return 1;
+    return a.st_ino != b.st_ino || a.st_dev != b.st_dev;
+#endif
+}
+
+static int hist_open()
+{
+    int replaced = 0;
+    if (hist_fd != -1)
+    {
+        if (!file_replaced(hist_fd)) return 0;
+        close(hist_fd);
+        hist_fd = -1;
+        replaced = 1;
+    }
+
+    hist_fd = open(HISTORY_FILE, O_RDWR | O_APPEND | O_CREAT | O_BINARY, 0644);
+    if (hist_fd == -1) return -1;
+
+    // A rewritten file holds what its writer had; skip rather than re-read it
+    struct stat st;
+    if (replaced && fstat(hist_fd, &st) == 0) known_end = (size_t)st.st_size;
+    return 0;
+}
+
+static int hist_lock()
+{
+    for (int tries = 0; tries < 3; ++tries)
+    {
+        if (hist_open() != 0) return -1;
+        if (lock_fd(hist_fd, 1) != 0) return -1;
+        if (!file_replaced(hist_fd)) return 0;
+        lock_fd(hist_fd, 0);
+    }
+    return -1;
+}
+
+// Add an owned copy of text unless it repeats the newest entry; 1 if added
+static int history_insert(const char *text, size_t len)
+{
+    if (ring_count > 0)
+    {
+        hist_entry_t *e = ring_at(ring_count - 1);
+        if (e->len == len && memcmp(e->text, text, len) == 0) return 0;
+    }
+    char *copy = mem_alloc(MEM_HISTORY, len + 1);
+    if (!copy) return 0;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    ring_push((hist_entry_t){ copy, (unsigned int)len, 1, 0 });
+    return 1;
+}
+
+// Pick up complete lines other sessions appended after known_end
+static void history_ingest()
+{
+    struct stat st;
+    if (fstat(hist_fd, &st) != 0) return;
+    size_t size = (size_t)st.st_size;
+    file_bytes = size;
+    if (size < known_end)
+    {
+        known_end = size; // rewritten elsewhere
+        return;
+    }
+    if (size == known_end) return;
+
+    size_t avail = size - known_end;
+    char *buf = mem_alloc(MEM_HISTORY, avail);
+    if (!buf) return;
+    size_t got = 0;
+    if (lseek(hist_fd, (off_t)known_end, SEEK_SET) != (off_t)-1)
+    {
+        while (got < avail)
+        {
+            ssize_t n = read(hist_fd, buf + got, avail - got);
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+    }
+
+    // A line still being written is left for next time
+    size_t used = 0;
+    for (size_t i = 0; i < got; ++i)
+    {
+        if (buf[i] != '\n') continue;
+        size_t len = i - used;
+        if (len > 0 && buf[i - 1] == '\r') len--;
+        if (len > 0) history_insert(buf + used, len);
+        used = i + 1;
+    }
+    known_end += used;
+    mem_free(buf);
+}
+
+void history_sync()
+{
+    if (hist_open() == 0) history_ingest();
+}
+
+/*
+ * Rewrite the history file with one line per live (not superseded) entry.
+ * The new contents are built in memory and become the backing store for
+ * every entry, so nothing points at the old mapping afterwards. Called with
+ * the lock held.
+ */
+static void history_compact()
+{
+    size_t total = 0, live = 0;
+    for (size_t i = 0; i < ring_count; ++i)
+    {
+        hist_entry_t *e = ring_at(i);
+        if (!e->superseded)
+        {
+            total += e->len + 1;
+            live++;
+        }
+    }
+
+    char *buf = mem_alloc(MEM_HISTORY, total ? total : 1);
+    hist_entry_t *entries = mem_alloc(MEM_HISTORY, sizeof(hist_entry_t) * (live ? live : 1));
+    if (!buf || !entries)
+    {
+        mem_free(buf);
+        mem_free(entries);
+        return;
+    }
+
+    char *p = buf;
+    size_t n = 0;
+    for (size_t i = 0; i < ring_count; ++i)
+    {
+        hist_entry_t *e = ring_at(i);
+        if (e->superseded) continue;
+        memcpy(p, e->text, e->len);
+        p[e->len] = '\n';
+        entries[n++] = (hist_entry_t){ p, e->len, 0, 0 };
+        p += e->len + 1;
+    }
+
+#ifdef _WIN32
+    // Open files cannot be replaced here, so rewrite in place under the lock
+    if (_chsize(hist_fd, 0) != 0 || write_all(hist_fd, buf, total) != 0)
+    {
+        mem_free(buf);
+        mem_free(entries);
+        return;
+    }
+#else
+    int fd = open(HISTORY_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    int ok = fd != -1 && write_all(fd, buf, total) == 0;
+    if (fd != -1 && close(fd) != 0) ok = 0;
+    if (!ok || rename(HISTORY_TMP_FILE, HISTORY_FILE) != 0)
+    {
+        remove(HISTORY_TMP_FILE);
+        mem_free(buf);
+        mem_free(entries);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < ring_count; ++i)
+    {
+        hist_entry_t *e = ring_at(i);
+        if (e->owned) mem_free((void *)e->text);
+    }
+    unmap_file(map_base, map_len, map_heap);
+    map_base = buf;
+    map_len = total;
+    map_heap = 1;
+
+    ring_rebuild(entries, n);
+    mem_free(entries);
+    file_bytes = known_end = total;
+}
+
+// Last line of the mapping, for the duplicate check before history_index()
+static const char *map_last_line(size_t *len)
+{
+    const char *p = map_base + map_len;
+    while (p > map_base && (p[-1] == '\n' || p[-1] == '\r')) --p;
+    const char *q = p;
+    while (q > map_base && q[-1] != '\n') --q;
+    *len = (size_t)(p - q);
+    return q;
+}
+
+void add_to_history(const char *cmd)
+{
+    if (!cmd || !*cmd) return;
+    size_t len = strlen(cmd);
+
+    // Repeats of older commands are kept once: the text table marks the
+    // earlier copy superseded when this one is pushed
+    if (ring_count == 0 && !indexed && map_base)
+    {
+        size_t last_len;
+        const char *last = map_last_line(&last_len);
+        if (last_len == len && memcmp(last, cmd, len) == 0) return;
+    }
+
+    char small[RECORD_BYTES];
+    char *line = len + 1 <= sizeof(small) ? small : mem_alloc(MEM_HISTORY, len + 1);
+    if (!line) return;
+    memcpy(line, cmd, len);
+    line[len] = '\n';
+
+    // Other sessions' new lines go in first, so the file and the ring agree
+    int locked = hist_lock() == 0;
+    if (locked) history_ingest();
+    if (history_insert(cmd, len) && hist_fd != -1)
+    {
+        write_all(hist_fd, line, len + 1);
+        struct stat st;
+        if (locked && fstat(hist_fd, &st) == 0) file_bytes = known_end = (size_t)st.st_size;
+        if (locked && indexed && file_bytes > MIN_COMPACT_BYTES && file_bytes > 2 * ring_bytes) history_compact();
+    }
+    if (locked) lock_fd(hist_fd, 0);
+    if (line != small) mem_free(line);
+}
@@ -0,0 +1,33 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void history_init();
+void history_load();
+void add_to_history(const char *cmd);
+int history_length();
+
+// Take in commands other sessions have appended to the history file
+void history_sync();
+
+// Entry text is NOT NUL-terminated (it may point into the mapped file).
+// NULL for an entry whose text was repeated later (only the newest is kept).
+const char *history_entry(int index, size_t *len); // 0 = oldest
+
+// Newest entry older than `before` containing `term`, or -1
+int history_find(const char *term, int before);
+
+// Up to max entries fuzzy-matching pattern, best first (by match score and
+// frecency); returns how many were written to out
+int history_fuzzy(const char *pattern, int *out, int max);
+
+void history_print_recent(int n);
+
+// Per-command records in .foxy_history.meta (histrec.c)
+void history_record(const char *cmd, const char *cwd, int64_t start_ms, uint64_t duration_us, int status);
+void history_print_slowest(int n);
+void history_print_failed(int n);
+
+#endif // HISTORY_H
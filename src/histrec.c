@@ -0,0 +1,221 @@
+#include "history.h"
+#include "mem.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define META_FILE ".foxy_history.meta"
+#define META_MAGIC 0x4d485846u // "FXHM"
+#define MAX_FIELD 0xffff
+
+/*
+ * .foxy_history.meta sits next to the history file and holds one binary
+ * record per executed command: this header followed by cwd_len bytes of
+ * working directory and cmd_len bytes of command text. Every record starts
+ * with the magic number, so a torn or foreign tail is easy to spot.
+ */
+typedef struct
+{
+    uint32_t magic;
+    int32_t status;
+    int64_t start_ms;     // wall clock, ms since the epoch
+    uint64_t duration_us;
+    uint16_t cwd_len;
+    uint16_t cmd_len;
+    uint32_t reserved;
+} rec_hdr_t;
+
+typedef struct
+{
+    int64_t start_ms;
+    uint64_t duration_us;
+    int32_t status;
+    uint16_t cwd_len;
+    uint16_t cmd_len;
+    const char *cwd;
+    const char *cmd;
+} rec_t;
+
+/*
+ * Records are loaded the first time they are queried. Two indexes are then
+ * kept current as commands finish: record ids ordered slowest first, and the
+ * ids of failed commands in execution order. A query only walks the first N
+ * ids of the index it needs.
+ */
+static rec_t *recs;
+static size_t rec_count, rec_cap;
+static uint32_t *by_duration;
+static uint32_t *failed;
+static size_t failed_count;
+static char *file_data; // loaded records point into this
+static int loaded;
+static int meta_fd = -1;
+
+static int rec_append(const rec_t *r)
+{
+    if (rec_count == rec_cap)
+    {
+        size_t new_cap = rec_cap ? rec_cap * 2 : 256;
+        rec_t *a = mem_realloc(MEM_HISTORY, recs, sizeof(rec_t) * new_cap);
+        if (!a) return -1;
+        recs = a;
+        uint32_t *b = mem_realloc(MEM_HISTORY, by_duration, sizeof(uint32_t) * new_cap);
+        if (!b) return -1;
+        by_duration = b;
+        uint32_t *c = mem_realloc(MEM_HISTORY, failed, sizeof(uint32_t) * new_cap);
+        if (!c) return -1;
+        failed = c;
+        rec_cap = new_cap;
+    }
+    recs[rec_count++] = *r;
+    return 0;
+}
+
+static int cmp_duration(const void *a, const void *b)
+{
+    uint64_t da = recs[*(const uint32_t *)a].duration_us;
+    uint64_t db = recs[*(const uint32_t *)b].duration_us;
+    return (da < db) - (da > db);
+}
+
+// Place record id in the slowest-first order (binary search + shift)
+static void index_duration(uint32_t id)
+{
+    uint64_t d = recs[id].duration_us;
+    size_t lo = 0, hi = rec_count - 1; // id is the newest record, not yet placed
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (recs[by_duration[mid]].duration_us >= d) lo = mid + 1;
+        else hi = mid;
+    }
+    memmove(by_duration + lo + 1, by_duration + lo, sizeof(uint32_t) * (rec_count - 1 - lo));
+    by_duration[lo] = id;
+}
+
+static void records_load()
+{
+    if (loaded) return;
+    loaded = 1;
+
+    int fd = open(META_FILE, O_RDONLY | O_BINARY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || !(file_data = mem_alloc(MEM_HISTORY, (size_t)st.st_size)))
+    {
+        close(fd);
+        return;
+    }
+
+    // One block read; records then point into the buffer
+    size_t size = 0;
+    while (size < (size_t)st.st_size)
+    {
+        ssize_t n = read(fd, file_data + size, (size_t)st.st_size - size);
+        if (n <= 0) break;
+        size += (size_t)n;
+    }
+    close(fd);
+
+    size_t off = 0;
+    while (off + sizeof(rec_hdr_t) <= size)
+    {
+        rec_hdr_t h;
+        memcpy(&h, file_data + off, sizeof(h));
+        if (h.magic != META_MAGIC) break;
+        size_t body = (size_t)h.cwd_len + h.cmd_len;
+        if (off + sizeof(h) + body > size) break;
+
+        const char *p = file_data + off + sizeof(h);
+        rec_t r = { h.start_ms, h.duration_us, h.status, h.cwd_len, h.cmd_len, p, p + h.cwd_len };
+        if (rec_append(&r) != 0) break;
+        off += sizeof(h) + body;
+    }
+
+    for (size_t i = 0; i < rec_count; ++i)
+    {
+        by_duration[i] = (uint32_t)i;
+        if (recs[i].status != 0) failed[failed_count++] = (uint32_t)i;
+    }
+    qsort(by_duration, rec_count, sizeof(uint32_t), cmp_duration);
+}
+
+void history_record(const char *cmd, const char *cwd, int64_t start_ms, uint64_t duration_us, int status)
+{
+    if (!cmd || !*cmd) return;
+    if (!cwd) cwd = "";
+
+    size_t cmd_len = strlen(cmd), cwd_len = strlen(cwd);
+    if (cmd_len > MAX_FIELD) cmd_len = MAX_FIELD;
+    if (cwd_len > MAX_FIELD) cwd_len = MAX_FIELD;
+
+    // Header and strings go out in a single write
+    size_t total = sizeof(rec_hdr_t) + cwd_len + cmd_len;
+    char *buf = mem_alloc(MEM_HISTORY, total);
+    if (!buf) return;
+    rec_hdr_t h = { META_MAGIC, status, start_ms, duration_us, (uint16_t)cwd_len, (uint16_t)cmd_len, 0 };
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), cwd, cwd_len);
+    memcpy(buf + sizeof(h) + cwd_len, cmd, cmd_len);
+
+    if (meta_fd == -1) meta_fd = open(META_FILE, O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0644);
+    if (meta_fd != -1)
+    {
+        ssize_t n = write(meta_fd, buf, total);
+        (void)n;
+    }
+
+    if (!loaded)
+    {
+        // Nobody has asked yet; the record will be read back with the rest
+        mem_free(buf);
+        return;
+    }
+
+    const char *p = buf + sizeof(h);
+    rec_t r = { start_ms, duration_us, status, (uint16_t)cwd_len, (uint16_t)cmd_len, p, p + cwd_len };
+    if (rec_append(&r) != 0)
+    {
+        mem_free(buf);
+        return;
+    }
+    uint32_t id = (uint32_t)(rec_count - 1);
+    index_duration(id);
+    if (status != 0) failed[failed_count++] = id;
+}
+
+static void print_record(const rec_t *r)
+{
+    char dur[32], when[32];
+    foxy_format_duration(r->duration_us, dur, sizeof(dur));
+    time_t t = (time_t)(r->start_ms / 1000);
+    struct tm *tm = localtime(&t);
+    if (!tm || !strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", tm)) strcpy(when, "?");
+    printf("%10s  %3d  %s  %.*s  [%.*s]\n", dur, r->status, when, (int)r->cmd_len, r->cmd, (int)r->cwd_len, r->cwd);
+}
+
+void history_print_slowest(int n)
+{
+    records_load();
+    for (size_t i = 0; i < rec_count && (int)i < n; ++i) print_record(&recs[by_duration[i]]);
+}
+
+void history_print_failed(int n)
+{
+    records_load();
+    size_t from = failed_count > (size_t)n ? failed_count - (size_t)n : 0;
+    for (size_t i = from; i < failed_count; ++i) print_record(&recs[failed[i]]);
+}
@@ -1,314 +1,1100 @@
 #include "interaction.h"
+#include "history.h"
+#include "fuzzy.h"
+#include "complete.h"
+#include "alias.h"
+#include "func.h"
+#include "foxy.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
 #include <conio.h>
 #include <windows.h>
-#include <ctype.h>
+#else
+#include <termios.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#endif
+
+#define MAX_LINE 4096
+#define MAX_RANKED 64
+#define MAX_OUT (4 * MAX_LINE)
+
+// Keys beyond the byte range, decoded from escape sequences / _getch prefixes
+enum
+{
+    KEY_UP = 1000,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_PASTE          // start of a bracketed paste
+};
+
+/*
+ * The editor keeps a model of what the terminal shows (the prompt's last
+ * line and the text after it) and of where the cursor is. A refresh compares
+ * that with the buffer, moves the cursor to the first difference, rewrites
+ * only the tail that changed and sends it all in one write.
+ */
+typedef struct
+{
+    const char *prompt;       // last line of the prompt
+    char *buf;
+    int max_len;
+    int len, pos;
+    int cols;                 // terminal width
+
+    char shown_prompt[MAX_LINE];
+    int shown_prompt_cols;
+    char shown[MAX_LINE];
+    unsigned char shown_cls[MAX_LINE];
+    int shown_len, shown_pos;
+
+    // Highlighting: the text last lexed, its classes and the lexer state
+    // before each byte, so an edit re-lexes only from the changed word on
+    int highlight;
+    char hl_text[MAX_LINE];
+    int hl_len;
+    unsigned char cls[MAX_LINE];
+    lex_state_t hl_states[MAX_LINE + 1];
 
-#define MAX_HISTORY 100
-#define HISTORY_FILE ".foxy_history"
-#define MAX_LINE 1024
+    char out[MAX_OUT];
+    size_t out_len;
+} editor_t;
 
-static char *history[MAX_HISTORY];
-static int history_count = 0;
+// FOXY_FUZZY=1 switches Ctrl+R and TAB to fuzzy, ranked matching
+static int fuzzy_enabled()
+{
+    const char *v = getenv("FOXY_FUZZY");
+    return v && *v && strcmp(v, "0") != 0;
+}
+
+// Highlighting is on unless FOXY_HIGHLIGHT=0 or the terminal is dumb
+static int highlight_enabled()
+{
+    const char *v = getenv("FOXY_HIGHLIGHT");
+    if (v && strcmp(v, "0") == 0) return 0;
+    const char *t = getenv("TERM");
+    return !(t && strcmp(t, "dumb") == 0);
+}
 
-void history_init()
+// Copy a history entry (not NUL-terminated) into the edit buffer
+static int load_history_entry(char *buf, int max_len, int index)
 {
-    history_count = 0;
-    memset(history, 0, sizeof(history));
+    size_t len = 0;
+    const char *e = history_entry(index, &len);
+    if (!e) { e = ""; len = 0; }
+    if (len > (size_t)max_len - 1) len = (size_t)max_len - 1;
+    memcpy(buf, e, len);
+    buf[len] = '\0';
+    return (int)len;
 }
 
-void history_load()
+#ifdef _WIN32
+static void term_raw()
 {
-    FILE *fp = fopen(HISTORY_FILE, "r");
-    if (!fp) return;
-    
-    char line[1024];
-    while (fgets(line, sizeof(line), fp))
+    // _getch already reads unechoed keys; turn on VT sequences for the redraw
+    static int vt_done;
+    if (vt_done) return;
+    vt_done = 1;
+    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (GetConsoleMode(h, &mode)) SetConsoleMode(h, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+}
+
+static void term_restore()
+{
+}
+
+static int term_columns()
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return info.srWindow.Right - info.srWindow.Left + 1;
+    return 80;
+}
+
+static int input_pending()
+{
+    return _kbhit();
+}
+
+static char *read_paste(size_t *len)
+{
+    // Consoles here deliver pastes as keystrokes; they are batched instead
+    *len = 0;
+    return NULL;
+}
+
+static int read_key()
+{
+    int ch = _getch();
+    if (ch == 0 || ch == 224)
     {
-        line[strcspn(line, "\n")] = 0;
-        if (line[0])
+        switch (_getch())
         {
-            if (history_count < MAX_HISTORY)
-            {
-                history[history_count++] = strdup(line);
-            }
-            else
+            case 72: return KEY_UP;
+            case 80: return KEY_DOWN;
+            case 75: return KEY_LEFT;
+            case 77: return KEY_RIGHT;
+            case 71: return KEY_HOME;
+            case 79: return KEY_END;
+            case 83: return KEY_DELETE;
+            default: return 0;
+        }
+    }
+    return ch;
+}
+#else
+static struct termios orig_termios;
+static int raw_on;
+
+// Input is read in blocks; keys and pastes are taken from here
+static unsigned char in_buf[4096];
+static int in_len, in_pos;
+
+static void term_write(const char *s)
+{
+    ssize_t r = write(STDOUT_FILENO, s, strlen(s));
+    (void)r;
+}
+
+// TCSADRAIN, not TCSAFLUSH: input typed ahead must not be thrown away
+static void term_restore()
+{
+    if (!raw_on) return;
+    term_write("\x1b[?2004l"); // bracketed paste off for other programs
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &orig_termios);
+    raw_on = 0;
+}
+
+static void term_raw()
+{
+    static int atexit_done;
+    if (raw_on || tcgetattr(STDIN_FILENO, &orig_termios) != 0) return;
+    if (!atexit_done)
+    {
+        atexit(term_restore);
+        atexit_done = 1;
+    }
+
+    struct termios raw = orig_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) != 0) return;
+    raw_on = 1;
+    term_write("\x1b[?2004h");
+}
+
+static int term_columns()
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+static int read_byte(int timeout_ms)
+{
+    if (in_pos == in_len)
+    {
+        if (timeout_ms >= 0)
+        {
+            struct pollfd p = { STDIN_FILENO, POLLIN, 0 };
+            if (poll(&p, 1, timeout_ms) <= 0) return -1;
+        }
+        ssize_t n;
+        while ((n = read(STDIN_FILENO, in_buf, sizeof(in_buf))) < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        in_len = (int)n;
+        in_pos = 0;
+    }
+    return in_buf[in_pos++];
+}
+
+static int input_pending()
+{
+    return in_pos < in_len;
+}
+
+// Pasted bytes up to the end marker, taken in bulk and not echoed
+static char *read_paste(size_t *len)
+{
+    static const char end[] = "\x1b[201~";
+    size_t n = 0, cap = 4096;
+    char *text = malloc(cap);
+    if (!text) return NULL;
+    while (1)
+    {
+        // A terminal that never ends the paste gets a second to do so
+        int c = read_byte(1000);
+        if (c == -1) break;
+        if (n == cap)
+        {
+            char *t = realloc(text, cap * 2);
+            if (!t) break;
+            text = t;
+            cap *= 2;
+        }
+        text[n++] = (char)c;
+        if (c == '~' && n >= sizeof(end) - 1 && memcmp(text + n - (sizeof(end) - 1), end, sizeof(end) - 1) == 0)
+        {
+            n -= sizeof(end) - 1;
+            break;
+        }
+    }
+    *len = n;
+    return text;
+}
+
+static int read_key()
+{
+    int ch = read_byte(-1);
+    if (ch == -1) return EOF;
+    if (ch == 127) return '\b';
+    if (ch == '\n') return '\r';
+    if (ch != 27) return ch;
+
+    // A lone Esc has nothing following it within a moment
+    int c1 = read_byte(50);
+    if (c1 != '[' && c1 != 'O') return 27;
+    int c = read_byte(50);
+    if (c1 == '[')
+    {
+        // Read through the final byte so modified keys (ESC[1;5C for
+        // Ctrl+Right) leave nothing behind; only the first number counts
+        int code = 0, params = 1;
+        for (; c >= 0x20 && c <= 0x3f; c = read_byte(50))
+        {
+            if (c == ';') params = 0;
+            else if (params && c >= '0' && c <= '9' && code < 10000) code = code * 10 + (c - '0');
+        }
+        if (c == '~')
+        {
+            switch (code)
             {
-                free(history[0]);
-                for (int i = 1; i < MAX_HISTORY; ++i) history[i-1] = history[i];
-                history[MAX_HISTORY-1] = strdup(line);
+                case 1: case 7: return KEY_HOME;
+                case 4: case 8: return KEY_END;
+                case 3: return KEY_DELETE;
+                case 200: return KEY_PASTE;
+                default: return 0;
             }
         }
     }
-    fclose(fp);
+    switch (c)
+    {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        default: return 0;
+    }
+}
+#endif
+
+// Columns the prompt takes, skipping colour sequences and UTF-8 continuations
+static int display_width(const char *s)
+{
+    int w = 0;
+    while (*s)
+    {
+        if (*s == 27 && s[1] == '[')
+        {
+            s += 2;
+            while (*s && !(*s >= '@' && *s <= '~')) s++;
+            if (*s) s++;
+            continue;
+        }
+        if (((unsigned char)*s & 0xc0) != 0x80) w++;
+        s++;
+    }
+    return w;
 }
 
-void add_to_history(const char *cmd)
+static int is_utf8_cont(char c)
 {
-    if (!cmd || !*cmd) return;
-    if (history_count > 0 && strcmp(history[history_count-1], cmd) == 0) return;
+    return ((unsigned char)c & 0xc0) == 0x80;
+}
 
-    if (history_count < MAX_HISTORY)
+// Cells s[0..n) takes on screen: one per code point
+static int text_cells(const char *s, int n)
+{
+    int w = 0;
+    for (int i = 0; i < n; ++i)
     {
-        history[history_count++] = strdup(cmd);
+        if (!is_utf8_cont(s[i])) w++;
     }
-    else
+    return w;
+}
+
+// Start of the code point before / after byte i of the line
+static int prev_char(const editor_t *e, int i)
+{
+    if (i > 0) i--;
+    while (i > 0 && is_utf8_cont(e->buf[i])) i--;
+    return i;
+}
+
+static int next_char(const editor_t *e, int i)
+{
+    if (i < e->len) i++;
+    while (i < e->len && is_utf8_cont(e->buf[i])) i++;
+    return i;
+}
+
+// 1 if the bytes before the cursor end part way through a code point
+static int char_incomplete(const editor_t *e)
+{
+    int start = prev_char(e, e->pos);
+    unsigned char lead = (unsigned char)e->buf[start];
+    int need = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+    return e->pos - start < need;
+}
+
+static void out_add(editor_t *e, const char *s, size_t n)
+{
+    if (e->out_len + n > sizeof(e->out))
     {
-        free(history[0]);
-        for (int i = 1; i < MAX_HISTORY; ++i) history[i-1] = history[i];
-        history[MAX_HISTORY-1] = strdup(cmd);
+        ssize_t r = write(STDOUT_FILENO, e->out, e->out_len);
+        (void)r;
+        e->out_len = 0;
     }
-    
-    // Check if we should append to file
-    FILE *fp = fopen(HISTORY_FILE, "a");
-    if (fp)
+    if (n > sizeof(e->out))
     {
-        fprintf(fp, "%s\n", cmd);
-        fclose(fp);
+        ssize_t r = write(STDOUT_FILENO, s, n);
+        (void)r;
+        return;
     }
+    memcpy(e->out + e->out_len, s, n);
+    e->out_len += n;
 }
 
-// Helper: Clear current line usage on console not used yet
-// static void clear_line(int len) ...
+static void out_seq(editor_t *e, int n, char code)
+{
+    char seq[16];
+    int k = snprintf(seq, sizeof(seq), "\x1b[%d%c", n, code);
+    out_add(e, seq, (size_t)k);
+}
+
+static void out_flush(editor_t *e)
+{
+    if (e->out_len == 0) return;
+    ssize_t r = write(STDOUT_FILENO, e->out, e->out_len);
+    (void)r;
+    e->out_len = 0;
+}
+
+// Move between two cells counted from the start of the prompt line
+static void move_cursor(editor_t *e, int from, int to)
+{
+    int r0 = from / e->cols, c0 = from % e->cols;
+    int r1 = to / e->cols, c1 = to % e->cols;
+    if (r1 < r0) out_seq(e, r0 - r1, 'A');
+    else if (r1 > r0) out_seq(e, r1 - r0, 'B');
+    if (c1 == 0 && c0 != 0) out_add(e, "\r", 1);
+    else if (c1 > c0) out_seq(e, c1 - c0, 'C');
+    else if (c1 < c0) out_seq(e, c0 - c1, 'D');
+}
+
+/*
+ * Command words are judged from what is already cached: builtins, aliases
+ * and the PATH index. Until that index exists every name passes, so nothing
+ * flashes red at startup. Paths are checked with stat, remembering the last
+ * answer so a word is not looked up again on every keystroke after it.
+ */
+static hl_class_t classify_command(const char *word, size_t len)
+{
+    static char last_path[MAX_LINE];
+    static hl_class_t last_class;
+
+    char name[MAX_LINE];
+    if (len >= sizeof(name)) return HL_UNKNOWN_CMD;
+    memcpy(name, word, len);
+    name[len] = '\0';
+
+    if (is_builtin(name) || alias_resolve(name) || func_exists(name)) return HL_BUILTIN;
+
+    if (strchr(name, '/') || strchr(name, '\\'))
+    {
+        if (strcmp(name, last_path) == 0) return last_class;
+        struct stat st;
+        int ok = stat(name, &st) == 0 && S_ISREG(st.st_mode);
+#ifndef _WIN32
+        ok = ok && (st.st_mode & 0111);
+#endif
+        snprintf(last_path, sizeof(last_path), "%s", name);
+        last_class = ok ? HL_COMMAND : HL_UNKNOWN_CMD;
+        return last_class;
+    }
+
+    const char *const *names;
+    size_t count;
+    if (complete_commands(name, len, &names, &count) != 0) return HL_COMMAND;
+    if (count > 0 && strcmp(names[0], name) == 0) return HL_COMMAND;
+#ifdef _WIN32
+    // "notepad" runs notepad.exe; the extensions sort right after the name
+    for (size_t i = 0; i < count && i < 16; ++i)
+    {
+        const char *ext = names[i] + len;
+        if (_stricmp(ext, ".exe") == 0 || _stricmp(ext, ".com") == 0 ||
+            _stricmp(ext, ".bat") == 0 || _stricmp(ext, ".cmd") == 0) return HL_COMMAND;
+    }
+#endif
+    return HL_UNKNOWN_CMD;
+}
+
+// Re-lex from the start of the first word that differs from the last pass
+static void highlight_update(editor_t *e)
+{
+    int k = 0;
+    while (k < e->hl_len && k < e->len && e->hl_text[k] == e->buf[k]) k++;
+    if (k == e->len && k == e->hl_len) return;
+    while (k > 0 && e->hl_states[k].in_word) k--;
+
+    lex_highlight(e->buf, (size_t)e->len, (size_t)k, e->hl_states, e->cls, classify_command);
+    memcpy(e->hl_text + k, e->buf + k, (size_t)(e->len - k));
+    e->hl_len = e->len;
+}
+
+static const char *hl_colour(unsigned char cls)
+{
+    switch (cls)
+    {
+        case HL_COMMAND: return "\x1b[0;32m";
+        case HL_BUILTIN: return "\x1b[0;36m";
+        case HL_UNKNOWN_CMD: return "\x1b[0;31m";
+        case HL_STRING: return "\x1b[0;33m";
+        case HL_OPERATOR: return "\x1b[0;1m";
+        case HL_VARIABLE: return "\x1b[0;35m";
+        default: return "\x1b[0m";
+    }
+}
+
+// Write buf[from..len), switching colour only where the class changes
+static void out_text(editor_t *e, int from)
+{
+    if (!e->highlight)
+    {
+        out_add(e, e->buf + from, (size_t)(e->len - from));
+        return;
+    }
+    int i = from;
+    while (i < e->len)
+    {
+        int j = i + 1;
+        while (j < e->len && e->cls[j] == e->cls[i]) j++;
+        const char *c = hl_colour(e->cls[i]);
+        out_add(e, c, strlen(c));
+        out_add(e, e->buf + i, (size_t)(j - i));
+        i = j;
+    }
+    out_add(e, "\x1b[0m", 4);
+}
+
+static void refresh(editor_t *e)
+{
+    int pc = e->shown_prompt_cols;
+
+    if (strcmp(e->shown_prompt, e->prompt) != 0)
+    {
+        // New prompt (search mode): redraw the whole line
+        move_cursor(e, pc + text_cells(e->shown, e->shown_pos), 0);
+        out_add(e, "\x1b[J", 3);
+        out_add(e, e->prompt, strlen(e->prompt));
+        snprintf(e->shown_prompt, sizeof(e->shown_prompt), "%s", e->prompt);
+        pc = e->shown_prompt_cols = display_width(e->prompt);
+        e->shown_len = e->shown_pos = 0;
+        if (pc > 0 && pc % e->cols == 0) out_add(e, "\r\n", 2);
+    }
+
+    if (e->highlight) highlight_update(e);
+    else memset(e->cls, 0, (size_t)e->len);
+
+    // A byte whose colour changed is rewritten like one whose text did;
+    // positions are bytes, the screen has one cell per code point
+    int p = 0;
+    while (p < e->shown_len && p < e->len && e->shown[p] == e->buf[p] && e->shown_cls[p] == e->cls[p]) p++;
+    while (p > 0 && is_utf8_cont(e->buf[p])) p--;
+
+    int cur = pc + text_cells(e->shown, e->shown_pos);
+    int end = pc + text_cells(e->buf, e->len);
+    if (p < e->len || e->shown_len > e->len)
+    {
+        move_cursor(e, cur, pc + text_cells(e->buf, p));
+        if (p < e->len)
+        {
+            out_text(e, p);
+            // At the right margin the terminal waits to wrap; make it happen now
+            if (end % e->cols == 0) out_add(e, "\r\n", 2);
+        }
+        if (e->shown_len > e->len) out_add(e, "\x1b[J", 3);
+        cur = end;
+    }
+    move_cursor(e, cur, pc + text_cells(e->buf, e->pos));
+    out_flush(e);
+
+    memcpy(e->shown, e->buf, (size_t)e->len);
+    memcpy(e->shown_cls, e->cls, (size_t)e->len);
+    e->shown_len = e->len;
+    e->shown_pos = e->pos;
+}
+
+static void set_text(editor_t *e, const char *text, int len)
+{
+    if (len > e->max_len - 1) len = e->max_len - 1;
+    memmove(e->buf, text, (size_t)len);
+    e->buf[len] = '\0';
+    e->len = e->pos = len;
+}
 
-// Reverse Increment Search
-static int do_reverse_search(char *buf, int max_len)
+// Reverse Increment Search: 1 = run the match, 0 = back to editing
+static int do_reverse_search(editor_t *e)
 {
-    (void)max_len;
     char search_term[256] = {0};
     int s_idx = 0;
     int match_idx = -1;
-    
-    printf("\n(reverse-i-search)`': ");
-    
+    int fuzzy = fuzzy_enabled();
+    int ranked[MAX_RANKED];
+    int n_ranked = 0, rank_pos = 0;
+    const char *label = fuzzy ? "fuzzy-search" : "reverse-i-search";
+
+    // The search shows in place of the prompt; the line is the match
+    const char *saved_prompt = e->prompt;
+    char saved[MAX_LINE];
+    int saved_len = e->len;
+    memcpy(saved, e->buf, (size_t)e->len);
+    char search_prompt[MAX_LINE];
+
     while (1)
     {
-        int ch = _getch();
-        if (ch == '\r') // Enter -> Accept match
+        snprintf(search_prompt, sizeof(search_prompt), "(%s)`%s': ", label, search_term);
+        e->prompt = search_prompt;
+        refresh(e);
+
+        int ch = read_key();
+        int changed = 0;
+        if (ch == '\r') // Enter -> run the match
+        {
+            e->prompt = saved_prompt;
+            if (match_idx == -1) set_text(e, saved, saved_len);
+            return 1;
+        }
+        else if (ch == 27 || ch == 7 || ch == EOF) // Esc / Ctrl+G -> back to the line as it was
+        {
+            set_text(e, saved, saved_len);
+            e->prompt = saved_prompt;
+            return 0;
+        }
+        else if (ch >= KEY_UP) // Movement keeps the match for editing
+        {
+            if (match_idx == -1) set_text(e, saved, saved_len);
+            e->prompt = saved_prompt;
+            return 0;
+        }
+        else if (ch == 18) // Ctrl+R again -> next older (or next ranked) match
         {
-            if (match_idx != -1)
+            if (fuzzy)
             {
-                strcpy(buf, history[match_idx]);
+                if (rank_pos + 1 < n_ranked) match_idx = ranked[++rank_pos];
             }
-            // Clear prompt line
-            printf("\r                                                                      ");
-            printf("\r%s", buf); // Reprint prompt handled by caller? No, caller expects buf filled. 
-            // Caller loop will continue or return? Standard readline returns the line.
-            // But we are inside read_line which expects to continue editing or return?
-            // Let's assume Enter accepts and executes.
-            return 1; // 1 means line ready
-        }
-        else if (ch == 27) // Esc -> Cancel
-        {
-             printf("\r                                                                      ");
-             // Restore what was there? Or just clear.
-             // Simplest: cancel yields empty line or keeps what was there.
-             // Let's clear search line and return to normal editing of *buf*.
-             // For now, simple exit.
-             printf("\rfoxy> %s", buf); // Reprint prompt hack? 
-             // Actually, the main loop handles prompt. We are in the read_line.
-             // It's tricky without a proper redraw function. 
-             // Let's just return 0 to indicate "continue editing" but we need to signal state.
-             // Let's stick to simple: Enter accepts, anything else edits search.
-             return -1; // -1 means cancel search mode
-        }
-        else if (ch == 8 || ch == '\b') // Backspace
-        {
-            if (s_idx > 0)
+            else if (match_idx > 0)
             {
-                search_term[--s_idx] = 0;
+                int older = history_find(search_term, match_idx);
+                if (older != -1) match_idx = older;
             }
         }
-        else if (ch >= 32 && ch <= 126 && s_idx < 255)
+        else if (ch == 8) // Backspace
+        {
+            while (s_idx > 0 && is_utf8_cont(search_term[--s_idx])) {}
+            search_term[s_idx] = 0;
+            changed = 1;
+        }
+        else if (((ch >= 32 && ch <= 126) || (ch >= 128 && ch <= 255)) && s_idx < 255)
         {
+            // Each extra character narrows the previous candidate set
             search_term[s_idx++] = ch;
             search_term[s_idx] = 0;
+            changed = 1;
+        }
+        else
+        {
+            continue;
         }
 
-        // Perform search
-        match_idx = -1;
-        for (int i = history_count - 1; i >= 0; --i)
+        if (changed && fuzzy)
         {
-            if (strstr(history[i], search_term))
-            {
-                match_idx = i;
-                break;
-            }
+            n_ranked = history_fuzzy(search_term, ranked, MAX_RANKED);
+            rank_pos = 0;
+            match_idx = n_ranked > 0 ? ranked[0] : -1;
+        }
+        else if (changed)
+        {
+            match_idx = history_find(search_term, history_length());
         }
 
-        // Redraw search prompt
-        printf("\r(reverse-i-search)`%s': %s", search_term, match_idx != -1 ? history[match_idx] : "");
-        // Clear rest of line logic missing, manual spaces for now
-        printf("        \b\b\b\b\b\b\b\b");
+        if (match_idx != -1) e->len = e->pos = load_history_entry(e->buf, e->max_len, match_idx);
+        else e->len = e->pos = 0;
+        e->buf[e->len] = '\0';
     }
 }
 
+// Repeated TAB presses step through the matches of the word as first typed
+typedef struct
+{
+    int active;
+    int start;          // where the word begins in buf
+    char word[256];
+    size_t next;        // match to show on the next press
+} completion_state_t;
+
+static int cmp_cand(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Replace buf[start..pos) with text, keeping what follows the cursor
+static void replace_word(editor_t *e, int start, const char *text, size_t len)
+{
+    int tail = e->len - e->pos;
+    if (start + (int)len + tail > e->max_len - 1) return;
+    memmove(e->buf + start + len, e->buf + e->pos, (size_t)tail);
+    memcpy(e->buf + start, text, len);
+    e->pos = start + (int)len;
+    e->len = e->pos + tail;
+    e->buf[e->len] = '\0';
+}
+
+// Replace the word with dir + name, adding '/' when name is a directory
+static void insert_match(editor_t *e, int start, const char *dir, size_t dir_len, const char *name, size_t len)
+{
+    char text[MAX_LINE];
+    if (dir_len + len + 2 > sizeof(text)) return;
+    memcpy(text, dir, dir_len);
+    memcpy(text + dir_len, name, len);
+    size_t n = dir_len + len;
+    text[n] = '\0';
+
+    struct stat st;
+    if (len == strlen(name) && stat(text, &st) == 0 && S_ISDIR(st.st_mode)) text[n++] = '/';
+    replace_word(e, start, text, n);
+}
+
 // Tab Completion
-static void do_completion(char *buf, int *pos)
+static void do_completion(editor_t *e, completion_state_t *cs)
 {
-    // Very basic completion: match files in CWD
-    // 1. Find start of word
-    int start = *pos;
+    char *buf = e->buf;
+
+    // 1. Find start of word (or keep the one being cycled)
+    int start = e->pos;
     while (start > 0 && buf[start-1] != ' ') start--;
-    
+
     char partial[256];
-    int len = *pos - start;
-    if (len >= 255) return;
-    
-    strncpy(partial, buf + start, len);
-    partial[len] = '\0';
-    
-    // 2. Search for matches
-    // Builtins
-    const char *builtins[] = { "cd", "exit", "help", "echo", "prompt", "jobs", "fg", NULL };
-    for (int i = 0; builtins[i]; ++i)
-    {
-        if (strncmp(builtins[i], partial, len) == 0)
-        {
-             int rest_len = strlen(builtins[i]) - len;
-             for (int j = 0; j < rest_len; ++j)
-             {
-                 buf[(*pos)++] = builtins[i][len + j];
-                 printf("%c", builtins[i][len + j]);
-             }
-             buf[*pos] = '\0';
-             return; // Found one, stop (simple)
-        }
-    }
-
-    WIN32_FIND_DATA ffd;
-    char pattern[256];
-    snprintf(pattern, sizeof(pattern), "%s*", partial);
-    
-    HANDLE hFind = FindFirstFile(pattern, &ffd);
-    if (hFind != INVALID_HANDLE_VALUE)
-    {
-        // Just take the first one for now
-        // Ideally we cycle.
-        char *match = ffd.cFileName;
-        
-        // Append difference
-        int rest_len = strlen(match) - len;
-        if (rest_len > 0)
-        {
-             // Check buffer space
-             for (int i = 0; i < rest_len; ++i)
-             {
-                 buf[(*pos)++] = match[len + i];
-                 printf("%c", match[len + i]);
-             }
-             buf[*pos] = '\0';
-        }
-        
-        FindClose(hFind);
-    }
-}
-
-int read_line_with_history(char *buf, int max_len)
-{
-    int pos = 0;
-    int ch;
-    int h_idx = history_count;
-    
-    if (buf[0]) { pos = strlen(buf); printf("%s", buf); } // Support pre-filled?
-    else buf[0] = '\0';
+    if (cs->active)
+    {
+        start = cs->start;
+        strcpy(partial, cs->word);
+    }
+    else
+    {
+        int len = e->pos - start;
+        if (len >= 255) return;
+        memcpy(partial, buf + start, len);
+        partial[len] = '\0';
+    }
 
-    while (1)
+    // 2. Split into the directory to list and the name prefix
+    const char *base = partial;
+    for (const char *p = partial; *p; ++p)
+    {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    size_t dir_len = (size_t)(base - partial), blen = strlen(base);
+    char dir[256];
+    if (dir_len == 0) strcpy(dir, ".");
+    else
     {
-        ch = _getch();
+        memcpy(dir, partial, dir_len);
+        dir[dir_len] = '\0';
+    }
 
-        if (ch == '\r') // Enter
+    // 3. Files; for the first word also builtins, aliases and PATH commands
+    int first_word = dir_len == 0;
+    for (int i = 0; i < start; ++i)
+    {
+        if (buf[i] != ' ') { first_word = 0; break; }
+    }
+    const char *const *files = NULL, *const *path_cmds = NULL;
+    size_t nf = 0, np = 0;
+    if (complete_files(dir, base, blen, &files, &nf) != 0) nf = 0;
+    if (first_word && complete_commands(base, blen, &path_cmds, &np) != 0) np = 0;
+
+    const char *aliases[MAX_ALIASES];
+    int na = first_word ? alias_names(aliases, MAX_ALIASES) : 0;
+
+    const char *const *cands = files;
+    const char **merged = NULL;
+    size_t n = nf;
+    if (first_word)
+    {
+        size_t cap = nf + np + (size_t)na + 32;
+        merged = malloc(sizeof(char *) * cap);
+        if (!merged) return;
+        n = 0;
+        for (int i = 0; builtin_names[i]; ++i)
+        {
+            if (strncmp(builtin_names[i], base, blen) == 0) merged[n++] = builtin_names[i];
+        }
+        for (int i = 0; i < na; ++i)
+        {
+            if (strncmp(aliases[i], base, blen) == 0) merged[n++] = aliases[i];
+        }
+        for (size_t i = 0; i < np; ++i) merged[n++] = path_cmds[i];
+        for (size_t i = 0; i < nf; ++i) merged[n++] = files[i];
+        qsort(merged, n, sizeof(char *), cmp_cand);
+        size_t u = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (u == 0 || strcmp(merged[u - 1], merged[i]) != 0) merged[u++] = merged[i];
+        }
+        n = u;
+        cands = merged;
+    }
+
+    if (cs->active)
+    {
+        if (n == 0) cs->active = 0;
+        else
+        {
+            size_t k = cs->next++ % n;
+            insert_match(e, start, partial, dir_len, cands[k], strlen(cands[k]));
+        }
+    }
+    else if (n == 1)
+    {
+        insert_match(e, start, partial, dir_len, cands[0], strlen(cands[0]));
+    }
+    else if (n > 1)
+    {
+        // Longest common prefix first; once there is nothing to add, cycle
+        size_t common = complete_common(cands, n);
+        if (common > blen)
+        {
+            insert_match(e, start, partial, dir_len, cands[0], common);
+        }
+        else
+        {
+            cs->active = 1;
+            cs->start = start;
+            strcpy(cs->word, partial);
+            cs->next = 1;
+            insert_match(e, start, partial, dir_len, cands[0], strlen(cands[0]));
+        }
+    }
+    else if (fuzzy_enabled() && blen > 0)
+    {
+        // No prefix match: take the best fuzzy match among everything completable here
+        const char *const *all = NULL, *const *all_cmds = NULL;
+        size_t nall = 0, ncmds = 0;
+        if (complete_files(dir, "", 0, &all, &nall) != 0) nall = 0;
+        if (first_word && complete_commands("", 0, &all_cmds, &ncmds) != 0) ncmds = 0;
+        const char **names = malloc(sizeof(char *) * (nall + ncmds + (size_t)na + 32));
+        if (names)
+        {
+            size_t m = 0;
+            for (int i = 0; first_word && builtin_names[i]; ++i) names[m++] = builtin_names[i];
+            for (int i = 0; i < na; ++i) names[m++] = aliases[i];
+            for (size_t i = 0; i < ncmds; ++i) names[m++] = all_cmds[i];
+            for (size_t i = 0; i < nall; ++i) names[m++] = all[i];
+
+            int best = fuzzy_best(base, names, m);
+            if (best >= 0) insert_match(e, start, partial, dir_len, names[best], strlen(names[best]));
+            free(names);
+        }
+    }
+    free(merged);
+}
+
+static void insert_char(editor_t *e, char c)
+{
+    if (e->len >= e->max_len - 1) return;
+    memmove(e->buf + e->pos + 1, e->buf + e->pos, (size_t)(e->len - e->pos));
+    e->buf[e->pos++] = c;
+    e->buf[++e->len] = '\0';
+}
+
+static void insert_text(editor_t *e, const char *text, size_t n)
+{
+    if (n > (size_t)(e->max_len - 1 - e->len)) n = (size_t)(e->max_len - 1 - e->len);
+    memmove(e->buf + e->pos + n, e->buf + e->pos, (size_t)(e->len - e->pos));
+    memcpy(e->buf + e->pos, text, n);
+    e->pos += (int)n;
+    e->len += (int)n;
+    e->buf[e->len] = '\0';
+}
+
+/*
+ * A multi-line paste runs like typed lines: the first completes the line
+ * being edited and the rest wait here, each then going through the prompt
+ * and process_line in turn. An unfinished last line becomes the starting
+ * text of the next edit.
+ */
+static char *queued;
+static size_t queued_len, queued_pos;
+
+static void queue_add(const char *text, size_t n)
+{
+    if (queued_pos == queued_len) queued_pos = queued_len = 0;
+    char *q = realloc(queued, queued_len + n + 1);
+    if (!q) return;
+    queued = q;
+    memcpy(queued + queued_len, text, n);
+    queued_len += n;
+}
+
+// Insert pasted text; 1 if it completed the line
+static int paste_insert(editor_t *e, char *text, size_t n)
+{
+    // Line endings to '\n', tabs to spaces, other control bytes dropped
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        char c = text[i];
+        if (c == '\r')
         {
-            printf("\n");
-            buf[pos] = '\0';
+            if (i + 1 < n && text[i + 1] == '\n') continue;
+            c = '\n';
+        }
+        else if (c == '\t') c = ' ';
+        else if ((unsigned char)c < 32 && c != '\n') continue;
+        else if (c == 127) continue;
+        text[k++] = c;
+    }
+
+    char *nl = memchr(text, '\n', k);
+    if (!nl)
+    {
+        insert_text(e, text, k);
+        return 0;
+    }
+
+    // What followed the cursor goes after the pasted text
+    queue_add(nl + 1, k - (size_t)(nl + 1 - text));
+    queue_add(e->buf + e->pos, (size_t)(e->len - e->pos));
+    e->len = e->pos;
+    insert_text(e, text, (size_t)(nl - text));
+    return 1;
+}
+
+static void delete_range(editor_t *e, int from, int to)
+{
+    if (to > e->len) to = e->len;
+    if (from >= to) return;
+    memmove(e->buf + from, e->buf + to, (size_t)(e->len - to));
+    e->len -= to - from;
+    e->buf[e->len] = '\0';
+    if (e->pos > to) e->pos -= to - from;
+    else if (e->pos > from) e->pos = from;
+}
+
+int read_line_with_history(const char *prompt, char *buf, int max_len)
+{
+    // Only the prompt's last line is redrawn with the text
+    const char *full_prompt = prompt;
+    const char *last = strrchr(prompt, '\n');
+    if (last) prompt = last + 1;
+
+    static editor_t ed;
+    editor_t *e = &ed;
+    e->prompt = prompt;
+    e->buf = buf;
+    e->max_len = max_len;
+    e->len = e->pos = (int)strlen(buf);
+    e->cols = term_columns();
+    snprintf(e->shown_prompt, sizeof(e->shown_prompt), "%s", prompt);
+    e->shown_prompt_cols = display_width(prompt);
+    e->shown_len = e->shown_pos = 0;
+    e->out_len = 0;
+    e->highlight = highlight_enabled();
+    e->hl_len = 0;
+    e->hl_states[0] = LEX_STATE_INIT;
+
+    int h_idx = -1; // looked up on the first Up/Down, so the prompt never waits for the history index
+    completion_state_t cs = {0};
+    int result = -1;
+
+    fflush(stdout); // job notices and the like went out through stdio
+    if (queued_pos < queued_len)
+    {
+        char *q = queued + queued_pos;
+        char *nl = memchr(q, '\n', queued_len - queued_pos);
+        size_t n = nl ? (size_t)(nl - q) : queued_len - queued_pos;
+        queued_pos += nl ? n + 1 : n;
+        e->len = e->pos = 0;
+        insert_text(e, q, n);
+        if (nl)
+        {
+            // A queued line is shown with its prompt in one write and run
+            out_add(e, full_prompt, strlen(full_prompt));
+            out_add(e, buf, (size_t)e->len);
+            out_add(e, "\r\n", 2);
+            out_flush(e);
             return 1;
         }
-        else if (ch == '\b' || ch == 8) // Backspace
+    }
+
+    term_raw();
+    out_add(e, full_prompt, strlen(full_prompt));
+    refresh(e);
+
+    while (result == -1)
+    {
+        int ch = read_key();
+        if (ch != 9) cs.active = 0;
+
+        if (ch == '\r') // Enter
         {
-            if (pos > 0)
-            {
-                pos--;
-                printf("\b \b");
-                buf[pos] = '\0';
-            }
+            result = 1;
+        }
+        else if (ch == '\b') // Backspace
+        {
+            delete_range(e, prev_char(e, e->pos), e->pos);
+        }
+        else if (ch == KEY_DELETE)
+        {
+            delete_range(e, e->pos, next_char(e, e->pos));
+        }
+        else if (ch == 4) // Ctrl+D: delete, or end of input on an empty line
+        {
+            if (e->len == 0) result = 0;
+            else delete_range(e, e->pos, next_char(e, e->pos));
+        }
+        else if (ch == KEY_LEFT || ch == 2) // Ctrl+B
+        {
+            e->pos = prev_char(e, e->pos);
+        }
+        else if (ch == KEY_RIGHT || ch == 6) // Ctrl+F
+        {
+            e->pos = next_char(e, e->pos);
+        }
+        else if (ch == KEY_HOME || ch == 1) // Ctrl+A
+        {
+            e->pos = 0;
+        }
+        else if (ch == KEY_END || ch == 5) // Ctrl+E
+        {
+            e->pos = e->len;
+        }
+        else if (ch == 21) // Ctrl+U: kill to start
+        {
+            delete_range(e, 0, e->pos);
+        }
+        else if (ch == 11) // Ctrl+K: kill to end
+        {
+            delete_range(e, e->pos, e->len);
+        }
+        else if (ch == 23) // Ctrl+W: kill previous word
+        {
+            int from = e->pos;
+            while (from > 0 && buf[from - 1] == ' ') from--;
+            while (from > 0 && buf[from - 1] != ' ') from--;
+            delete_range(e, from, e->pos);
+        }
+        else if (ch == 12) // Ctrl+L: clear screen
+        {
+            out_add(e, "\x1b[H\x1b[2J", 7);
+            out_add(e, prompt, strlen(prompt));
+            e->shown_len = e->shown_pos = 0;
         }
         else if (ch == 9) // TAB
         {
-            do_completion(buf, &pos);
+            do_completion(e, &cs);
+        }
+        else if (ch == KEY_PASTE)
+        {
+            size_t n;
+            char *text = read_paste(&n);
+            if (text && paste_insert(e, text, n)) result = 1;
+            free(text);
         }
         else if (ch == 18) // Ctrl+R
         {
-             // Simple search: clear current line, do search
-             // char old_buf[MAX_LINE]; 
-             // strcpy(old_buf, buf);
-             int res = do_reverse_search(buf, max_len);
-             if (res == 1) // Accepted
-             {
-                 printf("\n"); // Newline after search
-                 return 1;
-             }
-             else
-             {
-                 // Cancelled
-                 printf("\n"); 
-                 // We kept buf modified or we should restore? 
-                 // For now, simpler to just accept cancellation means "undefined" or empty or whatever search left.
-                 // Actually do_reverse_search should handle restoration on Cancel?
-                 // But I'm removing old_buf to fix error quickly.
-                 return 0; // aborts current input
-             }
-        }
-        else if (ch == 0 || ch == 224) // Arrow keys
-        {
-            int arrow = _getch();
-            if (arrow == 72) // UP
+            if (do_reverse_search(e)) result = 1;
+        }
+        else if (ch == KEY_UP)
+        {
+            // Skip entries repeated later on
+            if (h_idx < 0) h_idx = history_length();
+            int prev = h_idx - 1;
+            while (prev >= 0 && !history_entry(prev, NULL)) prev--;
+            if (prev >= 0)
             {
-                if (h_idx > 0)
-                {
-                    h_idx--;
-                    while (pos > 0) { printf("\b \b"); pos--; }
-                    strcpy(buf, history[h_idx]);
-                    pos = strlen(buf);
-                    printf("%s", buf);
-                }
+                h_idx = prev;
+                e->len = e->pos = load_history_entry(buf, max_len, h_idx);
             }
-            else if (arrow == 80) // DOWN
+        }
+        else if (ch == KEY_DOWN)
+        {
+            if (h_idx >= 0 && h_idx < history_length())
             {
-                if (h_idx < history_count)
+                h_idx++;
+                while (h_idx < history_length() && !history_entry(h_idx, NULL)) h_idx++;
+                if (h_idx < history_length()) e->len = e->pos = load_history_entry(buf, max_len, h_idx);
+                else
                 {
-                    h_idx++;
-                    while (pos > 0) { printf("\b \b"); pos--; }
-                    if (h_idx < history_count)
-                    {
-                        strcpy(buf, history[h_idx]);
-                        pos = strlen(buf);
-                        printf("%s", buf);
-                    }
-                    else
-                    {
-                        buf[0] = '\0';
-                        pos = 0;
-                    }
+                    buf[0] = '\0';
+                    e->len = e->pos = 0;
                 }
             }
         }
-        else if (ch == 3) // Ctrl+C
+        else if (ch == 3) // Ctrl+C: drop the line, keep the shell
         {
-             printf("^C\n");
-             buf[0] = '\0';
-             return 0;
+            e->pos = e->len;
+            refresh(e);
+            out_add(e, "^C", 2);
+            buf[0] = '\0';
+            foxy_interrupted = 1; // also drops an unfinished for/while/if
+            result = 1;
+            break;
         }
-        else if (pos < max_len - 1 && ch >= 32 && ch <= 126)
+        else if (ch == EOF)
         {
-            buf[pos++] = ch;
-            buf[pos] = '\0';
-            printf("%c", ch);
+            result = 0;
+            break;
         }
-        else if (ch == EOF)
+        else if (ch >= 32 && ch <= 126)
         {
-            return 0;
+            insert_char(e, (char)ch);
+        }
+        else if (ch >= 128 && ch <= 255) // UTF-8, drawn once the code point is whole
+        {
+            insert_char(e, (char)ch);
+            if (char_incomplete(e)) continue;
         }
+        else
+        {
+            continue;
+        }
+
+        // Keys already waiting (typed ahead or pasted) share one redraw
+        if (result == 1) e->pos = e->len;
+        if (result != -1 || !input_pending()) refresh(e);
     }
+
+    out_add(e, "\r\n", 2);
+    out_flush(e);
+    term_restore();
+    if (result == 0) buf[0] = '\0';
+    return result;
 }
@@ -1,9 +1,8 @@
 #ifndef INTERACTION_H
 #define INTERACTION_H
 
-void history_init();
-void history_load();
-void add_to_history(const char *cmd);
-int read_line_with_history(char *buf, int max_len);
+// Print prompt and edit a line into buf (which may hold text to start from).
+// Returns 1 when a line is ready (empty after Ctrl+C), 0 at end of input.
+int read_line_with_history(const char *prompt, char *buf, int max_len);
 
 #endif // INTERACTION_H
@@ -1,8 +1,16 @@
 #include "jobs.h"
+#include "mem.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
 
 #define MAX_JOBS 20
 
@@ -23,11 +31,12 @@ int job_add(intptr_t pid, const char *command)
         {
             job_list[i].id = next_job_id++;
             job_list[i].pid = pid;
-            job_list[i].command = strdup(command);
+            job_list[i].command = mem_strdup(MEM_JOBS, command);
             job_list[i].status = JOB_RUNNING;
             
             // Print background job info: [1] 1234
             printf("[%d] %lld\n", job_list[i].id, (long long)pid);
+            TRACE_EVENT("job start", command);
             return job_list[i].id;
         }
     }
@@ -63,7 +72,8 @@ void job_print_all()
 
 void remove_job(int index)
 {
-    if (job_list[index].command) free(job_list[index].command);
+    TRACE_EVENT("job done", job_list[index].command);
+    if (job_list[index].command) mem_free(job_list[index].command);
     job_list[index].command = NULL;
     job_list[index].id = 0;
     job_list[index].pid = 0;
@@ -76,6 +86,14 @@ void job_check_status()
     {
         if (job_list[i].id != 0 && job_list[i].status == JOB_RUNNING)
         {
+#ifndef _WIN32
+            int st;
+            if (waitpid((pid_t)job_list[i].pid, &st, WNOHANG) != 0)
+            {
+                printf("[%d] Done %s\n", job_list[i].id, job_list[i].command);
+                remove_job(i);
+            }
+#else
             DWORD exit_code;
             HANDLE hProcess = (HANDLE)job_list[i].pid;
             
@@ -97,6 +115,7 @@ void job_check_status()
                     remove_job(i);
                 }
             }
+#endif
         }
     }
 }
@@ -110,9 +129,16 @@ int job_to_foreground(int id)
         return -1;
     }
 
+    uint64_t t = TRACE_START();
+#ifdef _WIN32
     HANDLE hProcess = (HANDLE)j->pid;
     // Wait for it
     WaitForSingleObject(hProcess, INFINITE);
+#else
+    int st;
+    waitpid((pid_t)j->pid, &st, 0);
+#endif
+    TRACE_SPAN("job fg", t, j->command);
     
     // It's done
     job_check_status(); // This will cleanup and print "Done"
@@ -1,4 +1,5 @@
 #include "foxy.h"
+#include "mem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,10 +11,11 @@
 static void free_token_list_internal(token_list_t *tlist) 
 {
     if (!tlist) return;
-    for (size_t i = 0; i < tlist->count; ++i) free(tlist->items[i]);
-    free(tlist->items);
+    for (size_t i = 0; i < tlist->count; ++i) mem_free(tlist->items[i]);
+    mem_free(tlist->items);
     tlist->items = NULL;
     tlist->count = 0;
+    tlist->cap = 0;
 }
 
 /* expose for header */
@@ -22,32 +24,43 @@ void free_token_list(token_list_t *t)
     free_token_list_internal(t);
 }
 
-/* to add token */
-static int tlist_add(token_list_t *tlist, const char *s) 
+int splice_tokens(token_list_t *t, token_list_t *front)
 {
-    if (!tlist->items) 
+    if (t->count == 0) return -1;
+    size_t n = front->count + t->count - 1;
+    if (n + 1 > t->cap)
     {
-        tlist->items = malloc(sizeof(char*) * INITIAL_TOK_CAP);
-
-        if (!tlist->items) return -1;
-        for (int i=0;i<INITIAL_TOK_CAP;i++) tlist->items[i] = NULL;
-
+        char **tmp = mem_realloc(MEM_LEXER, t->items, sizeof(char*) * (n + 1));
+        if (!tmp) return -1;
+        t->items = tmp;
+        t->cap = n + 1;
     }
+    mem_free(t->items[0]);
+    memmove(t->items + front->count, t->items + 1, sizeof(char*) * (t->count - 1));
+    memcpy(t->items, front->items, sizeof(char*) * front->count);
+    t->count = n;
+    t->items[n] = NULL;
+
+    mem_free(front->items);
+    front->items = NULL;
+    front->count = front->cap = 0;
+    return 0;
+}
 
-    /* find allocated slots by walking until NULL sentinel */
-    size_t slots = 0;
-    while (tlist->items[slots]) ++slots;
-    if (tlist->count + 2 > slots)
+/* to add token */
+static int tlist_add(token_list_t *tlist, const char *s) 
+{
+    // Room for this token and the NULL sentinel after it
+    if (tlist->count + 2 > tlist->cap)
     {
-
-        size_t new_slots = (slots == 0) ? INITIAL_TOK_CAP : slots * 2;
-        char **tmp = realloc(tlist->items, sizeof(char*) * new_slots);
+        size_t new_slots = (tlist->cap == 0) ? INITIAL_TOK_CAP : tlist->cap * 2;
+        char **tmp = mem_realloc(MEM_LEXER, tlist->items, sizeof(char*) * new_slots);
         if (!tmp) return -1;
-        for (size_t i = slots; i < new_slots; ++i) tmp[i] = NULL;
+        for (size_t i = tlist->cap; i < new_slots; ++i) tmp[i] = NULL;
         tlist->items = tmp;
-        
+        tlist->cap = new_slots;
     }
-    tlist->items[tlist->count] = strdup(s ? s : "");
+    tlist->items[tlist->count] = mem_strdup(MEM_LEXER, s ? s : "");
     if (!tlist->items[tlist->count]) return -1;
     tlist->count++;
     tlist->items[tlist->count] = NULL;
@@ -60,7 +73,7 @@ static int buf_append(char **buf, size_t *len, size_t *cap, char c)
     {
 
         size_t newcap = (*cap == 0) ? INITIAL_BUF_CAP : (*cap * 2);
-        char *tmp = realloc(*buf, newcap);
+        char *tmp = mem_realloc(MEM_LEXER, *buf, newcap);
         if (!tmp) return -1;
         *buf = tmp;
         *cap = newcap;
@@ -73,12 +86,82 @@ static int buf_append(char **buf, size_t *len, size_t *cap, char c)
 
 }
 
+// $((expr)), up to the matching "))"; -2 if there is none
+static int buf_append_arith(const char **p, char **buf, size_t *len, size_t *cap)
+{
+    const char *s = *p + 3, *e = s;
+    int depth = 0;
+    for (; *e; ++e)
+    {
+        if (*e == '(') depth++;
+        else if (*e == ')')
+        {
+            if (depth == 0) break;
+            depth--;
+        }
+    }
+    if (*e != ')' || e[1] != ')') return -2;
+
+    if (buf_append(buf, len, cap, LEX_ARITH) < 0) return -1;
+    for (; s < e; ++s)
+    {
+        if (buf_append(buf, len, cap, *s) < 0) return -1;
+    }
+    *p = e + 2;
+    return buf_append(buf, len, cap, LEX_ARITH);
+}
+
+// <(cmd) or >(cmd), up to the matching ")"; -2 if there is none
+static int buf_append_subst(const char **p, char **buf, size_t *len, size_t *cap)
+{
+    const char *s = *p + 2, *e = s;
+    int depth = 0;
+    for (; *e && (*e != ')' || depth-- > 0); ++e)
+    {
+        if (*e == '(') depth++;
+        else if (*e == '\\' && e[1]) e++;
+        else if (*e == '\'' || *e == '"')
+        {
+            const char *q = strchr(e + 1, *e);
+            if (!q) return -2;
+            e = q;
+        }
+    }
+    if (*e != ')') return -2;
+
+    if (buf_append(buf, len, cap, LEX_SUBST) < 0 || buf_append(buf, len, cap, **p) < 0) return -1;
+    for (; s < e; ++s)
+    {
+        if (buf_append(buf, len, cap, *s) < 0) return -1;
+    }
+    *p = e + 1;
+    return buf_append(buf, len, cap, LEX_SUBST);
+}
+
+// At '$': NAME becomes LEX_VAR NAME LEX_VAR for the executor to expand;
+// a '$' not followed by a name is kept as it is
+static int buf_append_var(const char **p, char **buf, size_t *len, size_t *cap)
+{
+    if ((*p)[1] == '(' && (*p)[2] == '(') return buf_append_arith(p, buf, len, cap);
+    const char *name = ++*p;
+    if (isdigit((unsigned char)**p) || **p == '@' || **p == '#') ++*p; // $1, $@, $#
+    else while (isalnum((unsigned char)**p) || **p == '_') ++*p;
+    if (*p == name) return buf_append(buf, len, cap, '$');
+
+    if (buf_append(buf, len, cap, LEX_VAR) < 0) return -1;
+    for (; name < *p; ++name)
+    {
+        if (buf_append(buf, len, cap, *name) < 0) return -1;
+    }
+    return buf_append(buf, len, cap, LEX_VAR);
+}
+
 static int buf_push_token(char **buf, size_t *len, size_t *cap, token_list_t *tlist) 
 {
     if (*len == 0) return 0;
     if (buf_append(buf, len, cap, '\0') < 0) return -1;
     int r = tlist_add(tlist, *buf);
-    free(*buf);
+    mem_free(*buf);
     *buf = NULL;
     *len = 0;
     *cap = 0;
@@ -90,9 +173,205 @@ static int is_special_char(char c)
     return (c == '|' || c == '<' || c == '>' || c == '&' || c == ';');
 }
 
+// At an unquoted '{': 1 if a '}' closes it within the word with a ',' or
+// ".." at its own level, as in {a,b} and {1..9}; {}, {x} and "f(){" are text
+static int brace_opens(const char *p)
+{
+    int depth = 0, split = 0;
+    for (++p; *p && !isspace((unsigned char)*p) && !is_special_char(*p); ++p)
+    {
+        if (*p == '\\' && !*++p) return 0;
+        else if (*p == '\'' || *p == '"')
+        {
+            const char *q = strchr(p + 1, *p);
+            if (!q) return 0;
+            p = q;
+        }
+        else if (p[0] == '$' && p[1] == '(' && p[2] == '(')
+        {
+            int parens = 0; // $((...)) may hold spaces and commas
+            for (p += 3; *p && (*p != ')' || parens-- > 0); ++p) parens += *p == '(';
+            if (*p != ')' || p[1] != ')') return 0;
+            p++;
+        }
+        else if (*p == '{') depth++;
+        else if (*p == '}' && depth-- == 0) return split;
+        else if (depth == 0) split |= *p == ',' || (p[0] == '.' && p[1] == '.');
+    }
+    return 0;
+}
+
+// KW_LEADS: a command follows the keyword (do, then, ...)
+enum { KW_NONE, KW_PLAIN, KW_LEADS };
+
+int is_keyword(const char *word, size_t len)
+{
+    static const struct { const char *word; int kind; } keywords[] =
+    {
+        { "if", KW_LEADS }, { "then", KW_LEADS }, { "elif", KW_LEADS }, { "else", KW_LEADS },
+        { "while", KW_LEADS }, { "until", KW_LEADS }, { "do", KW_LEADS },
+        { "for", KW_PLAIN }, { "done", KW_PLAIN }, { "fi", KW_PLAIN },
+        { "{", KW_LEADS }, { "}", KW_PLAIN },
+    };
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i)
+    {
+        if (strlen(keywords[i].word) == len && memcmp(keywords[i].word, word, len) == 0) return keywords[i].kind;
+    }
+    return KW_NONE;
+}
+
+/*
+ * Highlighting follows the same rules as tokenize_line below (quotes,
+ * backslash escapes, operators, $NAME) but only labels bytes. The state
+ * before every byte is kept, so after an edit the scan resumes from the
+ * start of the word that changed instead of from the start of the line.
+ */
+enum { HS_NORMAL, HS_SQUOTE, HS_DQUOTE, HS_ESC, HS_DQ_ESC };
+
+static void hl_word_end(const char *line, size_t end, size_t *start, lex_state_t *st, unsigned char *classes, lex_cmd_fn classify)
+{
+    int leads = 0;
+    if (st->in_word && st->is_cmd)
+    {
+        hl_class_t k;
+        int kw = is_keyword(line + *start, end - *start);
+        int def = end - *start > 2 && memcmp(line + end - 2, "()", 2) == 0; // "name() {"
+        if (kw || def) k = HL_BUILTIN;
+        else k = classify ? classify(line + *start, end - *start) : HL_COMMAND;
+        for (size_t i = *start; i < end; ++i)
+        {
+            if (classes[i] == HL_PLAIN) classes[i] = (unsigned char)k;
+        }
+        leads = kw == KW_LEADS || def;
+    }
+    st->in_word = 0;
+    st->is_cmd = 0;
+    if (leads) st->expect = 1; // "do echo": echo is a command too
+}
+
+static void hl_word_begin(size_t i, size_t *start, lex_state_t *st)
+{
+    if (st->in_word) return;
+    st->in_word = 1;
+    *start = i;
+    if (st->redirect) st->redirect = 0;
+    else if (st->expect)
+    {
+        st->is_cmd = 1;
+        st->expect = 0;
+    }
+}
+
+void lex_highlight(const char *line, size_t len, size_t from, lex_state_t *states, unsigned char *classes, lex_cmd_fn classify)
+{
+    lex_state_t st = states[from];
+    size_t start = from;
+
+    for (size_t i = from; i < len; ++i)
+    {
+        states[i] = st;
+        char c = line[i];
+        unsigned char cls = HL_PLAIN;
+
+        if (st.arith)
+        {
+            // All of it, spaces and > included, until the ")" matching "$((" or "<("
+            if (c == '(' && st.arith < 255) st.arith++;
+            else if (c == ')' && --st.arith == 1) st.arith = 0;
+            classes[i] = HL_VARIABLE;
+            continue;
+        }
+
+        if (st.var)
+        {
+            int first = st.var == 2;
+            st.var = 1;
+            if (first && (isdigit((unsigned char)c) || c == '@' || c == '#'))
+            {
+                st.var = 0;
+                classes[i] = HL_VARIABLE;
+                continue;
+            }
+            if (isalnum((unsigned char)c) || c == '_')
+            {
+                classes[i] = HL_VARIABLE;
+                continue;
+            }
+            st.var = 0;
+        }
+
+        switch (st.mode)
+        {
+            case HS_ESC:
+                st.mode = HS_NORMAL;
+                break;
+            case HS_DQ_ESC:
+                st.mode = HS_DQUOTE;
+                cls = HL_STRING;
+                break;
+            case HS_SQUOTE:
+                if (c == '\'') st.mode = HS_NORMAL;
+                cls = HL_STRING;
+                break;
+            case HS_DQUOTE:
+                cls = HL_STRING;
+                if (c == '"') st.mode = HS_NORMAL;
+                else if (c == '\\') st.mode = HS_DQ_ESC;
+                else if (c == '$')
+                {
+                    if (i + 2 < len && line[i + 1] == '(' && line[i + 2] == '(') st.arith = 1;
+                    else st.var = 2;
+                    cls = HL_VARIABLE;
+                }
+                break;
+            default:
+                if (isspace((unsigned char)c))
+                {
+                    hl_word_end(line, i, &start, &st, classes, classify);
+                }
+                else if ((c == '<' || c == '>') && i + 1 < len && line[i + 1] == '(')
+                {
+                    hl_word_begin(i, &start, &st); // <(cmd) is a word, up to its ")"
+                    st.arith = 1;
+                    cls = HL_OPERATOR;
+                }
+                else if (is_special_char(c))
+                {
+                    hl_word_end(line, i, &start, &st, classes, classify);
+                    if (c == '<' || c == '>') st.redirect = 1;
+                    else st.expect = 1;
+                    cls = HL_OPERATOR;
+                }
+                else
+                {
+                    hl_word_begin(i, &start, &st);
+                    if (c == '\\') st.mode = HS_ESC;
+                    else if (c == '\'') { st.mode = HS_SQUOTE; cls = HL_STRING; }
+                    else if (c == '"') { st.mode = HS_DQUOTE; cls = HL_STRING; }
+                    else if (c == '$')
+                    {
+                        if (i + 2 < len && line[i + 1] == '(' && line[i + 2] == '(') st.arith = 1;
+                        else st.var = 2;
+                        cls = HL_VARIABLE;
+                    }
+                }
+                break;
+        }
+        classes[i] = cls;
+    }
+
+    // The word under the cursor is judged as typed so far
+    if (st.in_word && st.is_cmd)
+    {
+        lex_state_t tail = st;
+        hl_word_end(line, len, &start, &tail, classes, classify);
+    }
+    states[len] = st;
+}
+
 int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode) 
 {
-    *out = (token_list_t){ .items = NULL, .count = 0 };
+    *out = (token_list_t){ .items = NULL, .count = 0, .cap = 0 };
     *errcode = LEX_OK;
     if (!line) return 0;
 
@@ -101,12 +380,14 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
     size_t blen = 0, bcap = 0;
 
     enum { S_NORMAL, S_SQUOTE, S_DQUOTE, S_ESC } state = S_NORMAL;
+    int brace_depth = 0;
+    unsigned long long brace_marks = 0;
 
     while (*p) {
         char c = *p;
 
         if (state == S_ESC) {
-            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
+            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
             state = S_NORMAL;
             ++p;
             continue;
@@ -114,7 +395,7 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
 
         if (state == S_SQUOTE) {
             if (c == '\'') { state = S_NORMAL; ++p; continue; }
-            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
+            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
             ++p;
             continue;
         }
@@ -123,38 +404,22 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
             if (c == '"') { state = S_NORMAL; ++p; continue; }
             if (c == '\\') {
                 ++p;
-                if (!*p) { *errcode = LEX_ERR_UNCLOSED_QUOTE; free(buf); return -1; }
+                if (!*p) { *errcode = LEX_ERR_UNCLOSED_QUOTE; mem_free(buf); return -1; }
                 char nc = *p;
                 // Special case: only escape $ " \ inside double quotes, others are literal
                 if (nc != '$' && nc != '"' && nc != '\\') {
-                     if (buf_append(&buf, &blen, &bcap, '\\') < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
+                     if (buf_append(&buf, &blen, &bcap, '\\') < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
                 }
-                if (buf_append(&buf, &blen, &bcap, nc) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
+                if (buf_append(&buf, &blen, &bcap, nc) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
                 ++p;
                 continue;
             }
             if (c == '$') {
-                ++p;
-                char varname[256];
-                int vidx = 0;
-                while (*p && (isalnum((unsigned char)*p) || *p == '_') && vidx < 255) {
-                    varname[vidx++] = *p++;
-                }
-                varname[vidx] = '\0';
-                if (vidx > 0) {
-                    char *val = getenv(varname);
-                    if (val) {
-                        for (int i = 0; val[i]; ++i) {
-                            if (buf_append(&buf, &blen, &bcap, val[i]) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
-                        }
-                    }
-                } else {
-                    // Just a $
-                    if (buf_append(&buf, &blen, &bcap, '$') < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
-                }
+                int r = buf_append_var(&p, &buf, &blen, &bcap);
+                if (r < 0) { *errcode = r == -2 ? LEX_ERR_UNCLOSED_ARITH : LEX_ERR_OOM; mem_free(buf); return -1; }
                 continue;
             }
-            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
+            if (buf_append(&buf, &blen, &bcap, c) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
             ++p;
             continue;
         }
@@ -164,8 +429,10 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
         {
             if (buf_push_token(&buf, &blen, &bcap, out) < 0)
             {
-                *errcode = LEX_ERR_OOM; free(buf); return -1; 
+                *errcode = LEX_ERR_OOM; mem_free(buf); return -1; 
             }
+            // Lines joined for a multi-line for/while/if: a newline ends a command
+            if (c == '\n' && tlist_add(out, ";") < 0) { *errcode = LEX_ERR_OOM; return -1; }
             ++p;
             continue;
         }
@@ -175,31 +442,21 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
         if (c == '"') { state = S_DQUOTE; ++p; continue; }
 
         if (c == '$') {
-            ++p;
-            char varname[256];
-            int vidx = 0;
-            while (*p && (isalnum((unsigned char)*p) || *p == '_') && vidx < 255) {
-                varname[vidx++] = *p++;
-            }
-            varname[vidx] = '\0';
-            if (vidx > 0) {
-                char *val = getenv(varname);
-                if (val) {
-                    for (int i = 0; val[i]; ++i) {
-                        if (buf_append(&buf, &blen, &bcap, val[i]) < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
-                    }
-                }
-            } else {
-                // Just a $
-                if (buf_append(&buf, &blen, &bcap, '$') < 0) { *errcode = LEX_ERR_OOM; free(buf); return -1; }
-            }
+            int r = buf_append_var(&p, &buf, &blen, &bcap);
+            if (r < 0) { *errcode = r == -2 ? LEX_ERR_UNCLOSED_ARITH : LEX_ERR_OOM; mem_free(buf); return -1; }
+            continue;
+        }
+
+        if ((c == '<' || c == '>') && p[1] == '(') {
+            int r = buf_append_subst(&p, &buf, &blen, &bcap);
+            if (r < 0) { *errcode = r == -2 ? LEX_ERR_UNCLOSED_SUBST : LEX_ERR_OOM; mem_free(buf); return -1; }
             continue;
         }
 
         if (is_special_char(c)) {
             if (buf_push_token(&buf, &blen, &bcap, out) < 0)
             {
-                *errcode = LEX_ERR_OOM; free(buf); return -1; 
+                *errcode = LEX_ERR_OOM; mem_free(buf); return -1; 
             }
             if (c == '>' && *(p+1) == '>') 
             {
@@ -231,33 +488,62 @@ int tokenize_line(const char *line, token_list_t *out, lex_err_t *errcode)
             }
         }
 
+        // Braces: bit n of brace_marks is set if the brace open at depth n
+        // is marked, so its commas and } are marked too
+        if (c == '{' && brace_depth < 64)
+        {
+            int mark = brace_opens(p);
+            if (mark || brace_depth > 0)
+            {
+                brace_marks = (brace_marks & ~(1ULL << brace_depth)) | (unsigned long long)mark << brace_depth;
+                brace_depth++;
+            }
+            if (mark && buf_append(&buf, &blen, &bcap, LEX_BRACE) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
+        }
+        else if (brace_depth > 0 && (c == ',' || c == '}') && (brace_marks >> (brace_depth - 1) & 1))
+        {
+            if (c == '}') brace_depth--;
+            if (buf_append(&buf, &blen, &bcap, LEX_BRACE) < 0) { *errcode = LEX_ERR_OOM; mem_free(buf); return -1; }
+        }
+        else if (brace_depth > 0 && c == '}')
+        {
+            brace_depth--;
+        }
+
+        // Only unquoted pattern characters are marked, so "*" stays literal
+        if ((c == '*' || c == '?' || c == '[') && buf_append(&buf, &blen, &bcap, LEX_GLOB) < 0)
+        {
+            *errcode = LEX_ERR_OOM; mem_free(buf); return -1;
+        }
+
         if (buf_append(&buf, &blen, &bcap, c) < 0) 
         {
-            *errcode = LEX_ERR_OOM; free(buf); return -1; 
+            *errcode = LEX_ERR_OOM; mem_free(buf); return -1; 
         }
         ++p;
     }
 
     if (state == S_SQUOTE || state == S_DQUOTE || state == S_ESC) {
         *errcode = LEX_ERR_UNCLOSED_QUOTE;
-        free(buf);
+        mem_free(buf);
         free_token_list(out);
         return -1;
     }
 
     if (buf_push_token(&buf, &blen, &bcap, out) < 0) 
     {
-         *errcode = LEX_ERR_OOM; free(buf); free_token_list(out); return -1; 
+         *errcode = LEX_ERR_OOM; mem_free(buf); free_token_list(out); return -1; 
     }
 
     if (out->count == 0) 
     {
-        out->items = malloc(sizeof(char*));
+        out->items = mem_alloc(MEM_LEXER, sizeof(char*));
         if (!out->items)
         {
             *errcode = LEX_ERR_OOM; free_token_list(out); return -1; 
         }
         out->items[0] = NULL;
+        out->cap = 1;
     }
 
     return 0;
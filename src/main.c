@@ -5,130 +5,240 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 
-#define MAX_LINE 1024
+#ifndef _WIN32
+#define _isatty isatty
+#define _fileno fileno
+#endif
 
-static char prompt_fmt[MAX_LINE] = "$CWD> ";
+#define MAX_LINE 4096
 
-void set_prompt_format(const char *fmt)
+#include "prompt.h"
+#include "mem.h"
+#include "trace.h"
+
+// Only async-signal-safe work here: the main loop draws the next prompt
+void handle_sigint(int sig)
 {
-    if (!fmt) return;
-    strncpy(prompt_fmt, fmt, MAX_LINE - 1);
-    prompt_fmt[MAX_LINE - 1] = '\0';
+    (void)sig; // unused
+    foxy_interrupted = 1;
+    ssize_t r = write(STDOUT_FILENO, "\n", 1);
+    (void)r;
 }
 
-void print_prompt()
-{
-    char cwd_buf[PATH_MAX];
-    char *cwd = getcwd(cwd_buf, sizeof(cwd_buf));
-    if (!cwd) cwd = "unknown";
+#include "interaction.h"
+#include "history.h"
+#include "alias.h"
+#include "func.h"
+#include "timing.h"
+#include "complete.h"
 
-    const char *p = prompt_fmt;
-    while (*p)
-    {
-        if (*p == '$' && strncmp(p, "$CWD", 4) == 0)
-        {
-            printf("%s", cwd);
-            p += 4;
-        }
-        else if (*p == '\\' && *(p+1) == 'n')
-        {
-            printf("\n");
-            p += 2;
-        }
-        else
-        {
-            putchar(*p);
-            ++p;
-        }
-    }
-    fflush(stdout);
+/*
+ * --startup-profile: time each step up to the first prompt. The report is
+ * printed (to stderr) only once the prompt is ready, so printing it does not
+ * count against the phases.
+ */
+#define MAX_PHASES 16
+
+static int startup_profile = 0;
+static uint64_t profile_start, profile_last;
+static const char *phase_names[MAX_PHASES];
+static uint64_t phase_ns[MAX_PHASES];
+static int phase_count = 0;
+
+static void profile_mark(const char *name)
+{
+    if (!startup_profile || phase_count >= MAX_PHASES) return;
+    uint64_t now = foxy_clock_ns();
+    phase_names[phase_count] = name;
+    phase_ns[phase_count++] = now - profile_last;
+    profile_last = now;
 }
 
-void handle_sigint(int sig)
+static void profile_report()
 {
-    (void)sig; // unused
-    printf("\n");
-    print_prompt(); 
+    if (!startup_profile) return;
+    for (int i = 0; i < phase_count; ++i)
+    {
+        fprintf(stderr, "foxy: startup: %-14s %8.3f ms\n", phase_names[i], phase_ns[i] / 1e6);
+    }
+    fprintf(stderr, "foxy: startup: %-14s %8.3f ms\n", "first prompt", (profile_last - profile_start) / 1e6);
+    startup_profile = 0;
 }
 
-#include "interaction.h"
-#include "alias.h"
+// Only commands typed at the prompt are recorded, not .foxyrc or piped input
+static int record_lines = 0;
 
 // MAX_HISTORY code removed
 // add_to_history removed
 // read_line_with_history removed
 
-void process_line(char *line)
+/*
+ * A for, while, until, if or function definition can span lines. Until its
+ * done, fi or } arrives, its lines are kept here, joined by newlines (which
+ * the lexer reads as ";"), and the whole text is parsed once complete.
+ */
+static char *pending;
+static size_t pending_len;
+
+static char *pending_add(const char *line)
+{
+    size_t n = strlen(line);
+    char *tmp = realloc(pending, pending_len + n + 2);
+    if (!tmp)
+    {
+        fprintf(stderr, "foxy: out of memory\n");
+        free(pending);
+        pending = NULL;
+        pending_len = 0;
+        return NULL;
+    }
+    pending = tmp;
+    if (pending_len) pending[pending_len++] = '\n';
+    memcpy(pending + pending_len, line, n + 1);
+    pending_len += n;
+    return pending;
+}
+
+static void pending_drop()
+{
+    free(pending);
+    pending = NULL;
+    pending_len = 0;
+}
+
+// End of a script or -c string: an unfinished for/while/if is an error
+static int end_of_input(int status)
+{
+    if (!pending) return status;
+    fprintf(stderr, "foxy: syntax error: unexpected end of input\n");
+    pending_drop();
+    return 2;
+}
+
+// Run one line; with in_place its last command replaces the shell (-c).
+// Returns the exit status of the last command run.
+int process_line(char *line, int in_place)
 {
     // Remove trailing newline
     line[strcspn(line, "\n")] = 0;
 
     // Empty line check
-    if (line[0] == '\0') return;
+    if (line[0] == '\0') return 0;
+
+    // Continuing a for/while/if or function: only a line with done, fi or }
+    // can finish it
+    char *joined = NULL;
+    if (pending)
+    {
+        int may_close = strstr(line, "done") || strstr(line, "fi") || strchr(line, '}');
+        if (!pending_add(line)) return 2;
+        if (!may_close) return 0;
+        line = joined = pending;
+        pending = NULL;
+        pending_len = 0;
+    }
+    foxy_interrupted = 0;
+    uint64_t t_line = TRACE_START();
+    mem_line_begin();
 
     // Tokenize
     token_list_t tokens = {0};
     lex_err_t lex_err;
+    uint64_t t_phase = TRACE_START();
     if (tokenize_line(line, &tokens, &lex_err) != 0)
     {
         fprintf(stderr, "foxy: lex error %d\n", lex_err);
-        return;
+        free_token_list(&tokens); // a partial list may be left on error
+        mem_line_done();
+        free(joined);
+        return 2;
     }
+    TRACE_SPAN("lex", t_phase, NULL);
 
     if (tokens.count == 0 || tokens.items[0] == NULL)
     {
         free_token_list(&tokens);
-        return;
+        mem_line_done();
+        free(joined);
+        return 0;
     }
 
     // Alias Expansion
+    t_phase = TRACE_START();
     const char *resolved = alias_resolve(tokens.items[0]);
     if (resolved)
     {
-        // Re-tokenize command using alias value + original args
-        // E.g. alias ll='ls -l'
-        // Input: ll /tmp
-        // Resolved: ls -l /tmp
-        
-        // Simple buffer reconstruction
-        char new_line[MAX_LINE];
-        // Ensure space
-        snprintf(new_line, sizeof(new_line), "%s", resolved);
-        
-        // Append rest of args
-        for (size_t i = 1; i < tokens.count; ++i)
+        // The value's tokens take the place of the name; the arguments are
+        // already lexed and keep their quoting and expansion marks
+        // (one level: alias ls='ls -F' does not recurse)
+        token_list_t value = {0};
+        lex_err_t err2;
+        if (tokenize_line(resolved, &value, &err2) != 0 || splice_tokens(&tokens, &value) != 0)
         {
-            strncat(new_line, " ", sizeof(new_line) - strlen(new_line) - 1);
-            strncat(new_line, tokens.items[i], sizeof(new_line) - strlen(new_line) - 1);
+            fprintf(stderr, "foxy: alias expansion error\n");
+            free_token_list(&value);
+            free_token_list(&tokens);
+            mem_line_done();
+            free(joined);
+            return 2;
         }
-        
-        // Free old tokens
-        free_token_list(&tokens);
-        
-        // Process new line (tokenize again)
-        // Check recursion? "alias ls='ls -F'" -> infinite loop if we recurse process_line
-        // Better to re-tokenize here without recursion into alias lookup?
-        // Or simple recursion with depth limit?
-        // Simplest: re-tokenize and parse directly (one level alias).
-        
-        lex_err_t err2;
-        if (tokenize_line(new_line, &tokens, &err2) != 0)
+        if (tokens.count == 0)
         {
-             fprintf(stderr, "foxy: alias expansion error\n");
-             return;
+            free_token_list(&tokens);
+            mem_line_done();
+            free(joined);
+            return 0;
         }
     }
+    TRACE_SPAN("alias", t_phase, resolved ? tokens.items[0] : NULL);
 
     // Parse and Execute
+    int status = 2;
+    t_phase = TRACE_START();
     node_t *ast = parse_tokens(&tokens);
+    TRACE_SPAN("parse", t_phase, NULL);
+    if (!ast && parse_needs_more())
+    {
+        // Keep the lines for when the construct is complete
+        if (joined)
+        {
+            pending = joined;
+            pending_len = strlen(joined);
+            joined = NULL;
+        }
+        else pending_add(line);
+        status = 0;
+    }
     if (ast)
     {
-        exec_node(ast);
+        // One history line for a construct typed over several
+        if (joined)
+        {
+            for (char *c = joined; *c; ++c) if (*c == '\n') *c = ';';
+        }
+
+        char cwd_buf[PATH_MAX];
+        const char *cwd = record_lines ? getcwd(cwd_buf, sizeof(cwd_buf)) : NULL;
+        int64_t start_ms = foxy_wall_ms();
+        uint64_t t0 = foxy_clock_ns();
+
+        status = in_place ? exec_node_last(ast) : exec_node(ast);
+        uint64_t duration_us = (foxy_clock_ns() - t0) / 1000;
+        TRACE_SPAN("exec", t0, NULL);
+
+        if (record_lines) history_record(line, cwd, start_ms, duration_us, status);
+        prompt_command_done(status, duration_us);
         free_ast(ast);
     }
 
     free_token_list(&tokens);
+    mem_line_done();
+    TRACE_SPAN("line", t_line, line);
+    free(joined);
+    return status;
 }
 
 void run_rc_file()
@@ -139,14 +249,142 @@ void run_rc_file()
         char line[MAX_LINE];
         while (fgets(line, sizeof(line), fp))
         {
-            process_line(line);
+            process_line(line, 0);
         }
+        end_of_input(0);
         fclose(fp);
     }
 }
 
-int main(void)
+/*
+ * Non-interactive input (a script file or a pipe) is read in large blocks
+ * and run a line at a time as lines complete, so a pipe that is still being
+ * written to runs what has arrived so far.
+ */
+#define SCRIPT_BLOCK 65536
+
+static int run_script_fd(int fd)
+{
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    int status = 0;
+
+    while (1)
+    {
+        if (cap - len < SCRIPT_BLOCK)
+        {
+            char *tmp = realloc(buf, cap + SCRIPT_BLOCK + 1);
+            if (!tmp)
+            {
+                fprintf(stderr, "foxy: out of memory\n");
+                break;
+            }
+            buf = tmp;
+            cap += SCRIPT_BLOCK;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n <= 0) break;
+        len += (size_t)n;
+
+        size_t start = 0;
+        char *nl;
+        while ((nl = memchr(buf + start, '\n', len - start)))
+        {
+            *nl = '\0';
+            if (nl > buf + start && nl[-1] == '\r') nl[-1] = '\0';
+            status = process_line(buf + start, 0);
+            start = (size_t)(nl - buf) + 1;
+        }
+        memmove(buf, buf + start, len - start);
+        len -= start;
+    }
+
+    // Last line without a newline
+    if (len > 0)
+    {
+        buf[len] = '\0';
+        status = process_line(buf, 0);
+    }
+    free(buf);
+    return end_of_input(status);
+}
+
+// foxy -c: lines of the string in order, the last one run in place
+static int run_string(char *s)
 {
+    size_t n = strlen(s);
+    while (n > 0 && (s[n - 1] == '\n' || s[n - 1] == '\r')) s[--n] = '\0';
+
+    int status = 0;
+    while (1)
+    {
+        char *nl = strchr(s, '\n');
+        if (!nl) return end_of_input(process_line(s, 1));
+        *nl = '\0';
+        if (nl > s && nl[-1] == '\r') nl[-1] = '\0';
+        status = process_line(s, 0);
+        s = nl + 1;
+    }
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    char *command = NULL;
+    const char *script = NULL;
+    for (int i = 1; i < argc && !script; ++i)
+    {
+        if (strcmp(argv[i], "--startup-profile") == 0)
+        {
+            startup_profile = 1;
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "foxy: -c: option requires an argument\n");
+                return 2;
+            }
+            command = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "foxy: unknown option %s\n", argv[i]);
+            return 2;
+        }
+        else
+        {
+            script = argv[i];
+            func_set_args(argc - i - 1, argv + i + 1); // $1.. of the script
+        }
+    }
+
+    trace_init();
+
+    // Non-interactive: no banner, prompt, history, editor or .foxyrc
+    if (command)
+    {
+        return run_string(command);
+    }
+    if (script)
+    {
+        int fd = open(script, O_RDONLY);
+        if (fd < 0)
+        {
+            fprintf(stderr, "foxy: %s: %s\n", script, strerror(errno));
+            return 127;
+        }
+        int status = run_script_fd(fd);
+        close(fd);
+        return status;
+    }
+    if (!_isatty(_fileno(stdin)))
+    {
+        return run_script_fd(0);
+    }
+
+    profile_start = profile_last = foxy_clock_ns();
+
     // 1. Signal Handling
     if (signal(SIGINT, handle_sigint) == SIG_ERR)
     {
@@ -158,48 +396,46 @@ int main(void)
 
 
     puts("Foxy [Version 0.0.1]\n");
+    profile_mark("banner");
 
-    // Run RC file
-    run_rc_file();
-
-    // 1b. Job Init
+    // 1b. Job and Alias Init, before .foxyrc defines any
     job_init();
+    alias_init();
+    profile_mark("jobs, aliases");
 
-    // 1c. History Load
+    // 1c. History: only maps the file; entries are indexed on first use
     history_init();
     history_load();
+    profile_mark("history");
 
-    // 1d. Alias Init
-    alias_init();
+    // Run RC file
+    run_rc_file();
+    profile_mark(".foxyrc");
+
+    // 1e. Index PATH for command completion in the background
+    complete_commands_refresh();
+    profile_mark("path index");
 
     while (1)
     {
         // 1c. Job Check
         job_check_status();
 
-        // 2. Prompt
-        print_prompt();
-
-        // 3. Read Line
-        if (_isatty(_fileno(stdin)))
-        {
-             // Interactive mode
-             if (!read_line_with_history(line_buf, MAX_LINE))
-             {
-                 break; 
-             }
-             add_to_history(line_buf); 
-        }
-        else
+        // 2. Prompt and 3. Read Line: pick up commands from other sessions first
+        history_sync();
+        line_buf[0] = '\0';
+        if (foxy_interrupted) pending_drop(); // Ctrl+C at a continuation line
+        const char *prompt = pending ? "> " : prompt_render();
+        profile_mark("prompt");
+        profile_report();
+        if (!read_line_with_history(prompt, line_buf, MAX_LINE))
         {
-             // Script/Piped mode
-             if (fgets(line_buf, sizeof(line_buf), stdin) == NULL)
-             {
-                 break;
-             }
+            break; 
         }
+        add_to_history(line_buf); 
+        record_lines = 1;
         
-        process_line(line_buf);
+        process_line(line_buf, 0);
     }
 
     return 0;
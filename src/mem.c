@@ -0,0 +1,141 @@
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each block is prefixed with its size and tag, so mem_free() can update the
+ * right counters without the caller repeating either. The union keeps the
+ * payload aligned as malloc's own would be.
+ */
+typedef union
+{
+    struct
+    {
+        size_t size;
+        int tag;
+    } h;
+    long double align_ld;
+    void *align_p;
+    long long align_ll;
+} mem_hdr_t;
+
+typedef struct
+{
+    size_t live, peak;           // bytes requested, headers not counted
+    size_t blocks;               // live allocations
+    unsigned long long allocs;   // every alloc, calloc, realloc and strdup
+    unsigned long long line_start, last_line, line_total;
+} mem_stat_t;
+
+static const char *tag_names[MEM_TAGS] = { "lexer", "parser", "alias", "history", "jobs", "exec", "funcs" };
+static mem_stat_t stats[MEM_TAGS];
+static unsigned long long lines;
+
+static void *account(mem_hdr_t *h, mem_tag_t tag, size_t size)
+{
+    if (!h) return NULL;
+    h->h.size = size;
+    h->h.tag = tag;
+    mem_stat_t *s = &stats[tag];
+    s->live += size;
+    if (s->live > s->peak) s->peak = s->live;
+    s->blocks++;
+    s->allocs++;
+    return h + 1;
+}
+
+void *mem_alloc(mem_tag_t tag, size_t size)
+{
+    if (size > (size_t)-1 - sizeof(mem_hdr_t)) return NULL;
+    return account(malloc(sizeof(mem_hdr_t) + size), tag, size);
+}
+
+void *mem_calloc(mem_tag_t tag, size_t count, size_t size)
+{
+    if (size && count > ((size_t)-1 - sizeof(mem_hdr_t)) / size) return NULL;
+    return account(calloc(1, sizeof(mem_hdr_t) + count * size), tag, count * size);
+}
+
+void *mem_realloc(mem_tag_t tag, void *p, size_t size)
+{
+    if (!p) return mem_alloc(tag, size);
+    if (size > (size_t)-1 - sizeof(mem_hdr_t)) return NULL;
+
+    mem_hdr_t *old = (mem_hdr_t *)p - 1;
+    size_t old_size = old->h.size;
+    int old_tag = old->h.tag;
+    mem_hdr_t *h = realloc(old, sizeof(mem_hdr_t) + size);
+    if (!h) return NULL; // the old block is untouched
+
+    stats[old_tag].live -= old_size;
+    stats[old_tag].blocks--;
+    return account(h, tag, size);
+}
+
+char *mem_strdup(mem_tag_t tag, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = mem_alloc(tag, len);
+    if (copy) memcpy(copy, s, len);
+    return copy;
+}
+
+void mem_free(void *p)
+{
+    if (!p) return;
+    mem_hdr_t *h = (mem_hdr_t *)p - 1;
+    stats[h->h.tag].live -= h->h.size;
+    stats[h->h.tag].blocks--;
+    free(h);
+}
+
+void mem_line_begin()
+{
+    for (int i = 0; i < MEM_TAGS; ++i) stats[i].line_start = stats[i].allocs;
+}
+
+void mem_line_done()
+{
+    lines++;
+    for (int i = 0; i < MEM_TAGS; ++i)
+    {
+        stats[i].last_line = stats[i].allocs - stats[i].line_start;
+        stats[i].line_total += stats[i].last_line;
+    }
+}
+
+static const char *format_bytes(size_t n, char *out, size_t size)
+{
+    if (n < 10 * 1024) snprintf(out, size, "%zu B", n);
+    else if (n < 10 * 1024 * 1024) snprintf(out, size, "%.1f KB", n / 1024.0);
+    else snprintf(out, size, "%.1f MB", n / (1024.0 * 1024.0));
+    return out;
+}
+
+void mem_print_stats()
+{
+    char live[32], peak[32];
+    mem_stat_t total = {0};
+
+    printf("%-10s %10s %10s %8s %10s %9s %9s\n", "subsystem", "live", "peak", "blocks", "allocs", "last line", "avg/line");
+    for (int i = 0; i <= MEM_TAGS; ++i)
+    {
+        const mem_stat_t *s = i < MEM_TAGS ? &stats[i] : &total;
+        printf("%-10s %10s %10s %8zu %10llu %9llu %9.1f\n",
+               i < MEM_TAGS ? tag_names[i] : "total",
+               format_bytes(s->live, live, sizeof(live)),
+               i < MEM_TAGS ? format_bytes(s->peak, peak, sizeof(peak)) : "-", // peaks of different moments do not add up
+               s->blocks, s->allocs, s->last_line,
+               lines ? (double)s->line_total / lines : 0.0);
+        if (i < MEM_TAGS)
+        {
+            total.live += s->live;
+            total.blocks += s->blocks;
+            total.allocs += s->allocs;
+            total.last_line += s->last_line;
+            total.line_total += s->line_total;
+        }
+    }
+    printf("%llu lines run\n", lines);
+}
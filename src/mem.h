@@ -0,0 +1,37 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+
+/*
+ * Allocation accounting. The lexer, parser, alias table, history, job table,
+ * function table and the executor's expanded words allocate through these
+ * wrappers, which keep live bytes, peak and allocation counts per subsystem;
+ * `memstats` prints them.
+ *
+ * A block from mem_alloc() must be released with mem_free(), never free().
+ * The counters are plain integers: these subsystems run on the main thread.
+ */
+typedef enum
+{
+    MEM_LEXER,
+    MEM_PARSER,
+    MEM_ALIAS,
+    MEM_HISTORY,
+    MEM_JOBS,
+    MEM_EXEC,
+    MEM_FUNCS,
+    MEM_TAGS
+} mem_tag_t;
+
+void *mem_alloc(mem_tag_t tag, size_t size);
+void *mem_calloc(mem_tag_t tag, size_t count, size_t size);
+void *mem_realloc(mem_tag_t tag, void *p, size_t size);
+char *mem_strdup(mem_tag_t tag, const char *s);
+void mem_free(void *p);
+
+void mem_line_begin();  // around each command line, for the per-line counts
+void mem_line_done();
+void mem_print_stats();
+
+#endif // MEM_H
@@ -1,43 +1,140 @@
 #include "foxy.h"
+#include "arith.h"
+#include "mem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+
+static int parse_error; // a syntax error was reported
+static int parse_more;  // the tokens ended inside a for/while/until/if
 
 /* Parser helpers */
 static node_t *new_node(node_type_t type)
 {
-    node_t *n = calloc(1, sizeof(node_t));
-    if (!n) { fprintf(stderr, "foxy: OOM\n"); return NULL; }
+    node_t *n = mem_calloc(MEM_PARSER, 1, sizeof(node_t));
+    if (!n) { fprintf(stderr, "foxy: OOM\n"); parse_error = 1; return NULL; }
     n->type = type;
     return n;
 }
 
+static void free_words(char **words)
+{
+    if (!words) return;
+    for (int i = 0; words[i]; ++i) mem_free(words[i]);
+    mem_free(words);
+}
+
 void free_ast(node_t *node)
 {
     if (!node) return;
     if (node->type == NODE_CMD)
     {
-        if (node->cmd.args)
-        {
-            for (int i = 0; node->cmd.args[i]; ++i) free(node->cmd.args[i]);
-            free(node->cmd.args);
-        }
-        if (node->cmd.infile) free(node->cmd.infile);
-        if (node->cmd.outfile) free(node->cmd.outfile);
+        free_words(node->cmd.args);
+        if (node->cmd.infile) mem_free(node->cmd.infile);
+        if (node->cmd.outfile) mem_free(node->cmd.outfile);
+    }
+    else if (node->type >= NODE_FOR)
+    {
+        free_ast(node->ctl.cond);
+        free_ast(node->ctl.body);
+        free_ast(node->ctl.other);
+        mem_free(node->ctl.var);
+        free_words(node->ctl.words);
+        mem_free(node->ctl.infile);
+        mem_free(node->ctl.outfile);
     }
     else
     {
         free_ast(node->binary.left);
         free_ast(node->binary.right);
     }
-    free(node);
+    mem_free(node);
+}
+
+static char *copy_str(const char *s, int *ok)
+{
+    if (!s || !*ok) return NULL;
+    char *c = mem_strdup(MEM_PARSER, s);
+    if (!c) *ok = 0;
+    return c;
+}
+
+static char **copy_words(char **words, int *ok)
+{
+    if (!words || !*ok) return NULL;
+    size_t n = 0;
+    while (words[n]) n++;
+    char **c = mem_calloc(MEM_PARSER, n + 1, sizeof(char *));
+    if (!c) { *ok = 0; return NULL; }
+    for (size_t i = 0; i < n && *ok; ++i) c[i] = copy_str(words[i], ok);
+    return c;
+}
+
+static node_t *copy_child(const node_t *node, int *ok)
+{
+    if (!node || !*ok) return NULL;
+    node_t *c = copy_ast(node);
+    if (!c) *ok = 0;
+    return c;
+}
+
+// Deep copy, so a function body outlives the line that defined it
+node_t *copy_ast(const node_t *node)
+{
+    if (!node) return NULL;
+    node_t *n = mem_calloc(MEM_PARSER, 1, sizeof(node_t));
+    if (!n) return NULL;
+    n->type = node->type;
+    int ok = 1;
+    if (node->type == NODE_CMD)
+    {
+        n->cmd.append_out = node->cmd.append_out;
+        n->cmd.bg_mode = node->cmd.bg_mode;
+        n->cmd.expand = node->cmd.expand;
+        n->cmd.args = copy_words(node->cmd.args, &ok);
+        n->cmd.infile = copy_str(node->cmd.infile, &ok);
+        n->cmd.outfile = copy_str(node->cmd.outfile, &ok);
+    }
+    else if (node->type >= NODE_FOR)
+    {
+        n->ctl.append_out = node->ctl.append_out;
+        n->ctl.bg_mode = node->ctl.bg_mode;
+        n->ctl.cond = copy_child(node->ctl.cond, &ok);
+        n->ctl.body = copy_child(node->ctl.body, &ok);
+        n->ctl.other = copy_child(node->ctl.other, &ok);
+        n->ctl.var = copy_str(node->ctl.var, &ok);
+        n->ctl.words = copy_words(node->ctl.words, &ok);
+        n->ctl.infile = copy_str(node->ctl.infile, &ok);
+        n->ctl.outfile = copy_str(node->ctl.outfile, &ok);
+    }
+    else
+    {
+        n->binary.bg_mode = node->binary.bg_mode;
+        n->binary.left = copy_child(node->binary.left, &ok);
+        n->binary.right = copy_child(node->binary.right, &ok);
+    }
+    if (!ok)
+    {
+        free_ast(n);
+        return NULL;
+    }
+    return n;
 }
 
-/* 
+/*
  * Grammar:
  *  list     -> pipeline { (';' | '&' | '&&' | '||') pipeline }
  *  pipeline -> command { '|' command }
- *  command  -> WORD { WORD | REDIR }
+ *  command  -> compound { REDIR } | WORD { WORD | REDIR }
+ *  compound -> 'for' NAME 'in' { WORD } ';' 'do' list 'done'
+ *            | ('while' | 'until') list 'do' list 'done'
+ *            | 'if' list 'then' list { 'elif' list 'then' list } [ 'else' list ] 'fi'
+ *            | NAME '()' '{' list '}'
+ *
+ * Keywords count only where a command would start, so `echo done` is an
+ * ordinary command. Empty commands between separators are skipped, which
+ * lets a newline (";" from the lexer) follow do, then or else.
  */
 
 
@@ -47,10 +144,78 @@ static int is_op(const char *s)
     return (strcmp(s, ";") == 0 || strcmp(s, "&&") == 0 || strcmp(s, "||") == 0 || strcmp(s, "|") == 0);
 }
 
+static int is_redir(const char *s)
+{
+    return (strcmp(s, "<") == 0 || strcmp(s, ">") == 0 || strcmp(s, ">>") == 0);
+}
+
+// Keywords that close a list: do, done, then, elif, else, fi, }
+static int ends_list(const char *s)
+{
+    return (strcmp(s, "do") == 0 || strcmp(s, "done") == 0 || strcmp(s, "then") == 0 ||
+            strcmp(s, "elif") == 0 || strcmp(s, "else") == 0 || strcmp(s, "fi") == 0 ||
+            strcmp(s, "}") == 0);
+}
+
+static int is_name(const char *s)
+{
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') return 0;
+    for (; *s; ++s)
+    {
+        if (!isalnum((unsigned char)*s) && *s != '_') return 0;
+    }
+    return 1;
+}
+
+static int ends_with(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+    return n > m && strcmp(s + n - m, suffix) == 0;
+}
+
+// name() {, name () { or name(){
+static int is_func_def(char **tokens, int pos, int count)
+{
+    return ends_with(tokens[pos], "()") || ends_with(tokens[pos], "(){") ||
+           (pos + 1 < count && strcmp(tokens[pos + 1], "()") == 0);
+}
+
+static void syntax_error(char **tokens, int pos, int count)
+{
+    if (pos >= count) fprintf(stderr, "foxy: syntax error: unexpected end of input\n");
+    else fprintf(stderr, "foxy: syntax error near %s\n", tokens[pos]);
+    parse_error = 1;
+}
+
+// Consume the keyword kw; running out of tokens means more lines are needed
+static int expect(char **tokens, int *pos, int count, const char *kw)
+{
+    if (*pos >= count)
+    {
+        parse_more = 1;
+        return 0;
+    }
+    if (strcmp(tokens[*pos], kw) != 0)
+    {
+        syntax_error(tokens, *pos, count);
+        return 0;
+    }
+    (*pos)++;
+    return 1;
+}
+
+static void skip_separators(char **tokens, int *pos, int count)
+{
+    while (*pos < count && strcmp(tokens[*pos], ";") == 0) (*pos)++;
+}
+
 static node_t *parse_pipeline(char **tokens, int *pos, int count);
 
 static node_t *parse_list(char **tokens, int *pos, int count)
 {
+    skip_separators(tokens, pos, count);
+    if (*pos >= count || ends_list(tokens[*pos])) return NULL; // empty
+
     node_t *left = parse_pipeline(tokens, pos, count);
     if (!left) return NULL;
 
@@ -62,8 +227,10 @@ static node_t *parse_list(char **tokens, int *pos, int count)
             (*pos)++;
             node_t *right = NULL;
             if (*pos < count) right = parse_list(tokens, pos, count);
-            
+            if (!right) break; // nothing after it, e.g. "ls;" or "ls; done"
+
             node_t *seq = new_node(NODE_SEQ);
+            if (!seq) { free_ast(right); break; }
             seq->binary.left = left;
             seq->binary.right = right;
             left = seq;
@@ -72,9 +239,10 @@ static node_t *parse_list(char **tokens, int *pos, int count)
         {
             (*pos)++;
             node_t *right = parse_pipeline(tokens, pos, count);
-            if (!right) { fprintf(stderr, "foxy: syntax error near &&\n"); free_ast(left); return NULL; }
-            
+            if (!right) { if (!parse_error && !parse_more) { fprintf(stderr, "foxy: syntax error near &&\n"); parse_error = 1; } break; }
+
             node_t *and_n = new_node(NODE_AND);
+            if (!and_n) { free_ast(right); break; }
             and_n->binary.left = left;
             and_n->binary.right = right;
             left = and_n;
@@ -83,9 +251,10 @@ static node_t *parse_list(char **tokens, int *pos, int count)
         {
             (*pos)++;
             node_t *right = parse_pipeline(tokens, pos, count);
-            if (!right) { fprintf(stderr, "foxy: syntax error near ||\n"); free_ast(left); return NULL; }
-            
+            if (!right) { if (!parse_error && !parse_more) { fprintf(stderr, "foxy: syntax error near ||\n"); parse_error = 1; } break; }
+
             node_t *or_n = new_node(NODE_OR);
+            if (!or_n) { free_ast(right); break; }
             or_n->binary.left = left;
             or_n->binary.right = right;
             left = or_n;
@@ -93,24 +262,25 @@ static node_t *parse_list(char **tokens, int *pos, int count)
         else if (strcmp(op, "&") == 0) // Background at list level (or end of command)
         {
              (*pos)++;
-             // For now, mark left as background. 
+             // For now, mark left as background.
              // If left is a binary node, we might need to propagate or wrap.
              // Simplest: set flag on the node if possible or rely on top-level execution.
              // But existing struct has is_background in cmd and binary.
              if (left->type == NODE_CMD) left->cmd.bg_mode = 1;
+             else if (left->type >= NODE_FOR) left->ctl.bg_mode = 1;
              else left->binary.bg_mode = 1;
-             
-             // If there are more commands after &, treat as sequence? 
+
+             // If there are more commands after &, treat as sequence?
 
              // e.g. "sleep 1 & echo done" -> treated as sequence where left is bg.
-             if (*pos < count)
-             {
-                 node_t *right = parse_list(tokens, pos, count);
-                 node_t *seq = new_node(NODE_SEQ);
-                 seq->binary.left = left;
-                 seq->binary.right = right;
-                 left = seq;
-             }
+             node_t *right = NULL;
+             if (*pos < count) right = parse_list(tokens, pos, count);
+             if (!right) break;
+             node_t *seq = new_node(NODE_SEQ);
+             if (!seq) { free_ast(right); break; }
+             seq->binary.left = left;
+             seq->binary.right = right;
+             left = seq;
         }
         else
         {
@@ -120,25 +290,241 @@ static node_t *parse_list(char **tokens, int *pos, int count)
     return left;
 }
 
-static node_t *parse_pipeline(char **tokens, int *pos, int count)
+static int has_var(const char *s)
+{
+    return strpbrk(s, (const char[]){ LEX_VAR, LEX_ARITH, LEX_GLOB, LEX_BRACE, LEX_SUBST, '\0' }) != NULL;
+}
+
+/*
+ * A word as the command keeps it: a constant $((...)) becomes its value and
+ * one with constant parts keeps them computed, so a loop body does that
+ * arithmetic once. A partly folded expression is only kept if it is no
+ * longer than the original.
+ */
+static char *copy_word(const char *t)
+{
+    if (!strchr(t, LEX_ARITH)) return mem_strdup(MEM_PARSER, t);
+
+    size_t segments = 0;
+    for (const char *c = t; (c = strchr(c, LEX_ARITH)); ++c) segments++;
+    char *w = mem_alloc(MEM_PARSER, strlen(t) + 1 + segments * 24); // room for the numbers
+    if (!w) return NULL;
+
+    char folded[1024];
+    size_t n = 0;
+    while (*t)
+    {
+        const char *start = strchr(t, LEX_ARITH);
+        size_t plain = start ? (size_t)(start - t) : strlen(t);
+        memcpy(w + n, t, plain);
+        n += plain;
+        if (!start) break;
+
+        const char *end = strchr(start + 1, LEX_ARITH);
+        if (!end) end = start + strlen(start) - 1;
+        size_t len = (size_t)(end - start - 1);
+        int r = arith_fold(start + 1, len, folded, sizeof(folded));
+        size_t flen = r ? strlen(folded) : 0;
+        if (r == 2 || (r == 1 && flen <= len))
+        {
+            if (r == 1) w[n++] = LEX_ARITH;
+            memcpy(w + n, folded, flen);
+            n += flen;
+            if (r == 1) w[n++] = LEX_ARITH;
+        }
+        else
+        {
+            memcpy(w + n, start, len + 2);
+            n += len + 2;
+        }
+        t = end + 1;
+    }
+    w[n] = '\0';
+    return w;
+}
+
+// for NAME in WORDS; do BODY done (the "for" already consumed)
+static node_t *parse_for(char **tokens, int *pos, int count)
+{
+    node_t *n = new_node(NODE_FOR);
+    if (!n) return NULL;
+
+    if (*pos >= count) { parse_more = 1; return n; }
+    const char *name = tokens[*pos];
+    if (!is_name(name))
+    {
+        fprintf(stderr, "foxy: for: '%s' is not a valid variable name\n", name);
+        parse_error = 1;
+        return n;
+    }
+    n->ctl.var = mem_strdup(MEM_PARSER, name);
+    (*pos)++;
+    if (!expect(tokens, pos, count, "in")) return n;
+
+    int start = *pos;
+    while (*pos < count && strcmp(tokens[*pos], ";") != 0) (*pos)++;
+    n->ctl.words = mem_alloc(MEM_PARSER, sizeof(char *) * (*pos - start + 1));
+    if (!n->ctl.var || !n->ctl.words) { parse_error = 1; return n; }
+    for (int i = start; i < *pos; ++i) n->ctl.words[i - start] = copy_word(tokens[i]);
+    n->ctl.words[*pos - start] = NULL;
+
+    skip_separators(tokens, pos, count);
+    if (!expect(tokens, pos, count, "do")) return n;
+    n->ctl.body = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.body && *pos < count) { syntax_error(tokens, *pos, count); return n; }
+    expect(tokens, pos, count, "done");
+    return n;
+}
+
+// while/until COND do BODY done (the keyword already consumed)
+static node_t *parse_while(node_type_t type, char **tokens, int *pos, int count)
+{
+    node_t *n = new_node(type);
+    if (!n) return NULL;
+
+    n->ctl.cond = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.cond) { if (*pos < count) syntax_error(tokens, *pos, count); else parse_more = 1; return n; }
+    if (!expect(tokens, pos, count, "do")) return n;
+    n->ctl.body = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.body && *pos < count) { syntax_error(tokens, *pos, count); return n; }
+    expect(tokens, pos, count, "done");
+    return n;
+}
+
+// After "if" or "elif": COND then BODY, then elif (a nested NODE_IF that
+// consumes the fi), else, or fi
+static node_t *parse_if(char **tokens, int *pos, int count)
+{
+    node_t *n = new_node(NODE_IF);
+    if (!n) return NULL;
+
+    n->ctl.cond = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.cond) { if (*pos < count) syntax_error(tokens, *pos, count); else parse_more = 1; return n; }
+    if (!expect(tokens, pos, count, "then")) return n;
+    n->ctl.body = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.body && *pos < count) { syntax_error(tokens, *pos, count); return n; }
+
+    if (*pos < count && strcmp(tokens[*pos], "elif") == 0)
+    {
+        (*pos)++;
+        n->ctl.other = parse_if(tokens, pos, count);
+        return n;
+    }
+    if (*pos < count && strcmp(tokens[*pos], "else") == 0)
+    {
+        (*pos)++;
+        n->ctl.other = parse_list(tokens, pos, count);
+        if (parse_error || parse_more) return n;
+        if (!n->ctl.other && *pos < count) { syntax_error(tokens, *pos, count); return n; }
+    }
+    expect(tokens, pos, count, "fi");
+    return n;
+}
+
+// NAME() { BODY } (the name, "()" and perhaps "{" in word)
+static node_t *parse_function(char *word, char **tokens, int *pos, int count)
+{
+    node_t *n = new_node(NODE_FUNC);
+    if (!n) return NULL;
+
+    size_t len = strlen(word);
+    int brace = ends_with(word, "(){");
+    if (brace) len -= 3;
+    else if (ends_with(word, "()")) len -= 2;
+    else (*pos)++; // the separate "()"
+
+    n->ctl.var = mem_alloc(MEM_PARSER, len + 1);
+    if (!n->ctl.var) { parse_error = 1; return n; }
+    memcpy(n->ctl.var, word, len);
+    n->ctl.var[len] = '\0';
+    if (!is_name(n->ctl.var) || is_keyword(n->ctl.var, len))
+    {
+        fprintf(stderr, "foxy: '%s' is not a valid function name\n", n->ctl.var);
+        parse_error = 1;
+        return n;
+    }
+    if (is_builtin(n->ctl.var))
+    {
+        fprintf(stderr, "foxy: %s: is a builtin\n", n->ctl.var); // it would never be called
+        parse_error = 1;
+        return n;
+    }
+
+    if (!brace)
+    {
+        skip_separators(tokens, pos, count);
+        if (!expect(tokens, pos, count, "{")) return n;
+    }
+    n->ctl.body = parse_list(tokens, pos, count);
+    if (parse_error || parse_more) return n;
+    if (!n->ctl.body) { if (*pos < count) syntax_error(tokens, *pos, count); else parse_more = 1; return n; }
+    expect(tokens, pos, count, "}");
+    return n;
+}
+
+static node_t *parse_compound(char **tokens, int *pos, int count)
+{
+    char *kw = tokens[(*pos)++];
+    node_t *n;
+    if (strcmp(kw, "for") == 0) n = parse_for(tokens, pos, count);
+    else if (strcmp(kw, "while") == 0) n = parse_while(NODE_WHILE, tokens, pos, count);
+    else if (strcmp(kw, "until") == 0) n = parse_while(NODE_UNTIL, tokens, pos, count);
+    else if (strcmp(kw, "if") == 0) n = parse_if(tokens, pos, count);
+    else n = parse_function(kw, tokens, pos, count);
+    if (!n || parse_error || parse_more)
+    {
+        free_ast(n);
+        return NULL;
+    }
+
+    // Redirections of the whole loop or if: done > out.txt
+    while (n->type != NODE_FUNC && *pos < count && is_redir(tokens[*pos]))
+    {
+        char *t = tokens[(*pos)++];
+        if (*pos >= count || is_op(tokens[*pos]) || is_redir(tokens[*pos]) || strcmp(tokens[*pos], "&") == 0)
+        {
+            fprintf(stderr, "foxy: syntax error near %s\n", t);
+            parse_error = 1;
+            free_ast(n);
+            return NULL;
+        }
+        char **slot = strcmp(t, "<") == 0 ? &n->ctl.infile : &n->ctl.outfile;
+        mem_free(*slot);
+        *slot = mem_strdup(MEM_PARSER, tokens[(*pos)++]);
+        if (strcmp(t, "<") != 0) n->ctl.append_out = strcmp(t, ">>") == 0;
+    }
+    if (*pos < count && !is_op(tokens[*pos]) && strcmp(tokens[*pos], "&") != 0)
+    {
+        syntax_error(tokens, *pos, count); // e.g. "done extra"
+        free_ast(n);
+        return NULL;
+    }
+    return n;
+}
+
+static node_t *parse_simple(char **tokens, int *pos, int count)
 {
-    // Parse command first
-    // If next is |, consume and recurse
-    
     // Command parsing: consume words until op or end
     int start = *pos;
     int end = start;
-    
+
     while (end < count && !is_op(tokens[end]) && strcmp(tokens[end], "&") != 0 && strcmp(tokens[end], ")") != 0)
     {
         end++;
     }
-    
+
     if (start == end) return NULL; // No command found?
-    
+    if (ends_list(tokens[start])) { syntax_error(tokens, start, count); return NULL; }
+
     // Build CMD node
     node_t *cmd = new_node(NODE_CMD);
-    
+    if (!cmd) return NULL;
+
     // Pass 1: count args and handle redir
     int argc = 0;
     for (int i = start; i < end; ++i)
@@ -146,56 +532,94 @@ static node_t *parse_pipeline(char **tokens, int *pos, int count)
         char *t = tokens[i];
         if (strcmp(t, "<") == 0)
         {
-            if (i + 1 < end) { cmd->cmd.infile = strdup(tokens[++i]); }
-            else { fprintf(stderr, "foxy: syntax error near <\n"); free_ast(cmd); *pos = end; return NULL; }
+            if (i + 1 < end) { cmd->cmd.infile = mem_strdup(MEM_PARSER, tokens[++i]); }
+            else { fprintf(stderr, "foxy: syntax error near <\n"); parse_error = 1; free_ast(cmd); *pos = end; return NULL; }
         }
         else if (strcmp(t, ">") == 0)
         {
-            if (i + 1 < end) { cmd->cmd.outfile = strdup(tokens[++i]); cmd->cmd.append_out = 0; }
-            else { fprintf(stderr, "foxy: syntax error near >\n"); free_ast(cmd); *pos = end; return NULL; }
+            if (i + 1 < end) { cmd->cmd.outfile = mem_strdup(MEM_PARSER, tokens[++i]); cmd->cmd.append_out = 0; }
+            else { fprintf(stderr, "foxy: syntax error near >\n"); parse_error = 1; free_ast(cmd); *pos = end; return NULL; }
         }
         else if (strcmp(t, ">>") == 0)
         {
-            if (i + 1 < end) { cmd->cmd.outfile = strdup(tokens[++i]); cmd->cmd.append_out = 1; }
-            else { fprintf(stderr, "foxy: syntax error near >>\n"); free_ast(cmd); *pos = end; return NULL; }
+            if (i + 1 < end) { cmd->cmd.outfile = mem_strdup(MEM_PARSER, tokens[++i]); cmd->cmd.append_out = 1; }
+            else { fprintf(stderr, "foxy: syntax error near >>\n"); parse_error = 1; free_ast(cmd); *pos = end; return NULL; }
         }
         else
         {
             argc++;
         }
     }
-    
-    cmd->cmd.args = malloc(sizeof(char*) * (argc + 1));
+    if ((cmd->cmd.infile && has_var(cmd->cmd.infile)) || (cmd->cmd.outfile && has_var(cmd->cmd.outfile))) cmd->cmd.expand = 1;
+
+    cmd->cmd.args = mem_alloc(MEM_PARSER, sizeof(char*) * (argc + 1));
+    if (!cmd->cmd.args) { parse_error = 1; free_ast(cmd); *pos = end; return NULL; }
     int ai = 0;
     for (int i = start; i < end; ++i)
     {
         char *t = tokens[i];
         if (strcmp(t, "<") == 0 || strcmp(t, ">") == 0 || strcmp(t, ">>") == 0) { i++; continue; }
-        cmd->cmd.args[ai++] = strdup(t);
+        cmd->cmd.args[ai] = copy_word(t);
+        if (cmd->cmd.args[ai] && has_var(cmd->cmd.args[ai])) cmd->cmd.expand = 1;
+        ai++;
     }
     cmd->cmd.args[argc] = NULL;
-    
+
     *pos = end;
-    
+    return cmd;
+}
+
+static node_t *parse_pipeline(char **tokens, int *pos, int count)
+{
+    // Parse command first
+    // If next is |, consume and recurse
+    const char *first = *pos < count ? tokens[*pos] : "";
+    node_t *cmd;
+    if (strcmp(first, "for") == 0 || strcmp(first, "while") == 0 || strcmp(first, "until") == 0 || strcmp(first, "if") == 0 ||
+        (*pos < count && is_func_def(tokens, *pos, count)))
+    {
+        cmd = parse_compound(tokens, pos, count);
+    }
+    else
+    {
+        cmd = parse_simple(tokens, pos, count);
+    }
+    if (!cmd) return NULL;
+
     // Check for Pipe
     if (*pos < count && strcmp(tokens[*pos], "|") == 0)
     {
         (*pos)++;
         node_t *right = parse_pipeline(tokens, pos, count);
-        if (!right) { fprintf(stderr, "foxy: syntax error near |\n"); free_ast(cmd); return NULL; }
-        
+        if (!right) { if (!parse_error && !parse_more) { fprintf(stderr, "foxy: syntax error near |\n"); parse_error = 1; } free_ast(cmd); return NULL; }
+
         node_t *pipe = new_node(NODE_PIPE);
+        if (!pipe) { free_ast(cmd); free_ast(right); return NULL; }
         pipe->binary.left = cmd;
         pipe->binary.right = right;
         return pipe;
     }
-    
+
     return cmd;
 }
 
 node_t *parse_tokens(token_list_t *tokens)
 {
+    parse_error = parse_more = 0;
     if (!tokens || !tokens->items || tokens->count == 0) return NULL;
     int pos = 0;
-    return parse_list(tokens->items, &pos, tokens->count);
+    int count = (int)tokens->count;
+    node_t *ast = parse_list(tokens->items, &pos, count);
+    if (!parse_error && !parse_more && pos < count) syntax_error(tokens->items, pos, count); // a stray done, fi, ...
+    if (parse_error || parse_more)
+    {
+        free_ast(ast);
+        return NULL;
+    }
+    return ast;
+}
+
+int parse_needs_more()
+{
+    return parse_more && !parse_error;
 }
@@ -0,0 +1,306 @@
+#include "prompt.h"
+#include "foxy.h"
+#include "timing.h"
+#include "trace.h"
+#include "worker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define NULL_DEVICE "nul"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#define MAX_PROMPT 4096
+#define MAX_SEGMENTS 64
+
+typedef enum
+{
+    SEG_TEXT,
+    SEG_CWD,
+    SEG_STATUS,
+    SEG_DURATION,
+    SEG_GIT,
+    SEG_GITDIRTY
+} seg_kind_t;
+
+typedef struct
+{
+    seg_kind_t kind;
+    size_t off, len;      // SEG_TEXT: a run of seg_text
+} segment_t;
+
+// Longer names first, so $GITDIRTY is not read as $GIT + "DIRTY"
+static const struct
+{
+    const char *name;
+    seg_kind_t kind;
+} seg_names[] =
+{
+    { "$CWD", SEG_CWD },
+    { "$STATUS", SEG_STATUS },
+    { "$DURATION", SEG_DURATION },
+    { "$GITDIRTY", SEG_GITDIRTY },
+    { "$GIT", SEG_GIT },
+};
+
+static char seg_text[MAX_PROMPT];
+static segment_t segs[MAX_SEGMENTS];
+static int seg_count = -1;  // -1 = not compiled yet
+static int uses_git, uses_dirty;
+
+static char prompt_buf[2 * MAX_PROMPT];
+static char cwd[PATH_MAX];
+static int last_status;
+static uint64_t last_duration_us;
+static int have_last;
+
+/*
+ * Git state is read on the worker thread and shown stale-while-revalidate:
+ * the prompt always uses whatever result it has (as long as cwd is still
+ * inside that repository) and asks for a fresh one after every command or
+ * change of directory. A result the worker finishes while the prompt is up
+ * shows at the next prompt.
+ */
+typedef struct
+{
+    char dir[PATH_MAX];   // where it was asked for
+    char root[PATH_MAX];  // work tree root; empty outside a repository
+    char branch[128];
+    int dirty;
+    int want_dirty;
+} git_info_t;
+
+static _Atomic(git_info_t *) git_ready;
+static atomic_int git_busy;
+static git_info_t *git_shown;
+static int git_stale = 1;
+
+void set_prompt_format(const char *fmt)
+{
+    if (!fmt) return;
+
+    size_t t = 0;
+    int n = 0;
+    uses_git = uses_dirty = 0;
+    const char *p = fmt;
+    while (*p && t < sizeof(seg_text) - 1)
+    {
+        size_t k = 0;
+        if (*p == '$' && n < MAX_SEGMENTS - 2)
+        {
+            while (k < sizeof(seg_names) / sizeof(seg_names[0]) &&
+                   strncmp(p, seg_names[k].name, strlen(seg_names[k].name)) != 0) k++;
+        }
+        if (*p == '$' && k < sizeof(seg_names) / sizeof(seg_names[0]))
+        {
+            segs[n++] = (segment_t){ seg_names[k].kind, 0, 0 };
+            if (seg_names[k].kind == SEG_GIT) uses_git = 1;
+            if (seg_names[k].kind == SEG_GITDIRTY) uses_git = uses_dirty = 1;
+            p += strlen(seg_names[k].name);
+            continue;
+        }
+
+        char c = *p++;
+        if (c == '\\' && *p == 'n')
+        {
+            c = '\n';
+            p++;
+        }
+        // Extend the text segment in progress, or start one
+        if (n > 0 && segs[n - 1].kind == SEG_TEXT && segs[n - 1].off + segs[n - 1].len == t)
+        {
+            segs[n - 1].len++;
+        }
+        else if (n < MAX_SEGMENTS)
+        {
+            segs[n++] = (segment_t){ SEG_TEXT, t, 1 };
+        }
+        else break;
+        seg_text[t++] = c;
+    }
+    seg_count = n;
+    git_stale = 1;
+}
+
+void prompt_cwd_changed()
+{
+    if (!getcwd(cwd, sizeof(cwd))) snprintf(cwd, sizeof(cwd), "unknown");
+    git_stale = 1;
+}
+
+void prompt_command_done(int status, uint64_t duration_us)
+{
+    last_status = status;
+    last_duration_us = duration_us;
+    have_last = 1;
+    git_stale = 1;
+}
+
+// Directory holding .git at or above dir, and the git directory itself
+static int git_find(const char *dir, char *root, size_t root_size, char *gitdir, size_t gitdir_size)
+{
+    snprintf(root, root_size, "%s", dir);
+    while (1)
+    {
+        struct stat st;
+        snprintf(gitdir, gitdir_size, "%s/.git", root);
+        if (stat(gitdir, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode)) return 0;
+            // Worktrees and submodules: a file with "gitdir: <path>"
+            FILE *fp = fopen(gitdir, "r");
+            char line[PATH_MAX];
+            int ok = fp && fgets(line, sizeof(line), fp) && strncmp(line, "gitdir: ", 8) == 0;
+            if (fp) fclose(fp);
+            if (!ok) return -1;
+            line[strcspn(line, "\r\n")] = '\0';
+            const char *target = line + 8;
+            int absolute = target[0] == '/' || target[0] == '\\' || (target[0] && target[1] == ':');
+            if (absolute) snprintf(gitdir, gitdir_size, "%s", target);
+            else snprintf(gitdir, gitdir_size, "%s/%s", root, target);
+            return 0;
+        }
+        char *slash = strrchr(root, '/');
+#ifdef _WIN32
+        char *bslash = strrchr(root, '\\');
+        if (bslash > slash) slash = bslash;
+#endif
+        if (!slash || slash == root || (slash == root + 2 && root[1] == ':')) return -1;
+        *slash = '\0';
+    }
+}
+
+static void git_job(void *arg)
+{
+    git_info_t *g = arg;
+    char gitdir[PATH_MAX + 8];
+    uint64_t t = TRACE_START();
+
+    if (git_find(g->dir, g->root, sizeof(g->root), gitdir, sizeof(gitdir)) != 0)
+    {
+        g->root[0] = '\0';
+    }
+    else
+    {
+        char head_path[PATH_MAX + 16], head[256] = "";
+        snprintf(head_path, sizeof(head_path), "%s/HEAD", gitdir);
+        FILE *fp = fopen(head_path, "r");
+        if (fp)
+        {
+            if (!fgets(head, sizeof(head), fp)) head[0] = '\0';
+            fclose(fp);
+        }
+        head[strcspn(head, "\r\n")] = '\0';
+        if (strncmp(head, "ref: refs/heads/", 16) == 0) snprintf(g->branch, sizeof(g->branch), "%s", head + 16);
+        else snprintf(g->branch, sizeof(g->branch), "%.7s", head); // detached
+
+        // Tracked files only: untracked scans are what is slow in big trees
+        if (g->want_dirty && !strchr(g->root, '"'))
+        {
+            char cmd[PATH_MAX + 128];
+            snprintf(cmd, sizeof(cmd), "git -C \"%s\" --no-optional-locks status --porcelain -uno 2>" NULL_DEVICE, g->root);
+            FILE *pp = popen(cmd, "r");
+            if (pp)
+            {
+                char line[64];
+                g->dirty = fgets(line, sizeof(line), pp) != NULL;
+                while (fgets(line, sizeof(line), pp)) {}
+                pclose(pp);
+            }
+        }
+    }
+
+    TRACE_SPAN("git", t, g->root);
+    git_info_t *old = atomic_exchange(&git_ready, g);
+    free(old);
+    atomic_store(&git_busy, 0);
+}
+
+static int in_repo(const git_info_t *g)
+{
+    size_t n = strlen(g->root);
+    return n > 0 && strncmp(cwd, g->root, n) == 0 && (cwd[n] == '\0' || cwd[n] == '/' || cwd[n] == '\\');
+}
+
+static void git_update()
+{
+    git_info_t *fresh = atomic_exchange(&git_ready, NULL);
+    if (fresh)
+    {
+        free(git_shown);
+        git_shown = fresh;
+    }
+
+    int moved = !git_shown || strcmp(git_shown->dir, cwd) != 0;
+    if (!(git_stale || moved) || atomic_load(&git_busy)) return;
+
+    git_info_t *g = calloc(1, sizeof(*g));
+    if (!g) return;
+    snprintf(g->dir, sizeof(g->dir), "%s", cwd);
+    g->want_dirty = uses_dirty;
+    atomic_store(&git_busy, 1);
+    if (worker_submit(git_job, g) != 0)
+    {
+        atomic_store(&git_busy, 0);
+        free(g);
+        return;
+    }
+    git_stale = 0;
+}
+
+static size_t put(size_t n, const char *s, size_t len)
+{
+    size_t cap = sizeof(prompt_buf) - 1;
+    if (len > cap - n) len = cap - n;
+    memcpy(prompt_buf + n, s, len);
+    return n + len;
+}
+
+const char *prompt_render()
+{
+    if (seg_count < 0) set_prompt_format("$CWD> ");
+    if (!cwd[0]) prompt_cwd_changed();
+    if (uses_git) git_update();
+
+    const git_info_t *g = git_shown && in_repo(git_shown) ? git_shown : NULL;
+    size_t n = 0;
+    for (int i = 0; i < seg_count; ++i)
+    {
+        char num[32];
+        switch (segs[i].kind)
+        {
+            case SEG_TEXT:
+                n = put(n, seg_text + segs[i].off, segs[i].len);
+                break;
+            case SEG_CWD:
+                n = put(n, cwd, strlen(cwd));
+                break;
+            case SEG_STATUS:
+                snprintf(num, sizeof(num), "%d", last_status);
+                n = put(n, num, strlen(num));
+                break;
+            case SEG_DURATION:
+                if (!have_last) break;
+                foxy_format_duration(last_duration_us, num, sizeof(num));
+                n = put(n, num, strlen(num));
+                break;
+            case SEG_GIT:
+                if (g) n = put(n, g->branch, strlen(g->branch));
+                break;
+            case SEG_GITDIRTY:
+                if (g && g->dirty) n = put(n, "*", 1);
+                break;
+        }
+    }
+    prompt_buf[n] = '\0';
+    return prompt_buf;
+}
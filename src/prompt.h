@@ -0,0 +1,16 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <stdint.h>
+
+// The prompt for the next line; set_prompt_format() (foxy.h) compiles the
+// format into segments once, so this only copies them out
+const char *prompt_render();
+
+// The $CWD segment is kept, not queried: call after changing directory
+void prompt_cwd_changed();
+
+// Feed $STATUS and $DURATION, and let $GIT know the repo may have changed
+void prompt_command_done(int status, uint64_t duration_us);
+
+#endif // PROMPT_H
@@ -0,0 +1,53 @@
+#include "timing.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+uint64_t foxy_clock_ns()
+{
+#ifdef _WIN32
+    static LONGLONG freq = 0;
+    LARGE_INTEGER now;
+    if (!freq)
+    {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        freq = f.QuadPart;
+    }
+    QueryPerformanceCounter(&now);
+    // Split to avoid overflowing the multiplication on long uptimes
+    return (uint64_t)(now.QuadPart / freq) * 1000000000ull +
+           (uint64_t)(now.QuadPart % freq) * 1000000000ull / (uint64_t)freq;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+int64_t foxy_wall_ms()
+{
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    // FILETIME counts 100ns ticks since 1601-01-01
+    int64_t ticks = ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (ticks - 116444736000000000LL) / 10000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+void foxy_format_duration(uint64_t us, char *out, size_t size)
+{
+    if (us < 1000) snprintf(out, size, "%lluus", (unsigned long long)us);
+    else if (us < 1000000) snprintf(out, size, "%.1fms", us / 1000.0);
+    else if (us < 60000000) snprintf(out, size, "%.2fs", us / 1000000.0);
+    else snprintf(out, size, "%llum%02llus", (unsigned long long)(us / 60000000), (unsigned long long)(us / 1000000 % 60));
+}
@@ -0,0 +1,13 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t foxy_clock_ns(); // monotonic, for measuring intervals
+int64_t foxy_wall_ms();   // milliseconds since the Unix epoch
+
+// "850us", "12.5ms", "3.20s", "2m05s"
+void foxy_format_duration(uint64_t us, char *out, size_t size);
+
+#endif // TIMING_H
@@ -0,0 +1,163 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define TRACE_RING 65536 // events kept; a power of two
+#define MAX_DETAIL 56
+
+typedef struct
+{
+    atomic_ullong seq;    // index + 1 once the slot is fully written
+    const char *name;
+    uint64_t start_ns;
+    uint64_t dur_ns;      // UINT64_MAX for an instant event
+    int tid;
+    char detail[MAX_DETAIL];
+} trace_slot_t;
+
+/*
+ * Writers claim a slot with one fetch_add on ring_head and publish it by
+ * storing its sequence number last, so any thread can trace without a lock.
+ * When the ring wraps, the oldest events are overwritten; the dump skips
+ * slots whose sequence number shows they are mid-write or already reused.
+ */
+atomic_int trace_on;
+static trace_slot_t *ring;
+static atomic_ullong ring_head;
+static atomic_int next_tid;
+static _Thread_local int my_tid;
+static char *exit_path;
+
+void trace_init()
+{
+    const char *v = getenv("FOXY_TRACE");
+    if (!v || !*v || strcmp(v, "0") == 0) return;
+    if (trace_set(1) != 0)
+    {
+        fprintf(stderr, "foxy: trace: out of memory\n");
+        return;
+    }
+    if (strcmp(v, "1") != 0)
+    {
+        exit_path = strdup(v);
+        atexit(trace_exit);
+    }
+}
+
+int trace_set(int on)
+{
+    if (on && !ring)
+    {
+        ring = calloc(TRACE_RING, sizeof(trace_slot_t));
+        if (!ring) return -1;
+    }
+    atomic_store(&trace_on, on);
+    return 0;
+}
+
+void trace_clear()
+{
+    if (!ring) return;
+    for (size_t i = 0; i < TRACE_RING; ++i) atomic_store(&ring[i].seq, 0);
+    atomic_store(&ring_head, 0);
+}
+
+static void trace_put(const char *name, uint64_t start_ns, uint64_t dur_ns, const char *detail)
+{
+    if (!ring) return;
+    if (!my_tid) my_tid = atomic_fetch_add(&next_tid, 1) + 1;
+
+    unsigned long long i = atomic_fetch_add(&ring_head, 1);
+    trace_slot_t *s = &ring[i & (TRACE_RING - 1)];
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->name = name;
+    s->start_ns = start_ns;
+    s->dur_ns = dur_ns;
+    s->tid = my_tid;
+    snprintf(s->detail, sizeof(s->detail), "%s", detail ? detail : "");
+    atomic_store_explicit(&s->seq, i + 1, memory_order_release);
+}
+
+void trace_span(const char *name, uint64_t start_ns, const char *detail)
+{
+    if (start_ns == 0) return; // began before tracing was turned on
+    uint64_t now = foxy_clock_ns();
+    trace_put(name, start_ns, now - start_ns, detail);
+}
+
+void trace_event(const char *name, const char *detail)
+{
+    trace_put(name, foxy_clock_ns(), UINT64_MAX, detail);
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; ++s)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+int trace_dump(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    unsigned long long head = atomic_load(&ring_head);
+    unsigned long long from = head > TRACE_RING ? head - TRACE_RING : 0;
+    int pid = (int)getpid();
+    int first = 1;
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (unsigned long long i = from; ring && i < head; ++i)
+    {
+        trace_slot_t *s = &ring[i & (TRACE_RING - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != i + 1) continue;
+        const char *name = s->name;
+        uint64_t start_ns = s->start_ns, dur_ns = s->dur_ns;
+        int tid = s->tid;
+        char detail[MAX_DETAIL];
+        memcpy(detail, s->detail, sizeof(detail));
+        detail[MAX_DETAIL - 1] = '\0';
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) != i + 1) continue; // overwritten meanwhile
+
+        fprintf(fp, "%s{\"name\":", first ? "" : ",\n");
+        json_string(fp, name);
+        fprintf(fp, ",\"cat\":\"foxy\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", pid, tid, start_ns / 1000.0);
+        if (dur_ns == UINT64_MAX) fprintf(fp, ",\"ph\":\"i\",\"s\":\"t\"");
+        else fprintf(fp, ",\"ph\":\"X\",\"dur\":%.3f", dur_ns / 1000.0);
+        if (detail[0])
+        {
+            fprintf(fp, ",\"args\":{\"detail\":");
+            json_string(fp, detail);
+            fputc('}', fp);
+        }
+        fputc('}', fp);
+        first = 0;
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+void trace_exit()
+{
+    if (!exit_path) return;
+    if (trace_dump(exit_path) != 0) perror("foxy: trace");
+    free(exit_path);
+    exit_path = NULL;
+}
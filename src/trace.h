@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "timing.h"
+
+/*
+ * Execution tracing into an in-memory ring, exported in Chrome trace format
+ * (chrome://tracing, Perfetto). Every trace point is guarded by one relaxed
+ * load and branch, so it costs next to nothing while tracing is off.
+ *
+ *   uint64_t t = TRACE_START();
+ *   ...
+ *   TRACE_SPAN("parse", t, NULL);
+ */
+extern atomic_int trace_on;
+
+#define TRACE_ENABLED() (atomic_load_explicit(&trace_on, memory_order_relaxed))
+#define TRACE_START() (TRACE_ENABLED() ? foxy_clock_ns() : 0)
+#define TRACE_SPAN(name, start, detail) do { if (TRACE_ENABLED()) trace_span(name, start, detail); } while (0)
+#define TRACE_EVENT(name, detail) do { if (TRACE_ENABLED()) trace_event(name, detail); } while (0)
+
+// FOXY_TRACE=1 turns tracing on; FOXY_TRACE=<file> also dumps there at exit
+void trace_init();
+int trace_set(int on);                  // -1 if the ring cannot be allocated
+void trace_clear();
+
+// name must be a string literal (only the pointer is kept); detail is copied
+void trace_span(const char *name, uint64_t start_ns, const char *detail);
+void trace_event(const char *name, const char *detail);
+
+int trace_dump(const char *path);       // Chrome trace JSON; -1 on error
+void trace_exit();                      // dump to the FOXY_TRACE file, if any
+
+#endif // TRACE_H
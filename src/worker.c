@@ -0,0 +1,118 @@
+#include "worker.h"
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define MAX_JOBS 32
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *arg;
+} job_entry_t;
+
+/*
+ * One long-lived thread, started on the first submit, for work the prompt
+ * should not wait on (indexing PATH, asking git for the branch). Jobs sit in
+ * a small ring; results are handed back by the jobs themselves.
+ */
+static job_entry_t queue[MAX_JOBS];
+static int q_head, q_count;
+static int started;
+
+#ifdef _WIN32
+static CRITICAL_SECTION lock;
+static CONDITION_VARIABLE wake;
+#else
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void worker_loop()
+{
+    while (1)
+    {
+#ifdef _WIN32
+        EnterCriticalSection(&lock);
+        while (q_count == 0) SleepConditionVariableCS(&wake, &lock, INFINITE);
+#else
+        pthread_mutex_lock(&lock);
+        while (q_count == 0) pthread_cond_wait(&wake, &lock);
+#endif
+        job_entry_t job = queue[q_head];
+        q_head = (q_head + 1) % MAX_JOBS;
+        q_count--;
+#ifdef _WIN32
+        LeaveCriticalSection(&lock);
+#else
+        pthread_mutex_unlock(&lock);
+#endif
+        job.fn(job.arg);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(void *unused)
+{
+    (void)unused;
+    worker_loop();
+    return 0;
+}
+#else
+static void *worker_main(void *unused)
+{
+    (void)unused;
+    worker_loop();
+    return NULL;
+}
+#endif
+
+// Called from the main thread only, so no lock is needed yet
+static int worker_start()
+{
+    if (started) return started > 0 ? 0 : -1;
+    started = -1;
+#ifdef _WIN32
+    InitializeCriticalSection(&lock);
+    InitializeConditionVariable(&wake);
+    HANDLE h = CreateThread(NULL, 0, worker_main, NULL, 0, NULL);
+    if (!h) return -1;
+    CloseHandle(h);
+#else
+    pthread_t t;
+    if (pthread_create(&t, NULL, worker_main, NULL) != 0) return -1;
+    pthread_detach(t);
+#endif
+    started = 1;
+    return 0;
+}
+
+int worker_submit(void (*fn)(void *), void *arg)
+{
+    if (worker_start() != 0) return -1;
+
+    int ok = 0;
+#ifdef _WIN32
+    EnterCriticalSection(&lock);
+#else
+    pthread_mutex_lock(&lock);
+#endif
+    if (q_count < MAX_JOBS)
+    {
+        queue[(q_head + q_count) % MAX_JOBS] = (job_entry_t){ fn, arg };
+        q_count++;
+        ok = 1;
+    }
+#ifdef _WIN32
+    LeaveCriticalSection(&lock);
+    if (ok) WakeConditionVariable(&wake);
+#else
+    pthread_mutex_unlock(&lock);
+    if (ok) pthread_cond_signal(&wake);
+#endif
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,9 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+// Queue fn(arg) for the background thread, which runs jobs one at a time in
+// submission order. Returns -1 if the queue is full or no thread could be
+// started; the caller then still owns arg.
+int worker_submit(void (*fn)(void *), void *arg);
+
+#endif // WORKER_H